@@ -0,0 +1,70 @@
+/** @file
+    @brief Mip chains for glyph atlases, with cells sized so that glyphs
+           never bleed into their neighbors at any level.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Standard includes
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+/// @brief Size of an atlas cell that keeps glyphs apart down to a mip level.
+///
+///   Each glyph sits in the top-left corner of its cell.  A cell that is a
+/// multiple of 2^levels texels keeps every texel of every level inside one
+/// cell, so the levels never average two glyphs together.  A gutter of at
+/// least 2^levels texels after the glyph is one whole texel at the smallest
+/// level, which is as far past the glyph's edge as bilinear filtering reads.
+/// @param [in] glyphSize Largest glyph width or height, in texels.
+inline int mipAlignedCellSize(int glyphSize, int levels)
+{
+  int align = 1 << levels;
+  return (glyphSize + 2 * align - 1) / align * align;
+}
+
+/// @brief Append the levels of a mip chain to its base image.
+///
+/// Each level is the one above halved with a 2x2 box filter, which for
+/// glyph coverage is the fraction of the area that is covered.
+/// @param [in,out] chain Holds the 8-bit single-channel base image on
+///                 entry, and levels 1 to levels after it on return.
+/// @param [in] width, height Base image size.  Must be multiples of
+///             2^levels.
+inline void buildMipChain(std::vector<std::vector<uint8_t> >& chain,
+                          int width, int height, int levels)
+{
+  chain.resize(1);
+  for (int level = 1; level <= levels; level++) {
+    const std::vector<uint8_t>& src = chain[level - 1];
+    int srcWidth = width >> (level - 1);
+    int w = srcWidth / 2;
+    int h = (height >> (level - 1)) / 2;
+    std::vector<uint8_t> dst(static_cast<size_t>(w) * h);
+    for (int y = 0; y < h; y++) {
+      const uint8_t* row0 = &src[(2 * y) * srcWidth];
+      const uint8_t* row1 = row0 + srcWidth;
+      for (int x = 0; x < w; x++) {
+        dst[y * w + x] = static_cast<uint8_t>(
+            (row0[2 * x] + row0[2 * x + 1] + row1[2 * x] + row1[2 * x + 1] + 2) / 4);
+      }
+    }
+    chain.push_back(std::move(dst));
+  }
+}
@@ -0,0 +1,283 @@
+/** @file
+    @brief Generator for synthetic umoria-style maps of any size, used to
+           stress the map renderers beyond the small test maps.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "MapGrid.h"
+
+// Standard includes
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <string>
+#include <vector>
+
+/// @brief Knobs for DungeonGenerator.
+struct DungeonParams {
+  int width = 256;            ///< Columns, including the outer wall
+  int height = 256;           ///< Rows, including the outer wall
+  int rooms = 32;             ///< Rooms to try to place
+  float wallDensity = 0.05f;  ///< Fraction of floor turned into pillars
+  int actors = 64;            ///< Monsters wandering the floor
+  float mutationRate = 0.001f;  ///< Fraction of cells changed each turn
+  unsigned seed = 1;          ///< Same seed and knobs give the same maps
+};
+
+/// @brief Builds a map in the format umoria writes, and changes it one
+/// turn at a time.
+///
+///   Rooms are rectangles of floor ('.') joined by one-cell corridors, and
+/// every blank cell touching floor becomes wall ('#'), so the result looks
+/// like a dungeon level drawn by the game.  The outer edge is always wall.
+/// Pillars, stairs, the player ('@') and monsters (letters) are scattered
+/// over the floor.
+///
+///   Each turn the player and every monster take a step, and enough
+/// floor cells are changed between floor, item and pillar to reach the
+/// mutation rate, so the renderers see the sort of churn a busy level has.
+class DungeonGenerator {
+public:
+  explicit DungeonGenerator(const DungeonParams& params)
+      : params(params), rng(params.seed) {
+    generate();
+  }
+
+  /// @brief The current map.
+  const MapGrid& map() const { return grid; }
+
+  /// @brief The current map as the text of a map file.
+  std::string text() const {
+    std::string out;
+    out.reserve((grid.width + 1) * grid.height);
+    for (int r = 0; r < grid.height; r++) {
+      out.append(&grid.cells[r * grid.width], grid.width);
+      out.push_back('\n');
+    }
+    return out;
+  }
+
+  /// @brief Advance one turn.
+  /// @return The number of cells that changed.
+  size_t step() {
+    size_t changed = 0;
+    changed += moveActor(player);
+    for (Actor& a : monsters) {
+      changed += moveActor(a);
+    }
+    grid.playerRow = player.row;
+    grid.playerCol = player.col;
+
+    size_t target = static_cast<size_t>(params.mutationRate *
+                                        grid.width * grid.height);
+    static const char items[] = "!?$=\"-_|~&*";
+    for (size_t tries = 0; changed < target && tries < 4 * target + 16;
+         tries++) {
+      int r = randomInt(1, grid.height - 2);
+      int c = randomInt(1, grid.width - 2);
+      char& cell = grid.cells[r * grid.width + c];
+      switch (cell) {
+      case '.':
+        cell = (uniform() < 0.5f) ? '#' : items[randomInt(0, sizeof(items) - 2)];
+        changed++;
+        break;
+      case '#':
+        // Only knock down pillars, so the rooms keep their shape.
+        if (isPillar(r, c)) {
+          cell = '.';
+          changed++;
+        }
+        break;
+      default:
+        if (cell != '\0' && std::strchr(items, cell)) {
+          cell = '.';
+          changed++;
+        }
+        break;
+      }
+    }
+    return changed;
+  }
+
+private:
+  struct Actor {
+    int row;
+    int col;
+    char glyph;
+  };
+
+  DungeonParams params;
+  std::mt19937 rng;
+  MapGrid grid;
+  Actor player;
+  std::vector<Actor> monsters;
+
+  int randomInt(int lo, int hi) {
+    return std::uniform_int_distribution<int>(lo, hi)(rng);
+  }
+
+  float uniform() {
+    return std::uniform_real_distribution<float>(0.0f, 1.0f)(rng);
+  }
+
+  char& cell(int r, int c) { return grid.cells[r * grid.width + c]; }
+
+  bool isPillar(int r, int c) const {
+    // A pillar is wall with floor on both sides in some direction.
+    return (grid.at(r - 1, c) == '.' && grid.at(r + 1, c) == '.') ||
+           (grid.at(r, c - 1) == '.' && grid.at(r, c + 1) == '.');
+  }
+
+  void carveRoom(int r0, int c0, int r1, int c1) {
+    for (int r = r0; r <= r1; r++) {
+      for (int c = c0; c <= c1; c++) {
+        cell(r, c) = '.';
+      }
+    }
+  }
+
+  /// @brief Carve a straight run of floor between two cells in a line.
+  void carveLine(int r0, int c0, int r1, int c1) {
+    carveRoom(std::min(r0, r1), std::min(c0, c1), std::max(r0, r1),
+              std::max(c0, c1));
+  }
+
+  /// @brief Carve an L-shaped corridor, turning at a random corner.
+  void carveCorridor(int r0, int c0, int r1, int c1) {
+    int turnR = r0;
+    int turnC = c1;
+    if (uniform() < 0.5f) {
+      turnR = r1;
+      turnC = c0;
+    }
+    carveLine(r0, c0, turnR, turnC);
+    carveLine(turnR, turnC, r1, c1);
+  }
+
+  /// @brief Pick a random floor cell.
+  bool randomFloor(int& row, int& col) {
+    for (int tries = 0; tries < 10000; tries++) {
+      row = randomInt(1, grid.height - 2);
+      col = randomInt(1, grid.width - 2);
+      if (cell(row, col) == '.') {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void generate() {
+    grid.width = std::max(params.width, 8);
+    grid.height = std::max(params.height, 8);
+    grid.cells.assign(static_cast<size_t>(grid.width) * grid.height, ' ');
+
+    // Rooms, each joined to the one before it.
+    int lastR = -1;
+    int lastC = -1;
+    for (int i = 0; i < std::max(params.rooms, 1); i++) {
+      int h = randomInt(3, std::max(3, std::min(12, grid.height / 4)));
+      int w = randomInt(4, std::max(4, std::min(30, grid.width / 4)));
+      int r0 = randomInt(2, std::max(2, grid.height - h - 3));
+      int c0 = randomInt(2, std::max(2, grid.width - w - 3));
+      int r1 = std::min(r0 + h, grid.height - 3);
+      int c1 = std::min(c0 + w, grid.width - 3);
+      carveRoom(r0, c0, r1, c1);
+      int midR = (r0 + r1) / 2;
+      int midC = (c0 + c1) / 2;
+      if (lastR >= 0) {
+        carveCorridor(lastR, lastC, midR, midC);
+      }
+      lastR = midR;
+      lastC = midC;
+    }
+
+    // Walls wherever rock touches floor, and all around the edge.
+    std::vector<char> carved = grid.cells;
+    for (int r = 0; r < grid.height; r++) {
+      for (int c = 0; c < grid.width; c++) {
+        if (r == 0 || c == 0 || r == grid.height - 1 || c == grid.width - 1) {
+          cell(r, c) = '#';
+          continue;
+        }
+        if (carved[r * grid.width + c] != ' ') {
+          continue;
+        }
+        for (int dr = -1; dr <= 1; dr++) {
+          for (int dc = -1; dc <= 1; dc++) {
+            if (carved[(r + dr) * grid.width + c + dc] == '.') {
+              cell(r, c) = '#';
+            }
+          }
+        }
+      }
+    }
+
+    // Pillars.
+    size_t floorCells = std::count(grid.cells.begin(), grid.cells.end(), '.');
+    size_t pillars = static_cast<size_t>(params.wallDensity * floorCells);
+    int r, c;
+    for (size_t i = 0; i < pillars && randomFloor(r, c); i++) {
+      cell(r, c) = '#';
+    }
+
+    if (randomFloor(r, c)) {
+      cell(r, c) = '>';
+    }
+    if (randomFloor(r, c)) {
+      cell(r, c) = '<';
+    }
+
+    player.glyph = '@';
+    player.row = player.col = 1;
+    if (randomFloor(r, c)) {
+      player.row = r;
+      player.col = c;
+      cell(r, c) = '@';
+    }
+    grid.playerRow = player.row;
+    grid.playerCol = player.col;
+
+    static const char kinds[] = "abcdefghijklmnopqrstuvwxyzCDGHJKLMOPRTUWZ";
+    for (int i = 0; i < params.actors && randomFloor(r, c); i++) {
+      Actor a;
+      a.row = r;
+      a.col = c;
+      a.glyph = kinds[randomInt(0, sizeof(kinds) - 2)];
+      cell(r, c) = a.glyph;
+      monsters.push_back(a);
+    }
+  }
+
+  /// @brief Move an actor one step onto an adjacent floor cell, if any.
+  /// @return The number of cells that changed.
+  size_t moveActor(Actor& a) {
+    static const int steps[8][2] = { { -1, -1 }, { -1, 0 }, { -1, 1 }, { 0, -1 },
+                                     { 0, 1 },   { 1, -1 }, { 1, 0 },  { 1, 1 } };
+    const int* s = steps[randomInt(0, 7)];
+    int r = a.row + s[0];
+    int c = a.col + s[1];
+    if (grid.at(r, c) != '.') {
+      return 0;
+    }
+    cell(a.row, a.col) = '.';
+    a.row = r;
+    a.col = c;
+    cell(r, c) = a.glyph;
+    return 2;
+  }
+};
@@ -0,0 +1,319 @@
+/** @file
+    @brief Always-on flight recorder: keeps the last few thousand frames of
+           phase timings and events in a fixed ring, and writes the seconds
+           before any frame-time spike out as a trace file.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Standard includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// @brief Number of allocations made by the program so far.
+///
+///   Only counted by programs that replace the global operator new with
+/// one that calls countedAllocate().
+inline std::atomic<uint64_t>& allocationCount()
+{
+  static std::atomic<uint64_t> count(0);
+  return count;
+}
+
+/// @brief Allocate as the global operator new does, counting it.
+inline void* countedAllocate(std::size_t size)
+{
+  allocationCount().fetch_add(1, std::memory_order_relaxed);
+  void* p = std::malloc(size ? size : 1);
+  if (!p) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+/// @brief One entry in the flight recorder's ring.
+struct FlightEvent {
+  enum Kind {
+    FRAME,    ///< A whole frame, from start to duration
+    PHASE,    ///< Part of a frame, on one of a few tracks
+    COUNTER,  ///< A number sampled at a time
+    MARK      ///< Something that happened at a time, with a number
+  };
+
+  Kind kind = FRAME;
+  int track = 0;               ///< Of a phase, such as 0 for the render thread
+  const char* name = "";       ///< Must outlive the recorder, as literals do
+  int64_t startNs = 0;         ///< Since the recorder was created
+  int64_t value = 0;           ///< Duration in ns, or the number recorded
+};
+
+/// @brief Keeps recent frames in memory and writes them out when a frame
+/// takes much longer than usual.
+///
+///   Recording is cheap enough to leave on: each call fills in the next
+/// slot of a ring allocated up front.  Each frame's time is compared with
+/// the median of the last MEDIAN_FRAMES; one that takes spikeFactor times
+/// as long has the last dumpSeconds of the ring copied out and handed to a
+/// background thread, which writes it as a Chrome trace file (JSON, for
+/// chrome://tracing or Perfetto).  After a dump no other is started for
+/// dumpSeconds, and at most maxDumps are written.
+///
+///   All recording calls must come from one thread, normally the render
+/// loop's.
+class FlightRecorder {
+public:
+  typedef std::chrono::steady_clock Clock;
+  enum { MEDIAN_FRAMES = 128 };
+
+  double spikeFactor = 3;        ///< Of the median frame time
+  double dumpSeconds = 5;        ///< History written for each spike
+  std::string prefix = "flight"; ///< Traces are prefix-N.json
+  size_t maxDumps = 20;
+
+  /// @param [in] capacity Events kept in the ring.
+  explicit FlightRecorder(size_t capacity = 1 << 16)
+    : ring(capacity), epoch(Clock::now()) {}
+
+  ~FlightRecorder() { stop(); }
+
+  /// @brief Record part of a frame.
+  /// @param [in] track Keeps phases that may overlap apart, such as those
+  ///        on different threads.
+  void phase(const char* name, Clock::time_point start, Clock::time_point end,
+             int track = 0) {
+    FlightEvent& e = next(FlightEvent::PHASE, name, start);
+    e.track = track;
+    e.value = ns(end - start);
+  }
+
+  /// @brief Record a number, such as a count or a query result.
+  void counter(const char* name, int64_t value,
+               Clock::time_point when = Clock::now()) {
+    next(FlightEvent::COUNTER, name, when).value = value;
+  }
+
+  /// @brief Record that something happened, such as the map changing.
+  void mark(const char* name, int64_t value = 0,
+            Clock::time_point when = Clock::now()) {
+    next(FlightEvent::MARK, name, when).value = value;
+  }
+
+  /// @brief Record a whole frame, and write out the recent past if it took
+  /// much longer than usual.
+  /// @param [in] typical False for frames that are expected to be slow, such
+  ///        as ones that sleep while there is nothing to draw, which are
+  ///        recorded but not checked.
+  /// @return True if a trace is being written because of this frame.
+  bool frame(Clock::time_point start, Clock::time_point end, bool typical = true) {
+    FlightEvent& e = next(FlightEvent::FRAME, "frame", start);
+    e.value = ns(end - start);
+    if (!typical) {
+      return false;
+    }
+    double seconds = std::chrono::duration<double>(end - start).count();
+    bool spike = false;
+    double median = 0;
+    if (recentCount == MEDIAN_FRAMES) {
+      std::copy(recent, recent + MEDIAN_FRAMES, sorted);
+      std::nth_element(sorted, sorted + MEDIAN_FRAMES / 2, sorted + MEDIAN_FRAMES);
+      median = sorted[MEDIAN_FRAMES / 2];
+      spike = seconds > spikeFactor * median;
+    }
+    recent[recentNext] = seconds;
+    recentNext = (recentNext + 1) % MEDIAN_FRAMES;
+    recentCount = std::min<size_t>(recentCount + 1, MEDIAN_FRAMES);
+    if (!spike) {
+      return false;
+    }
+    spikes++;
+    if (dumps >= maxDumps ||
+        (dumps > 0 && end - lastDump < std::chrono::duration<double>(dumpSeconds))) {
+      return false;
+    }
+    lastDump = end;
+    dump(end, seconds, median);
+    return true;
+  }
+
+  /// @brief Wait for any traces still being written.
+  void stop() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_one();
+    if (writer.joinable()) {
+      writer.join();
+    }
+  }
+
+  /// @brief Print how many spikes were seen and traces written.
+  void printStats(std::ostream& out) const {
+    out << "Flight recorder: " << spikes << " frame-time spikes, " << dumps
+        << " traces written";
+    if (dumps > 0) {
+      out << " to " << prefix << "-*.json";
+    }
+    out << std::endl;
+  }
+
+private:
+  FlightRecorder(const FlightRecorder&) = delete;
+  FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+  struct Dump {
+    std::string fileName;
+    double frameSeconds;
+    double medianSeconds;
+    std::vector<FlightEvent> events;
+  };
+
+  std::vector<FlightEvent> ring;
+  size_t ringNext = 0;
+  size_t ringCount = 0;
+  Clock::time_point epoch;
+
+  double recent[MEDIAN_FRAMES];   ///< Frame times in seconds, a ring
+  double sorted[MEDIAN_FRAMES];   ///< Scratch for finding the median
+  size_t recentNext = 0;
+  size_t recentCount = 0;
+  uint64_t spikes = 0;
+  size_t dumps = 0;
+  Clock::time_point lastDump;
+
+  std::thread writer;             ///< Started with the first dump
+  std::mutex mutex;               ///< Guards the fields below
+  std::condition_variable wake;
+  std::deque<Dump> queue;
+  bool stopping = false;
+
+  int64_t ns(Clock::duration d) const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+  }
+
+  FlightEvent& next(FlightEvent::Kind kind, const char* name,
+                    Clock::time_point when) {
+    FlightEvent& e = ring[ringNext];
+    ringNext = (ringNext + 1) % ring.size();
+    ringCount = std::min(ringCount + 1, ring.size());
+    e.kind = kind;
+    e.track = 0;
+    e.name = name;
+    e.startNs = ns(when - epoch);
+    e.value = 0;
+    return e;
+  }
+
+  /// @brief Copy the events since dumpSeconds before end, oldest first,
+  /// and queue them to be written.
+  void dump(Clock::time_point end, double frameSeconds, double medianSeconds) {
+    int64_t from = ns(end - epoch) -
+        static_cast<int64_t>(dumpSeconds * 1e9);
+    size_t n = 0;
+    while (n < ringCount &&
+           ring[(ringNext + ring.size() - 1 - n) % ring.size()].startNs >= from) {
+      n++;
+    }
+    Dump d;
+    std::ostringstream name;
+    name << prefix << "-" << dumps++ << ".json";
+    d.fileName = name.str();
+    d.frameSeconds = frameSeconds;
+    d.medianSeconds = medianSeconds;
+    d.events.reserve(n);
+    for (size_t i = n; i > 0; i--) {
+      d.events.push_back(ring[(ringNext + ring.size() - i) % ring.size()]);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      queue.push_back(std::move(d));
+      if (!writer.joinable()) {
+        writer = std::thread([this]() { writeLoop(); });
+      }
+    }
+    wake.notify_one();
+  }
+
+  void writeLoop() {
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+      wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+      if (queue.empty()) {
+        return;
+      }
+      Dump d = std::move(queue.front());
+      queue.pop_front();
+      lock.unlock();
+      write(d);
+      lock.lock();
+    }
+  }
+
+  static void write(const Dump& d) {
+    std::ofstream out(d.fileName.c_str());
+    if (!out.is_open()) {
+      std::cerr << "FlightRecorder: Could not create " + d.fileName + "\n"
+                << std::flush;
+      return;
+    }
+    // Chrome's trace event format, in microseconds.
+    out << "{\"otherData\":{\"frameMs\":" << d.frameSeconds * 1e3
+        << ",\"medianFrameMs\":" << d.medianSeconds * 1e3
+        << "},\n\"traceEvents\":[";
+    const char* separator = "\n";
+    for (const FlightEvent& e : d.events) {
+      out << separator << "{\"name\":\"" << e.name << "\",\"pid\":1,\"ts\":"
+          << e.startNs / 1e3;
+      switch (e.kind) {
+      case FlightEvent::FRAME:
+        out << ",\"ph\":\"X\",\"tid\":0,\"dur\":" << e.value / 1e3;
+        break;
+      case FlightEvent::PHASE:
+        out << ",\"ph\":\"X\",\"tid\":" << e.track + 1
+            << ",\"dur\":" << e.value / 1e3;
+        break;
+      case FlightEvent::COUNTER:
+        out << ",\"ph\":\"C\",\"tid\":0,\"args\":{\"value\":" << e.value << "}";
+        break;
+      case FlightEvent::MARK:
+        out << ",\"ph\":\"i\",\"s\":\"g\",\"tid\":0,\"args\":{\"value\":"
+            << e.value << "}";
+        break;
+      }
+      out << "}";
+      separator = ",\n";
+    }
+    out << "\n]}\n";
+    if (!out) {
+      std::cerr << "FlightRecorder: Could not write " + d.fileName + "\n"
+                << std::flush;
+    }
+  }
+};
@@ -0,0 +1,185 @@
+/** @file
+    @brief Vertex layout and quad builders shared by the text renderers.
+           Kept free of OpenGL so that the CPU side can be benchmarked.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Library/third-party includes
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define FONT_QUADS_USE_SSE
+#endif
+
+// Standard includes
+#include <cstddef>
+#include <vector>
+
+/// @brief Structure to hold OpenGL vertex buffer data.
+class FontVertex {
+public:
+  float pos[3];   ///< Location of the vertexre
+  float col[4];   ///< Color of the vertex (red, green, blue, alpha)
+  float tex[2];   ///< Texture coordinates for the vertex
+};
+
+/// @brief Planes a glyph quad can lie in.
+static const int XY = 0;
+static const int XZ = 1;
+static const int YZ = 2;
+
+/// @brief Where the two in-plane axes and the depth axis of a plane land
+/// in X, Y and Z.
+///
+///   The horizontal axis is the one the text reads along and the vertical
+/// axis is the one its top points along: X and Y for XY, X and Z for XZ,
+/// and Z and Y for YZ.
+template <int Plane> struct FontQuadAxes;
+template <> struct FontQuadAxes<XY> { enum { H = 0, V = 1, D = 2 }; };
+template <> struct FontQuadAxes<XZ> { enum { H = 0, V = 2, D = 1 }; };
+template <> struct FontQuadAxes<YZ> { enum { H = 2, V = 1, D = 0 }; };
+
+#ifdef FONT_QUADS_USE_SSE
+/// @brief Pack one corner's position, in X, Y, Z order, followed by red,
+/// which is how the first four floats of a FontVertex are laid out.
+template <int Plane>
+inline __m128 fontQuadPositionAndRed(float h, float v, float d, float R)
+{
+  typedef FontQuadAxes<Plane> Axes;
+  if (Axes::H == 0 && Axes::V == 1) {
+    return _mm_setr_ps(h, v, d, R);
+  } else if (Axes::H == 0) {
+    return _mm_setr_ps(h, d, v, R);
+  }
+  return _mm_setr_ps(d, v, h, R);
+}
+#endif
+
+/// @brief Write the six vertices of one glyph quad lying in a plane.
+///
+///   This is the kernel behind the addFontQuad helpers and the map
+/// meshers.  The plane is a template parameter so that each caller gets
+/// straight-line code with no branch per vertex, and it writes through a
+/// pointer into space the caller has already allocated, so a run of quads
+/// does no capacity checks.  With SSE the six vertices are written
+/// unrolled, two vector stores and one scalar store each.
+///
+///   Corners are given in the plane's own axes (see FontQuadAxes), and
+/// bottom need not be below top nor left to the left of right, which is
+/// how the callers flip a glyph to face the other way.  The triangles are
+/// wound clockwise as seen with left towards -H and top towards +V, and
+/// texture row t1 lands on the bottom edge so glyph bitmaps, whose first
+/// row is their top, come out right-side up.
+/// @param [out] out Where to write the six vertices.
+/// @return The vertex after the last one written.
+template <int Plane>
+inline FontVertex* emitFontQuad(FontVertex* out,
+  float left, float right, float bottom, float top, float depth,
+  float s0, float t0, float s1, float t1,
+  float R, float G, float B, float alpha)
+{
+#ifdef FONT_QUADS_USE_SSE
+  // Each vertex is nine floats: position and red, then green, blue, alpha
+  // and s, then t.  The middle four only depend on left or right.
+  float* f = out->pos;
+  const __m128 leftRest = _mm_setr_ps(G, B, alpha, s0);
+  const __m128 rightRest = _mm_setr_ps(G, B, alpha, s1);
+  _mm_storeu_ps(f + 0, fontQuadPositionAndRed<Plane>(left, bottom, depth, R));
+  _mm_storeu_ps(f + 4, leftRest);
+  f[8] = t1;
+  _mm_storeu_ps(f + 9, fontQuadPositionAndRed<Plane>(right, top, depth, R));
+  _mm_storeu_ps(f + 13, rightRest);
+  f[17] = t0;
+  _mm_storeu_ps(f + 18, fontQuadPositionAndRed<Plane>(right, bottom, depth, R));
+  _mm_storeu_ps(f + 22, rightRest);
+  f[26] = t1;
+  _mm_storeu_ps(f + 27, fontQuadPositionAndRed<Plane>(left, bottom, depth, R));
+  _mm_storeu_ps(f + 31, leftRest);
+  f[35] = t1;
+  _mm_storeu_ps(f + 36, fontQuadPositionAndRed<Plane>(left, top, depth, R));
+  _mm_storeu_ps(f + 40, leftRest);
+  f[44] = t0;
+  _mm_storeu_ps(f + 45, fontQuadPositionAndRed<Plane>(right, top, depth, R));
+  _mm_storeu_ps(f + 49, rightRest);
+  f[53] = t0;
+#else
+  typedef FontQuadAxes<Plane> Axes;
+  const float h[6] = { left, right, right, left, left, right };
+  const float v[6] = { bottom, top, bottom, bottom, top, top };
+  const float s[6] = { s0, s1, s1, s0, s0, s1 };
+  const float t[6] = { t1, t0, t1, t1, t0, t0 };
+  for (int k = 0; k < 6; k++) {
+    FontVertex& vert = out[k];
+    vert.pos[Axes::H] = h[k];
+    vert.pos[Axes::V] = v[k];
+    vert.pos[Axes::D] = depth;
+    vert.col[0] = R; vert.col[1] = G; vert.col[2] = B; vert.col[3] = alpha;
+    vert.tex[0] = s[k];
+    vert.tex[1] = t[k];
+  }
+#endif
+  return out + 6;
+}
+
+/// @brief Helper function for render_text.
+/// @param [out] vertexBufferData OpenGL vertex buffer data to be rendered
+///             for a single character of text onto a quadrilateral.
+///
+///   The quadrilateral will be in the X-Y plane whose depth is specified.
+/// It will be axis aligned, with the character reading towards +X with
+/// its top rendered towards +Y.
+///   The quadrilateral is rendered into whatever space is defined by
+/// the projection and model/view transforms being used by the shader.
+///
+/// @param [in] left Furthest left (-x) on the Quadrilateral
+/// @param [in] right Furthest right (+x) on the Quadrilateral
+/// @param [in] top Furthest up (+y) on the Quadrilateral
+/// @param [in] bottom Furthest down (-y) on the Quadrilateral
+/// @param [in] depth Z value of the quadrilateral.
+inline void addFontQuad(std::vector<FontVertex> &vertexBufferData,
+  float left, float right, float top, float bottom, float depth,
+  float R, float G, float B, float alpha)
+{
+  size_t first = vertexBufferData.size();
+  vertexBufferData.resize(first + 6);
+  emitFontQuad<XY>(&vertexBufferData[first], left, right, bottom, top, depth,
+                   0, 0, 1, 1, R, G, B, alpha);
+}
+
+/// @brief As addFontQuad(), but lying in the X-Z plane at height y, reading
+/// towards +X with its top towards maxZ.
+inline void addFontQuadXZ(std::vector<FontVertex>& vertexBufferData,
+    float left, float right, float y, float maxZ, float minZ,
+    float R, float G, float B, float alpha)
+{
+  size_t first = vertexBufferData.size();
+  vertexBufferData.resize(first + 6);
+  emitFontQuad<XZ>(&vertexBufferData[first], left, right, minZ, maxZ, y,
+                   0, 0, 1, 1, R, G, B, alpha);
+}
+
+/// @brief As addFontQuad(), but lying in the Y-Z plane at x, reading
+/// towards maxZ with its top towards +Y.
+inline void addFontQuadYZ(std::vector<FontVertex>& vertexBufferData,
+    float x, float top, float bot, float maxZ, float minZ,
+    float R, float G, float B, float alpha)
+{
+  size_t first = vertexBufferData.size();
+  vertexBufferData.resize(first + 6);
+  emitFontQuad<YZ>(&vertexBufferData[first], minZ, maxZ, bot, top, x,
+                   0, 0, 1, 1, R, G, B, alpha);
+}
@@ -0,0 +1,183 @@
+/** @file
+    @brief Just-in-time frame starts: waits to sample the inputs until just
+           long enough before the next vertical sync to render the frame,
+           so that the pose it is drawn with is as fresh as possible.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "LatencyHistogram.h"
+
+// Standard includes
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+
+/// @brief Decides when to start each frame when presenting blocks until
+/// the vertical sync.
+///
+///   Started as soon as the last one returns, a frame renders in a few
+/// milliseconds and then waits for the sync, showing a pose sampled nearly
+/// a whole refresh earlier.  Instead, the render time of the next frame,
+/// from its start until the GPU has finished drawing it, is predicted from
+/// a moving average over recent frames, and the frame starts that long plus
+/// a safety margin before the sync it is aiming for.
+///
+///   The syncs are found from when presenting returns: the refresh period
+/// is the average interval between returns, leaving out intervals that
+/// skipped a sync, and the latest return gives the phase.  Until two have
+/// been seen, frames start at once.  The syncs that intervals skipped are
+/// counted as dropped frames.
+///
+///   The period is seeded from the shortest of the first few intervals, so
+/// that a stall at startup is not taken for the period.  Should the period
+/// still come out a multiple of the real one, every real interval would
+/// look too short to average in; a run of them re-seeds the period from the
+/// shortest of the run.
+class FrameScheduler {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  double weight = 0.1;  ///< Of each new frame in the moving averages
+  Clock::duration margin = std::chrono::milliseconds(2);
+
+  FrameScheduler() {}
+
+  /// @brief Sleep until it is time to start the next frame.
+  /// @return When the frame started, after any sleep.
+  Clock::time_point waitForStart() {
+    Clock::time_point now = Clock::now();
+    if (period <= 0) {
+      target = Clock::time_point();
+      return now;
+    }
+    // Aim for the first sync that can be made from now.
+    Clock::duration lead = predictedRenderTime() + margin;
+    Clock::duration periodTime = seconds(period);
+    Clock::duration ahead = now + lead - lastSync;
+    int64_t syncs = ahead.count() <= 0 ? 1
+        : (ahead.count() + periodTime.count() - 1) / periodTime.count();
+    target = lastSync + syncs * periodTime;
+    Clock::time_point start = target - lead;
+    if (start > now) {
+      std::this_thread::sleep_until(start);
+      now = Clock::now();
+    }
+    return now;
+  }
+
+  /// @brief Record how long a frame took from its start until the GPU had
+  /// finished drawing it.
+  void rendered(Clock::duration renderTime) {
+    double s = std::chrono::duration<double>(renderTime).count();
+    renderSeconds =
+        (renderSeconds == 0) ? s : renderSeconds + weight * (s - renderSeconds);
+  }
+
+  /// @brief Record that the frame started at start was presented, that is,
+  /// that presenting it returned at shown.
+  void presented(Clock::time_point start, Clock::time_point shown) {
+    if (haveSync) {
+      double interval = std::chrono::duration<double>(shown - lastSync).count();
+      if (seedIntervals < SEED_INTERVALS) {
+        period = (seedIntervals == 0) ? interval : std::min(period, interval);
+        seedIntervals++;
+      } else if (interval <= 0.5 * period) {
+        shortest = (shortIntervals == 0) ? interval : std::min(shortest, interval);
+        if (++shortIntervals >= SEED_INTERVALS) {
+          period = shortest;
+          shortIntervals = 0;
+        }
+      } else {
+        shortIntervals = 0;
+        if (interval < 1.5 * period) {
+          period += weight * (interval - period);
+        } else {
+          dropped += static_cast<uint64_t>(interval / period + 0.5) - 1;
+        }
+      }
+    }
+    haveSync = true;
+    lastSync = shown;
+    poseAge.add(shown - start);
+    if (target != Clock::time_point()) {
+      frames++;
+      if (shown > target + seconds(period / 2)) {
+        missed++;
+      }
+    }
+  }
+
+  /// @brief Record that a frame was not presented on purpose, such as one
+  /// that had nothing new to show, so that the wait until the next one is
+  /// not taken for dropped frames.
+  void skipped() { haveSync = false; }
+
+  /// @brief Refreshes that showed an old frame because a new one was late.
+  uint64_t droppedFrames() const { return dropped; }
+
+  /// @brief Seconds between syncs, or 0 until two presents have been seen.
+  double refreshPeriod() const { return period; }
+
+  /// @brief The render time the next frame is expected to take.
+  Clock::duration predictedRenderTime() const {
+    return seconds(renderSeconds);
+  }
+
+  /// @brief Print the refresh period, how old the inputs were when their
+  /// frames were shown, how many frames were dropped and, for frames that
+  /// were scheduled, the render time and how many missed their sync.
+  void print(std::ostream& out) const {
+    if (poseAge.count() == 0) {
+      return;
+    }
+    out << "Frame starts: " << period * 1e3 << " ms refresh";
+    if (frames > 0) {
+      out << ", " << renderSeconds * 1e3 << " ms predicted render time, "
+          << missed << " of " << frames << " frames missed their sync ("
+          << 100.0 * missed / frames << "%)";
+    }
+    out << ", " << dropped << " dropped frames";
+    out << std::endl;
+    poseAge.print(out, "Pose age at presentation");
+  }
+
+private:
+  FrameScheduler(const FrameScheduler&) = delete;
+  FrameScheduler& operator=(const FrameScheduler&) = delete;
+
+  double renderSeconds = 0;   ///< Moving average of the render time
+  double period = 0;          ///< Seconds between syncs, 0 until known
+  enum { SEED_INTERVALS = 4 };
+  int seedIntervals = 0;      ///< Intervals the period was seeded from
+  int shortIntervals = 0;     ///< Intervals in a row under half the period
+  double shortest = 0;        ///< Shortest of those
+  bool haveSync = false;
+  Clock::time_point lastSync;
+  Clock::time_point target;   ///< Sync the current frame aims for, if any
+  uint64_t frames = 0;        ///< Frames that aimed for a sync
+  uint64_t missed = 0;
+  uint64_t dropped = 0;       ///< Syncs skipped between presents
+  LatencyHistogram poseAge;
+
+  static Clock::duration seconds(double s) {
+    return std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(s));
+  }
+};
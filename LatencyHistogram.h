@@ -0,0 +1,122 @@
+/** @file
+    @brief Lock-free histogram of latencies in power-of-two microsecond
+           buckets, for reporting tails such as the 99th percentile.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Standard includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+/// @brief Counts of latencies, bucketed by powers of two.
+///
+///   Bucket 0 holds latencies of up to 1 us and bucket i holds those over
+/// 2^(i-1) and up to 2^i us, compared in nanoseconds, so a percentile is
+/// known to within a factor of two, which is enough to tell a long tail
+/// from a short one.  The maximum and the sum are kept exactly.  add()
+/// may be called from any number of threads at once; the counts are
+/// relaxed atomics, so a report made while samples are being added may be
+/// a few samples behind.
+class LatencyHistogram {
+public:
+  enum { BUCKETS = 32 };
+
+  LatencyHistogram() {
+    for (int i = 0; i < BUCKETS; i++) {
+      buckets[i] = 0;
+    }
+  }
+
+  /// @brief Count one latency.  Negative ones count as zero.
+  template <typename Rep, typename Period>
+  void add(std::chrono::duration<Rep, Period> latency) {
+    int64_t ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(latency).count();
+    uint64_t exact = ns > 0 ? static_cast<uint64_t>(ns) : 0;
+    int bucket = 0;
+    while (bucket < BUCKETS - 1 && exact > (uint64_t(1000) << bucket)) {
+      bucket++;
+    }
+    buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(exact, std::memory_order_relaxed);
+    uint64_t value = exact / 1000;
+    uint64_t old = largest.load(std::memory_order_relaxed);
+    while (value > old &&
+           !largest.compare_exchange_weak(old, value, std::memory_order_relaxed)) {
+    }
+  }
+
+  uint64_t count() const {
+    uint64_t n = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+      n += buckets[i].load(std::memory_order_relaxed);
+    }
+    return n;
+  }
+
+  /// @brief Upper bound of the bucket holding a percentile, in us.
+  /// @param [in] p From 0 to 100.
+  uint64_t percentile(double p) const {
+    uint64_t n = count();
+    if (n == 0) {
+      return 0;
+    }
+    uint64_t rank = static_cast<uint64_t>(p / 100.0 * n + 0.5);
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+      seen += buckets[i].load(std::memory_order_relaxed);
+      if (seen >= rank && seen > 0) {
+        return std::min(uint64_t(1) << i, maximum());
+      }
+    }
+    return maximum();
+  }
+
+  /// @brief Largest latency added, in us.
+  uint64_t maximum() const { return largest.load(std::memory_order_relaxed); }
+
+  /// @brief Sum of the latencies added, in ns.
+  uint64_t sum() const { return total.load(std::memory_order_relaxed); }
+
+  /// @brief Number of latencies in bucket i; see the class comment.
+  uint64_t bucketCount(int i) const {
+    return buckets[i].load(std::memory_order_relaxed);
+  }
+
+  /// @brief Print one line of the count, median, tail and maximum.
+  void print(std::ostream& out, const char* name) const {
+    uint64_t n = count();
+    if (n == 0) {
+      return;
+    }
+    out << name << ": " << n << " samples, 50% within " << percentile(50)
+        << " us, 99% within " << percentile(99) << " us, 99.9% within "
+        << percentile(99.9) << " us, max " << maximum() << " us" << std::endl;
+  }
+
+private:
+  LatencyHistogram(const LatencyHistogram&) = delete;
+  LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+  std::atomic<uint64_t> buckets[BUCKETS];
+  std::atomic<uint64_t> largest{ 0 };
+  std::atomic<uint64_t> total{ 0 };  ///< In ns
+};
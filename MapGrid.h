@@ -0,0 +1,249 @@
+/** @file
+    @brief Parsed form of the text maps written by umoria, along with the
+           tile table that says how each map character is drawn.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Standard includes
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+/// @brief How a map character is turned into geometry.
+///
+///   This is the tile table shared by the CPU path (render_text per cell)
+/// and the GPU path (vertex pulling from the map texture), so the two
+/// always agree on what a character looks like.  The numeric values are
+/// also used inside the terrain shader, so do not reorder them.
+enum TileKind {
+  TILE_NONE = 0,    ///< Nothing is drawn (blank, line ending)
+  TILE_WALL = 1,    ///< draw_box-style glyph on the four vertical faces
+  TILE_FLOOR = 2,   ///< Glyph lying in the X-Z plane
+  TILE_GLYPH = 3    ///< Glyph standing up in the X-Y plane
+};
+
+/// @brief Look up the tile kind for a map character.
+inline TileKind tileKindFor(char c)
+{
+  switch (c) {
+  case '#':
+    return TILE_WALL;
+  case '.':
+    return TILE_FLOOR;
+  case ' ':
+  case '\r':
+  case '\n':
+  case '\0':
+    return TILE_NONE;
+  default:
+    return TILE_GLYPH;
+  }
+}
+
+/// @brief A map as a rectangular grid of characters.
+///
+///   Rows are the lines of the file and columns are the characters within
+/// a line.  Short lines are padded with blanks so that every row has the
+/// same width.  The location of the player ('@') is found while parsing so
+/// that callers do not need a second pass over the file.
+class MapGrid {
+public:
+  int width = 0;      ///< Number of columns (longest line)
+  int height = 0;     ///< Number of rows (lines)
+  int playerRow = 0;  ///< Row holding '@', or 0 if there is none
+  int playerCol = 0;  ///< Column holding '@', or 0 if there is none
+  std::vector<char> cells;  ///< Row-major, width * height characters
+
+  /// @brief Character at a cell, or blank when off the map.
+  char at(int row, int col) const {
+    if (row < 0 || col < 0 || row >= height || col >= width) {
+      return ' ';
+    }
+    return cells[row * width + col];
+  }
+
+  /// @brief Whether a face of a wall cell is left uncovered, that is,
+  /// whether the neighbor on that side is not itself a wall.
+  /// @param [in] face 0 is +X, 1 is -X, 2 is +Z and 3 is -Z.
+  bool wallFaceShown(int row, int col, int face) const {
+    static const int offsets[4][2] = { { 1, 0 }, { -1, 0 }, { 0, -1 }, { 0, 1 } };
+    return tileKindFor(at(row + offsets[face][0], col + offsets[face][1])) !=
+           TILE_WALL;
+  }
+
+  bool operator==(const MapGrid& other) const {
+    return width == other.width && height == other.height &&
+           playerRow == other.playerRow && playerCol == other.playerCol &&
+           cells == other.cells;
+  }
+
+  /// @brief Parse a map from the text of a map file.
+  void parse(const std::string& text) {
+    // First pass finds the size so we only allocate once.
+    int rows = 0;
+    int cols = 0;
+    int longest = 0;
+    for (char c : text) {
+      if (c == '\n') {
+        rows++;
+        cols = 0;
+      } else if (++cols > longest) {
+        longest = cols;
+      }
+    }
+    if (cols > 0) {
+      rows++;
+    }
+
+    width = longest;
+    height = rows;
+    playerRow = 0;
+    playerCol = 0;
+    cells.assign(static_cast<size_t>(width) * height, ' ');
+
+    bool foundPlayer = false;
+    int r = 0;
+    int col = 0;
+    for (char c : text) {
+      if (c == '\n') {
+        r++;
+        col = 0;
+        continue;
+      }
+      if (c == '@' && !foundPlayer) {
+        foundPlayer = true;
+        playerRow = r;
+        playerCol = col;
+      }
+      cells[r * width + col] = c;
+      col++;
+    }
+  }
+
+  /// @brief Read and parse a map file.
+  /// @return True on success, false if the file could not be opened.
+  bool load(const char* fileName) {
+    std::ifstream ifs(fileName, std::ifstream::in | std::ifstream::binary);
+    if (!ifs.is_open()) {
+      return false;
+    }
+    std::string text((std::istreambuf_iterator<char>(ifs)),
+                     std::istreambuf_iterator<char>());
+    parse(text);
+    return true;
+  }
+};
+
+/// @brief Whether a map character is something that moves or is picked up
+/// (the player, monsters and items) rather than part of the level itself.
+///
+///   Actors are kept out of the terrain layer so that one moving does not
+/// disturb any geometry built from the terrain.
+inline bool isActorGlyph(char c)
+{
+  if (c == '@' || std::isalpha(static_cast<unsigned char>(c))) {
+    return true;
+  }
+  return c != '\0' && std::strchr("!?$=\"-_|~&*,()[]{}/\\", c) != nullptr;
+}
+
+/// @brief Color an actor is drawn in, packed as 0xAABBGGRR so that its
+/// bytes are red, green, blue and alpha in memory.
+inline uint32_t actorColorFor(char c)
+{
+  switch (c) {
+  case '@':
+    return 0xff00ff00;  // Green
+  case 'c':
+    return 0xffff00ff;  // Purple
+  case 'p':
+    return 0xff0000ff;  // Red
+  case 'r':
+    return 0xffff0000;  // Blue
+  default:
+    break;
+  }
+  if (std::isalpha(static_cast<unsigned char>(c))) {
+    return 0xff0080ff;  // Orange for the other monsters
+  }
+  return 0xff00ffff;    // Yellow for items
+}
+
+/// @brief The actors on a map, as parallel arrays so that they can be
+/// handed to OpenGL as an instance buffer without repacking.
+///
+///   Positions are in cells: x counts rows and z counts columns, which is
+/// how the renderers lay the map out, so a renderer only has to scale and
+/// flip them.
+struct MapActors {
+  std::vector<float> x;         ///< Row of each actor
+  std::vector<float> z;         ///< Column of each actor
+  std::vector<char> kind;       ///< Map character of each actor
+  std::vector<uint32_t> color;  ///< From actorColorFor()
+
+  size_t size() const { return kind.size(); }
+
+  void clear() {
+    x.clear();
+    z.clear();
+    kind.clear();
+    color.clear();
+  }
+
+  void add(int row, int col, char c) {
+    x.push_back(static_cast<float>(row));
+    z.push_back(static_cast<float>(col));
+    kind.push_back(c);
+    color.push_back(actorColorFor(c));
+  }
+
+  bool operator==(const MapActors& other) const {
+    return kind == other.kind && x == other.x && z == other.z;
+  }
+  bool operator!=(const MapActors& other) const { return !(*this == other); }
+};
+
+/// @brief Split a map into its static terrain and its actors.
+///
+///   Every actor's cell becomes floor in the terrain, since that is what
+/// actors stand on, and the actor is added to the list.
+/// @param [out] terrain The map with the actors removed.
+/// @param [out] actors The actors, in row-major order.
+inline void splitMapLayers(const MapGrid& map, MapGrid& terrain,
+                           MapActors& actors)
+{
+  terrain.width = map.width;
+  terrain.height = map.height;
+  terrain.playerRow = map.playerRow;
+  terrain.playerCol = map.playerCol;
+  terrain.cells = map.cells;
+  actors.clear();
+  for (int r = 0; r < map.height; r++) {
+    for (int c = 0; c < map.width; c++) {
+      char& cell = terrain.cells[r * map.width + c];
+      if (isActorGlyph(cell)) {
+        actors.add(r, c, cell);
+        cell = '.';
+      }
+    }
+  }
+}
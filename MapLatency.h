@@ -0,0 +1,134 @@
+/** @file
+    @brief Game-to-photon latency of map snapshots: when each one was
+           written, read, built, uploaded and shown, and the distribution of
+           the time spent in each stage.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "LatencyHistogram.h"
+
+// Standard includes
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include <sys/stat.h>
+#include <sys/types.h>
+
+/// @brief When one map snapshot reached each stage on its way to the
+/// screen.
+///
+///   The times are wall-clock, to compare with the file's modification time
+/// and with the display deadlines, which are also wall-clock.  A stage that
+/// a path does not have takes no time: the text path builds no geometry, so
+/// its snapshots are built when they are parsed.
+struct MapStageTimes {
+  typedef std::chrono::system_clock Clock;
+
+  uint64_t sequence = 0;  ///< Counts snapshots from 1; 0 if not timed
+  Clock::time_point written;     ///< Modification time of the map file
+  Clock::time_point readStart;   ///< When reading the file began
+  Clock::time_point parsed;
+  Clock::time_point built;       ///< When its geometry was built on the CPU
+  Clock::time_point applyStart;  ///< When the frame that uploads it began
+  Clock::time_point uploaded;    ///< When it was sent to OpenGL
+};
+
+/// @brief Distribution of the time map snapshots spend in each stage.
+class MapLatency {
+public:
+  enum Stage {
+    FIND,     ///< Written until the file was next read
+    PARSE,    ///< Read and parsed
+    BUILD,    ///< Geometry built on the CPU
+    QUEUE,    ///< Waiting for the next frame to start
+    UPLOAD,   ///< Sent to OpenGL
+    DISPLAY,  ///< Uploaded until the deadline of the first frame to draw it
+    TOTAL,    ///< Written until that deadline
+    NUM_STAGES
+  };
+
+  MapLatency() {}
+
+  static const char* stageName(Stage stage) {
+    static const char* names[NUM_STAGES] = {
+      "find", "parse", "build", "queue", "upload", "display", "total"
+    };
+    return names[stage];
+  }
+
+  /// @brief The modification time of a file.
+  /// @return False if the file could not be examined.
+  static bool fileWriteTime(const char* fileName,
+                            MapStageTimes::Clock::time_point& written) {
+#ifdef _WIN32
+    struct _stat64 st;
+    if (_stat64(fileName, &st) != 0) {
+      return false;
+    }
+    written = MapStageTimes::Clock::from_time_t(st.st_mtime);
+#else
+    struct stat st;
+    if (stat(fileName, &st) != 0) {
+      return false;
+    }
+    written = MapStageTimes::Clock::from_time_t(st.st_mtime);
+#if defined(__APPLE__)
+    written += std::chrono::duration_cast<MapStageTimes::Clock::duration>(
+        std::chrono::nanoseconds(st.st_mtimespec.tv_nsec));
+#else
+    written += std::chrono::duration_cast<MapStageTimes::Clock::duration>(
+        std::chrono::nanoseconds(st.st_mtim.tv_nsec));
+#endif
+#endif
+    return true;
+  }
+
+  /// @brief Count a snapshot that has been drawn for the first time.
+  /// @param [in] displayed When the frame that drew it is to be shown.
+  void shown(const MapStageTimes& times, MapStageTimes::Clock::time_point displayed) {
+    stages[FIND].add(times.readStart - times.written);
+    stages[PARSE].add(times.parsed - times.readStart);
+    stages[BUILD].add(times.built - times.parsed);
+    stages[QUEUE].add(times.applyStart - times.built);
+    stages[UPLOAD].add(times.uploaded - times.applyStart);
+    stages[DISPLAY].add(displayed - times.uploaded);
+    stages[TOTAL].add(displayed - times.written);
+  }
+
+  const LatencyHistogram& stage(Stage s) const { return stages[s]; }
+
+  /// @brief Print a line for each stage.
+  void print(std::ostream& out) const {
+    if (stages[TOTAL].count() == 0) {
+      return;
+    }
+    out << "Map latency, per stage:" << std::endl;
+    for (int s = 0; s < NUM_STAGES; s++) {
+      std::string name = std::string("  ") + stageName(static_cast<Stage>(s));
+      stages[s].print(out, name.c_str());
+    }
+  }
+
+private:
+  MapLatency(const MapLatency&) = delete;
+  MapLatency& operator=(const MapLatency&) = delete;
+
+  LatencyHistogram stages[NUM_STAGES];
+};
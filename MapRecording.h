@@ -0,0 +1,434 @@
+/** @file
+    @brief Recording of the maps and inputs that the renderer sees, and
+           replay of them, so that a slow stretch of a game can be run
+           again under a profiler.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "MapGrid.h"
+
+// Standard includes
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// @brief The inputs read for one frame.
+struct InputSample {
+  uint64_t timeUs = 0;        ///< Since the start of the recording
+  double trigger = 0;
+  double leftStickX = 0;
+  double leftStickY = 0;
+  double rightStickX = 0;
+  bool headValid = false;     ///< False if the head pose could not be read
+  double headPosition[3] = { 0, 0, 0 };
+  double headRotation[4] = { 1, 0, 0, 0 };  ///< w, x, y, z
+  bool headVelocityValid = false;  ///< False if there was no angular velocity
+  double headAngularVelocity[3] = { 0, 0, 0 };  ///< Radians/second, head space
+};
+
+/// @brief Shared file layout for MapRecorder and MapReplayer.
+///
+///   After an eight-byte magic number the file is a sequence of records,
+/// each starting with a type byte.  Numbers are unsigned LEB128 varints
+/// and doubles are stored as their raw little-endian bytes.
+///
+///   A map record holds its arrival time, the map size and player cell,
+/// and the cells as a delta against the previous map record: pairs of
+/// (cells unchanged, cells changed) counts, each followed by the changed
+/// cells.  When the size changes the delta is against a blank map.  Most
+/// turns only change a handful of cells, so this stores them in a few bytes.
+///
+///   An input record holds its time, whether the head pose was valid and
+/// the doubles of the sample.  A motion input record is an input record
+/// followed by whether the angular velocity was valid and the velocity;
+/// recordings made before there was one still play back, without it.
+class MapRecordingFormat {
+public:
+  static const char* magic() { return "UMREC01\n"; }
+  enum RecordType {
+    MAP_RECORD = 'M',
+    INPUT_RECORD = 'I',
+    MOTION_INPUT_RECORD = 'V'
+  };
+
+  static void putVarint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+      out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+      v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+  }
+
+  static bool getVarint(const char*& p, const char* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+      unsigned char b = static_cast<unsigned char>(*p++);
+      v |= static_cast<uint64_t>(b & 0x7f) << shift;
+      if (!(b & 0x80)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  static void putDouble(std::string& out, double d) {
+    char bytes[sizeof(double)];
+    std::memcpy(bytes, &d, sizeof(d));
+    out.append(bytes, sizeof(bytes));
+  }
+
+  static bool getDouble(const char*& p, const char* end, double& d) {
+    if (end - p < static_cast<ptrdiff_t>(sizeof(double))) {
+      return false;
+    }
+    std::memcpy(&d, p, sizeof(d));
+    p += sizeof(d);
+    return true;
+  }
+
+  /// @brief Append the delta that turns previous into current.
+  static void encodeDelta(const std::vector<char>& previous,
+                          const std::vector<char>& current, std::string& out) {
+    size_t n = current.size();
+    size_t i = 0;
+    while (i < n) {
+      size_t same = i;
+      while (same < n && current[same] == previous[same]) {
+        same++;
+      }
+      size_t changed = same;
+      // Short unchanged runs cost more to skip than to copy.
+      while (changed < n &&
+             (current[changed] != previous[changed] ||
+              (changed + 1 < n && current[changed + 1] != previous[changed + 1]))) {
+        changed++;
+      }
+      putVarint(out, same - i);
+      putVarint(out, changed - same);
+      out.append(current.data() + same, changed - same);
+      i = changed;
+    }
+  }
+
+  /// @brief Apply a delta written by encodeDelta() in place.
+  static bool applyDelta(const char*& p, const char* end, std::vector<char>& cells) {
+    size_t i = 0;
+    while (i < cells.size()) {
+      uint64_t same, changed;
+      if (!getVarint(p, end, same) || !getVarint(p, end, changed) ||
+          same + changed > cells.size() - i ||
+          static_cast<uint64_t>(end - p) < changed) {
+        return false;
+      }
+      i += static_cast<size_t>(same);
+      std::memcpy(cells.data() + i, p, static_cast<size_t>(changed));
+      p += changed;
+      i += static_cast<size_t>(changed);
+    }
+    return true;
+  }
+};
+
+/// @brief Writes every map and input sample handed to it into a file.
+///
+/// Thread safe, so maps can be recorded from the thread that reads them and
+/// inputs from the thread that polls them.
+class MapRecorder {
+public:
+  MapRecorder() {}
+
+  ~MapRecorder() { close(); }
+
+  /// @brief Start a new recording.
+  /// @return True on success, false if the file could not be created.
+  bool open(const char* fileName) {
+    std::lock_guard<std::mutex> lock(mutex);
+    out.open(fileName, std::ofstream::out | std::ofstream::binary |
+                           std::ofstream::trunc);
+    if (!out.is_open()) {
+      std::cerr << "MapRecorder::open(): Could not create " << fileName
+                << std::endl;
+      return false;
+    }
+    out.write(MapRecordingFormat::magic(), 8);
+    start = std::chrono::steady_clock::now();
+    previous.clear();
+    width = height = 0;
+    maps = inputs = 0;
+    rawBytes = storedBytes = 0;
+    return true;
+  }
+
+  bool isOpen() const { return out.is_open(); }
+
+  /// @brief Record a map as it arrives.
+  void recordMap(const MapGrid& map) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!out.is_open()) {
+      return;
+    }
+    record.clear();
+    record.push_back(static_cast<char>(MapRecordingFormat::MAP_RECORD));
+    MapRecordingFormat::putVarint(record, now());
+    MapRecordingFormat::putVarint(record, map.width);
+    MapRecordingFormat::putVarint(record, map.height);
+    MapRecordingFormat::putVarint(record, map.playerRow);
+    MapRecordingFormat::putVarint(record, map.playerCol);
+    if (map.width != width || map.height != height) {
+      width = map.width;
+      height = map.height;
+      previous.assign(map.cells.size(), ' ');
+    }
+    MapRecordingFormat::encodeDelta(previous, map.cells, record);
+    previous = map.cells;
+    out.write(record.data(), record.size());
+    maps++;
+    rawBytes += map.cells.size();
+    storedBytes += record.size();
+  }
+
+  /// @brief Record the inputs for a frame.  The time is filled in here.
+  void recordInput(const InputSample& sample) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!out.is_open()) {
+      return;
+    }
+    record.clear();
+    record.push_back(static_cast<char>(MapRecordingFormat::MOTION_INPUT_RECORD));
+    MapRecordingFormat::putVarint(record, now());
+    record.push_back(sample.headValid ? 1 : 0);
+    MapRecordingFormat::putDouble(record, sample.trigger);
+    MapRecordingFormat::putDouble(record, sample.leftStickX);
+    MapRecordingFormat::putDouble(record, sample.leftStickY);
+    MapRecordingFormat::putDouble(record, sample.rightStickX);
+    for (double d : sample.headPosition) {
+      MapRecordingFormat::putDouble(record, d);
+    }
+    for (double d : sample.headRotation) {
+      MapRecordingFormat::putDouble(record, d);
+    }
+    record.push_back(sample.headVelocityValid ? 1 : 0);
+    for (double d : sample.headAngularVelocity) {
+      MapRecordingFormat::putDouble(record, d);
+    }
+    out.write(record.data(), record.size());
+    inputs++;
+  }
+
+  /// @brief Finish the file and report how much was recorded.
+  void close() {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!out.is_open()) {
+      return;
+    }
+    out.close();
+    std::cerr << "MapRecorder: Recorded " << maps << " maps and " << inputs
+              << " input samples; " << rawBytes << " bytes of maps stored in "
+              << storedBytes << " bytes" << std::endl;
+  }
+
+private:
+  MapRecorder(const MapRecorder&) = delete;
+  MapRecorder& operator=(const MapRecorder&) = delete;
+
+  std::mutex mutex;
+  std::ofstream out;
+  std::chrono::steady_clock::time_point start;
+  std::vector<char> previous;  ///< Cells of the last map recorded
+  int width = 0;
+  int height = 0;
+  std::string record;          ///< Reused to build each record
+  size_t maps = 0;
+  size_t inputs = 0;
+  size_t rawBytes = 0;
+  size_t storedBytes = 0;
+
+  uint64_t now() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - start).count();
+  }
+};
+
+/// @brief Plays back a file written by MapRecorder.
+///
+///   The whole file is read by open(), still delta-encoded, and the maps
+/// are rebuilt one at a time as they are asked for.  Maps and inputs are
+/// separate streams, each played back in the order they were recorded.
+class MapReplayer {
+public:
+  MapReplayer() {}
+
+  /// @brief Read a recording.
+  /// @return True on success, false if the file is missing or damaged.
+  bool open(const char* fileName) {
+    std::ifstream in(fileName, std::ifstream::in | std::ifstream::binary);
+    if (!in.is_open()) {
+      std::cerr << "MapReplayer::open(): Could not open " << fileName
+                << std::endl;
+      return false;
+    }
+    data.assign((std::istreambuf_iterator<char>(in)),
+                std::istreambuf_iterator<char>());
+    if (data.size() < 8 ||
+        std::memcmp(data.data(), MapRecordingFormat::magic(), 8) != 0) {
+      std::cerr << "MapReplayer::open(): " << fileName
+                << " is not a map recording" << std::endl;
+      return false;
+    }
+
+    // Index the records so the two streams can be read independently.
+    maps.clear();
+    inputs.clear();
+    const char* p = data.data() + 8;
+    const char* end = data.data() + data.size();
+    MapGrid scratch;
+    while (p < end) {
+      char type = *p++;
+      if (type == MapRecordingFormat::MAP_RECORD) {
+        maps.push_back(p - data.data());
+        uint64_t timeUs;
+        if (!readMap(p, scratch, timeUs)) {
+          maps.pop_back();
+          break;
+        }
+      } else if (type == MapRecordingFormat::INPUT_RECORD ||
+                 type == MapRecordingFormat::MOTION_INPUT_RECORD) {
+        InputSample sample;
+        if (!readInput(p, sample) ||
+            (type == MapRecordingFormat::MOTION_INPUT_RECORD &&
+             !readMotion(p, sample))) {
+          break;
+        }
+        inputs.push_back(sample);
+      } else {
+        break;
+      }
+    }
+    if (p != end) {
+      std::cerr << "MapReplayer::open(): " << fileName
+                << " is damaged; replaying the part before the damage"
+                << std::endl;
+    }
+    nextMapIndex = nextInputIndex = 0;
+    current = MapGrid();
+    return true;
+  }
+
+  size_t mapCount() const { return maps.size(); }
+  size_t inputCount() const { return inputs.size(); }
+
+  /// @brief Get the next map in the recording.
+  /// @param [out] map Filled in with the map.  At the end of the recording
+  ///             this is the last map.
+  /// @param [out] timeUs When the map arrived, since the recording started.
+  /// @return True if there was another map.
+  bool nextMap(MapGrid& map, uint64_t& timeUs) {
+    bool more = nextMapIndex < maps.size();
+    timeUs = 0;
+    if (more) {
+      const char* p = data.data() + maps[nextMapIndex++];
+      readMap(p, current, timeUs);
+    }
+    map.width = current.width;
+    map.height = current.height;
+    map.playerRow = current.playerRow;
+    map.playerCol = current.playerCol;
+    map.cells = current.cells;
+    return more;
+  }
+
+  /// @brief Get the next input sample in the recording.
+  /// @return False at the end of the recording.
+  bool nextInput(InputSample& sample) {
+    if (nextInputIndex >= inputs.size()) {
+      return false;
+    }
+    sample = inputs[nextInputIndex++];
+    return true;
+  }
+
+private:
+  MapReplayer(const MapReplayer&) = delete;
+  MapReplayer& operator=(const MapReplayer&) = delete;
+
+  std::vector<char> data;        ///< The whole file
+  std::vector<size_t> maps;      ///< Offset of each map record's body
+  std::vector<InputSample> inputs;
+  size_t nextMapIndex = 0;
+  size_t nextInputIndex = 0;
+  MapGrid current;               ///< The last map rebuilt
+
+  /// @brief Read a map record body, applying it on top of map.
+  bool readMap(const char*& p, MapGrid& map, uint64_t& timeUs) const {
+    const char* end = data.data() + data.size();
+    uint64_t w, h, row, col;
+    if (!MapRecordingFormat::getVarint(p, end, timeUs) ||
+        !MapRecordingFormat::getVarint(p, end, w) ||
+        !MapRecordingFormat::getVarint(p, end, h) ||
+        !MapRecordingFormat::getVarint(p, end, row) ||
+        !MapRecordingFormat::getVarint(p, end, col)) {
+      return false;
+    }
+    if (static_cast<int>(w) != map.width || static_cast<int>(h) != map.height) {
+      map.width = static_cast<int>(w);
+      map.height = static_cast<int>(h);
+      map.cells.assign(static_cast<size_t>(w * h), ' ');
+    }
+    map.playerRow = static_cast<int>(row);
+    map.playerCol = static_cast<int>(col);
+    return MapRecordingFormat::applyDelta(p, end, map.cells);
+  }
+
+  bool readInput(const char*& p, InputSample& sample) const {
+    const char* end = data.data() + data.size();
+    if (!MapRecordingFormat::getVarint(p, end, sample.timeUs) || p >= end) {
+      return false;
+    }
+    sample.headValid = (*p++ != 0);
+    bool ok = MapRecordingFormat::getDouble(p, end, sample.trigger) &&
+              MapRecordingFormat::getDouble(p, end, sample.leftStickX) &&
+              MapRecordingFormat::getDouble(p, end, sample.leftStickY) &&
+              MapRecordingFormat::getDouble(p, end, sample.rightStickX);
+    for (double& d : sample.headPosition) {
+      ok = ok && MapRecordingFormat::getDouble(p, end, d);
+    }
+    for (double& d : sample.headRotation) {
+      ok = ok && MapRecordingFormat::getDouble(p, end, d);
+    }
+    return ok;
+  }
+
+  bool readMotion(const char*& p, InputSample& sample) const {
+    const char* end = data.data() + data.size();
+    if (p >= end) {
+      return false;
+    }
+    sample.headVelocityValid = (*p++ != 0);
+    bool ok = true;
+    for (double& d : sample.headAngularVelocity) {
+      ok = ok && MapRecordingFormat::getDouble(p, end, d);
+    }
+    return ok;
+  }
+};
@@ -0,0 +1,370 @@
+/** @file
+    @brief Counters, gauges and histograms that a render loop updates
+           without locking, exported in the Prometheus text format to a file
+           or a Unix socket by a background thread.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "LatencyHistogram.h"
+
+// Standard includes
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+/// @brief Named metrics, and their current values in the Prometheus text
+/// exposition format.
+///
+///   Every metric must be added before anything reads the registry, so that
+/// the list of them never changes while the exporter walks it; after that,
+/// updating a value is a relaxed atomic store or add and reading one is a
+/// relaxed load, so neither side ever waits for the other.  Histograms are
+/// LatencyHistograms owned by the caller and exported in seconds, with the
+/// bucket bounds at powers of two microseconds, inclusive as Prometheus's
+/// le bounds are.
+class MetricsRegistry {
+public:
+  /// @brief A count that only goes up.
+  class Counter {
+  public:
+    Counter() {}
+    void add(uint64_t n = 1) { value.fetch_add(n, std::memory_order_relaxed); }
+    /// @brief Copy a total that is kept elsewhere, such as a cache's hits.
+    void set(uint64_t total) { value.store(total, std::memory_order_relaxed); }
+    uint64_t get() const { return value.load(std::memory_order_relaxed); }
+
+  private:
+    Counter(const Counter&) = delete;
+    Counter& operator=(const Counter&) = delete;
+    std::atomic<uint64_t> value{ 0 };
+  };
+
+  /// @brief A number that may go up or down.
+  class Gauge {
+  public:
+    Gauge() {}
+    void set(double v) { value.store(v, std::memory_order_relaxed); }
+    double get() const { return value.load(std::memory_order_relaxed); }
+
+  private:
+    Gauge(const Gauge&) = delete;
+    Gauge& operator=(const Gauge&) = delete;
+    std::atomic<double> value{ 0 };
+  };
+
+  MetricsRegistry() {}
+
+  /// @param [in] name Such as app_frames_total; see the Prometheus naming
+  ///        conventions.
+  Counter& counter(const std::string& name, const std::string& help) {
+    counters.emplace_back();
+    Metric m(name, help, "counter");
+    m.counter = &counters.back();
+    metrics.push_back(m);
+    return counters.back();
+  }
+
+  Gauge& gauge(const std::string& name, const std::string& help) {
+    gauges.emplace_back();
+    Metric m(name, help, "gauge");
+    m.gauge = &gauges.back();
+    metrics.push_back(m);
+    return gauges.back();
+  }
+
+  /// @param [in] histogram Must outlive the registry.
+  void histogram(const std::string& name, const std::string& help,
+                 const LatencyHistogram& histogram) {
+    Metric m(name, help, "histogram");
+    m.histogram = &histogram;
+    metrics.push_back(m);
+  }
+
+  /// @brief Write every metric's current value.
+  void write(std::ostream& out) const {
+    out.precision(15);
+    for (const Metric& m : metrics) {
+      out << "# HELP " << m.name << " " << m.help << "\n"
+          << "# TYPE " << m.name << " " << m.type << "\n";
+      if (m.counter) {
+        out << m.name << " " << m.counter->get() << "\n";
+      } else if (m.gauge) {
+        out << m.name << " " << m.gauge->get() << "\n";
+      } else {
+        // Bucket i of a LatencyHistogram holds the latencies up to 2^i us
+        // that are not in a lower bucket; the last holds the rest.
+        uint64_t cumulative = 0;
+        for (int i = 0; i < LatencyHistogram::BUCKETS - 1; i++) {
+          cumulative += m.histogram->bucketCount(i);
+          out << m.name << "_bucket{le=\"" << double(uint64_t(1) << i) * 1e-6
+              << "\"} " << cumulative << "\n";
+        }
+        cumulative += m.histogram->bucketCount(LatencyHistogram::BUCKETS - 1);
+        out << m.name << "_bucket{le=\"+Inf\"} " << cumulative << "\n"
+            << m.name << "_sum " << m.histogram->sum() * 1e-9 << "\n"
+            << m.name << "_count " << cumulative << "\n";
+      }
+    }
+  }
+
+  std::string text() const {
+    std::ostringstream out;
+    write(out);
+    return out.str();
+  }
+
+private:
+  MetricsRegistry(const MetricsRegistry&) = delete;
+  MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+  struct Metric {
+    Metric(const std::string& n, const std::string& h, const char* t)
+      : name(n), help(h), type(t) {}
+    std::string name;
+    std::string help;
+    const char* type;
+    const Counter* counter = nullptr;
+    const Gauge* gauge = nullptr;
+    const LatencyHistogram* histogram = nullptr;
+  };
+
+  std::deque<Counter> counters;  ///< A deque, so that they never move
+  std::deque<Gauge> gauges;
+  std::vector<Metric> metrics;
+};
+
+/// @brief Publishes a registry from a background thread.
+///
+///   Every interval the metrics are written to a file, by way of a
+/// temporary file renamed over it so that a reader never sees half of one;
+/// this suits node_exporter's textfile collector, given a file name ending
+/// in .prom in its directory.  They can also be served on a Unix socket:
+/// a client that sends an HTTP GET, such as curl --unix-socket, gets an
+/// HTTP response, and one that sends nothing gets just the text.  Sockets
+/// are not supported on Windows.
+class MetricsExporter {
+public:
+  std::string fileName;     ///< Not written if empty
+  std::string socketPath;   ///< Not served if empty
+  double intervalSeconds = 10;  ///< Between writes of the file
+
+  explicit MetricsExporter(const MetricsRegistry& registry)
+    : registry(registry) {}
+
+  ~MetricsExporter() { stop(); }
+
+  /// @brief Open the socket, if any, and start the thread.
+  /// @return False if the socket could not be opened.
+  bool start() {
+    if (fileName.empty() && socketPath.empty()) {
+      return true;
+    }
+    if (!socketPath.empty() && !listen()) {
+      return false;
+    }
+    stopping = false;
+    thread = std::thread([this]() { run(); });
+    return true;
+  }
+
+  /// @brief Write the file one last time, so that it has the final counts,
+  /// and close the socket.
+  void stop() {
+    if (!thread.joinable()) {
+      return;
+    }
+    stopping = true;
+    thread.join();
+    if (!fileName.empty()) {
+      writeFile();
+    }
+#ifndef _WIN32
+    if (listenFd >= 0) {
+      close(listenFd);
+      listenFd = -1;
+      unlink(socketPath.c_str());
+    }
+#endif
+  }
+
+private:
+  MetricsExporter(const MetricsExporter&) = delete;
+  MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+  typedef std::chrono::steady_clock Clock;
+
+  const MetricsRegistry& registry;
+  std::thread thread;
+  std::atomic<bool> stopping{ false };
+  int listenFd = -1;
+
+  void run() {
+    Clock::duration interval = std::chrono::duration_cast<Clock::duration>(
+        std::chrono::duration<double>(intervalSeconds));
+    Clock::time_point nextWrite = Clock::now();
+    // Wake often enough to notice stop() soon after it is called.
+    const Clock::duration slice = std::chrono::milliseconds(100);
+    while (!stopping) {
+      Clock::time_point now = Clock::now();
+      if (!fileName.empty() && now >= nextWrite) {
+        writeFile();
+        nextWrite = now + interval;
+      }
+      Clock::duration wait = slice;
+      if (!fileName.empty() && nextWrite - now < wait) {
+        wait = nextWrite - now;
+      }
+      if (listenFd >= 0) {
+        serve(wait);
+      } else {
+        std::this_thread::sleep_for(wait);
+      }
+    }
+  }
+
+  void writeFile() {
+    std::string temporary = fileName + ".tmp";
+    {
+      std::ofstream out(temporary.c_str());
+      registry.write(out);
+      if (!out) {
+        std::cerr << "MetricsExporter: Could not write " + temporary + "\n"
+                  << std::flush;
+        return;
+      }
+    }
+#ifdef _WIN32
+    std::remove(fileName.c_str());
+#endif
+    if (std::rename(temporary.c_str(), fileName.c_str()) != 0) {
+      std::cerr << "MetricsExporter: Could not replace " + fileName + "\n"
+                << std::flush;
+    }
+  }
+
+#ifdef _WIN32
+  bool listen() {
+    std::cerr << "MetricsExporter: Unix sockets are not supported here"
+              << std::endl;
+    return false;
+  }
+
+  void serve(Clock::duration) {}
+#else
+  bool listen() {
+    sockaddr_un address;
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(address.sun_path)) {
+      std::cerr << "MetricsExporter: Socket path too long: " << socketPath
+                << std::endl;
+      return false;
+    }
+    std::strcpy(address.sun_path, socketPath.c_str());
+    listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenFd < 0) {
+      std::cerr << "MetricsExporter: Could not create a socket: "
+                << std::strerror(errno) << std::endl;
+      return false;
+    }
+    // A socket left behind by an earlier run would make bind() fail.
+    unlink(socketPath.c_str());
+    if (bind(listenFd, reinterpret_cast<sockaddr*>(&address),
+             sizeof(address)) != 0 ||
+        ::listen(listenFd, 4) != 0) {
+      std::cerr << "MetricsExporter: Could not listen on " << socketPath
+                << ": " << std::strerror(errno) << std::endl;
+      close(listenFd);
+      listenFd = -1;
+      return false;
+    }
+    fcntl(listenFd, F_SETFL, fcntl(listenFd, F_GETFL) | O_NONBLOCK);
+    return true;
+  }
+
+  /// @brief Answer any client that connects within wait.
+  void serve(Clock::duration wait) {
+    pollfd listening = { listenFd, POLLIN, 0 };
+    int ms = static_cast<int>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(wait).count());
+    if (poll(&listening, 1, ms > 0 ? ms : 0) <= 0) {
+      return;
+    }
+    int client = accept(listenFd, nullptr, nullptr);
+    if (client < 0) {
+      return;
+    }
+#ifdef SO_NOSIGPIPE
+    int on = 1;
+    setsockopt(client, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+    // Give a client a moment to send its request, but serve the text
+    // anyway if it sends none.
+    char request[1024];
+    ssize_t got = 0;
+    pollfd readable = { client, POLLIN, 0 };
+    if (poll(&readable, 1, 100) > 0) {
+      got = recv(client, request, sizeof(request), 0);
+    }
+    std::string body = registry.text();
+    std::string response;
+    if (got >= 3 && std::strncmp(request, "GET", 3) == 0) {
+      std::ostringstream header;
+      header << "HTTP/1.0 200 OK\r\n"
+             << "Content-Type: text/plain; version=0.0.4\r\n"
+             << "Content-Length: " << body.size() << "\r\n\r\n";
+      response = header.str();
+    }
+    response += body;
+#ifdef MSG_NOSIGNAL
+    // A client that hangs up early must not kill the program.
+    const int flags = MSG_NOSIGNAL;
+#else
+    const int flags = 0;
+#endif
+    size_t sent = 0;
+    while (sent < response.size()) {
+      ssize_t n = send(client, response.data() + sent, response.size() - sent,
+                       flags);
+      if (n <= 0) {
+        break;
+      }
+      sent += static_cast<size_t>(n);
+    }
+    close(client);
+  }
+#endif
+};
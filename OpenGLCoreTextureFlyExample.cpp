@@ -41,6 +41,21 @@
 #include <osvr/RenderKit/RenderManager.h>
 #include <quat.h>
 #include <chrono>
+#include "AtlasMips.h"
+#include "FlightRecorder.h"
+#include "FontQuads.h"
+#include "FrameScheduler.h"
+#include "MapGrid.h"
+#include "MapLatency.h"
+#include "MapRecording.h"
+#include "Metrics.h"
+#include "PosePredictor.h"
+#include "RedrawPolicy.h"
+#include "TaskScheduler.h"
+#include "TextRunCache.h"
+#include "TextureCompression.h"
+#include "ThreadTuning.h"
+#include "TiledMap.h"
 
 // Library/third-party includes
 #ifdef _WIN32
@@ -49,14 +64,29 @@
 #endif
 
 #include <GL/glew.h>
+#include <SDL.h>
 
 #include <freetype2/ft2build.h>
 #include FT_FREETYPE_H
 
 #include <fstream>  //for parsing text file
 // Standard includes
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
 #include <iostream>
+#include <iterator>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <stdlib.h> // For exit()
 
 // This must come after we include <GL/gl.h> so its pointer types are defined.
@@ -93,23 +123,21 @@ static const GLchar* vertexShader =
     "}\n";
 
 
-static const int XY = 0;
-static const int XZ = 1;
-static const int YZ = 2;
-
 /// @brief This is the OpenGL shader used to color fragments.
 /// @param [in] tex The texture sampler used to map the texture.  The texture value
 ///             multiplied by the fragment color, and alpha is supported, so that
 ///             the texture can recolor the fragment and also change its opacity.
+/// @param [in] layer Layer of the tileset array to sample.
 static const GLchar* fragmentShader =
     "#version 330 core\n"
     "in vec4 fragmentColor;\n"
     "in vec2 textureCoord;\n"
     "layout(location = 0) out vec4 color;\n"
-    "uniform sampler2D tex;\n"
+    "uniform sampler2DArray tex;\n"
+    "uniform float layer;\n"
     "void main()\n"
     "{\n"
-    "   color = fragmentColor * texture(tex, textureCoord);\n"
+    "   color = fragmentColor * texture(tex, vec3(textureCoord, layer));\n"
     "}\n";
 
 /// @brief Class that wraps all of the things needed to handle OpenGL vertex and fragment shaders.
@@ -158,6 +186,7 @@ class SampleShader {
 
             projectionUniformId = glGetUniformLocation(programId, "projection");
             modelViewUniformId = glGetUniformLocation(programId, "modelView");
+            layerUniformId = glGetUniformLocation(programId, "layer");
             initialized = true;
         }
     }
@@ -167,7 +196,9 @@ class SampleShader {
     ///             from OSVR.
     /// @param [in] modelView OpenGL model/view matrix to use.  This should be obtained
     ///             from OSVR.
-    void useProgram(const GLdouble projection[], const GLdouble modelView[]) {
+    /// @param [in] layer Tileset layer that the texture coordinates refer to.
+    void useProgram(const GLdouble projection[], const GLdouble modelView[],
+                    GLint layer) {
         init();
         glUseProgram(programId);
         GLfloat projectionf[16];
@@ -176,6 +207,7 @@ class SampleShader {
         convertMatrix(modelView, modelViewf);
         glUniformMatrix4fv(projectionUniformId, 1, GL_FALSE, projectionf);
         glUniformMatrix4fv(modelViewUniformId, 1, GL_FALSE, modelViewf);
+        glUniform1f(layerUniformId, static_cast<GLfloat>(layer));
     }
 
   private:
@@ -185,6 +217,7 @@ class SampleShader {
     GLuint programId = 0;
     GLuint projectionUniformId = 0;
     GLuint modelViewUniformId = 0;
+    GLint layerUniformId = -1;
 
     void checkShaderError(GLuint shaderId, const std::string& exceptionMsg) {
         GLint result = GL_FALSE;
@@ -223,350 +256,185 @@ class SampleShader {
 };
 static SampleShader sampleShader;
 
-// Things needed for Freetype font display
-FT_Library g_ft = nullptr;
-FT_Face g_face = nullptr;
-std::vector<const char*> FONTS = {"./COURIER.TTF"};
-const int FONT_SIZE = 48;
-GLuint g_font_tex = 0;
-GLuint g_on_tex = 0;
-GLuint g_fontShader = 0;
-GLuint g_fontVertexBuffer = 0;
-GLuint g_fontVertexArrayId = 0;
-
-/// @brief Structure to hold OpenGL vertex buffer data.
-class FontVertex {
-public:
-  GLfloat pos[3];   ///< Location of the vertexre
-  GLfloat col[4];   ///< Color of the vertex (red, green, blue, alpha)
-  GLfloat tex[2];   ///< Texture coordinates for the vertex
-};
-
-/// @brief Helper function for render_text.
-/// @param [out] vertexBufferData OpenGL vertex buffer data to be rendered
-///             for a single character of text onto a quadrilateral.
-///
-///   The quadrilateral will be in the X-Y plane whose depth is specified.
-/// It will be axis aligned, with the character reading towards +X with
-/// its top rendered towards +Y.
-///   The quadrilateral is rendered into whatever space is defined by
-/// the projection and model/view transforms being used by the shader.
-///
-/// @param [in] left Furthest left (-x) on the Quadrilateral
-/// @param [in] right Furthest right (+x) on the Quadrilateral
-/// @param [in] left Furthest up (+y) on the Quadrilateral
-/// @param [in] left Furthest down (-y) on the Quadrilateral
-/// @param [in] depth Z value of the quadrilateral.
-static void addFontQuad(std::vector<FontVertex> &vertexBufferData,
-  GLfloat left, GLfloat right, GLfloat top, GLfloat bottom, GLfloat depth,
-  GLfloat R, GLfloat G, GLfloat B, GLfloat alpha)
-{
-  FontVertex v;
-  v.col[0] = R; v.col[1] = G; v.col[2] = B; v.col[3] = alpha;
-
-  // Invert the Y texture coordinate so that we draw the textures
-  // right-side up.
-  // Switch the order so we have clockwise front-facing.
-  v.pos[0] = left; v.pos[1] = bottom; v.pos[2] = depth;
-  v.tex[0] = 0; v.tex[1] = 1;
-  vertexBufferData.emplace_back(v);
-  v.pos[0] = right; v.pos[1] = top; v.pos[2] = depth;
-  v.tex[0] = 1; v.tex[1] = 0;
-  vertexBufferData.emplace_back(v);
-  v.pos[0] = right; v.pos[1] = bottom; v.pos[2] = depth;
-  v.tex[0] = 1; v.tex[1] = 1;
-  vertexBufferData.emplace_back(v);
-
-  v.pos[0] = left; v.pos[1] = bottom; v.pos[2] = depth;
-  v.tex[0] = 0; v.tex[1] = 1;
-  vertexBufferData.emplace_back(v);
-  v.pos[0] = left; v.pos[1] = top; v.pos[2] = depth;
-  v.tex[0] = 0; v.tex[1] = 0;
-  vertexBufferData.emplace_back(v);
-  v.pos[0] = right; v.pos[1] = top; v.pos[2] = depth;
-  v.tex[0] = 1; v.tex[1] = 0;
-  vertexBufferData.emplace_back(v);
-}
-
-static void addFontQuadXZ(std::vector<FontVertex>& vertexBufferData,
-    GLfloat left, GLfloat right, GLfloat y, GLfloat maxZ, GLfloat minZ,
-    GLfloat R, GLfloat G, GLfloat B, GLfloat alpha)
-{
-    FontVertex v;
-    v.col[0] = R; v.col[1] = G; v.col[2] = B; v.col[3] = alpha;
-
-    // Invert the Y texture coordinate so that we draw the textures
-    // right-side up.
-    // Switch the order so we have clockwise front-facing.
-    v.pos[0] = left; v.pos[1] = y; v.pos[2] = minZ;
-    v.tex[0] = 0; v.tex[1] = 1;
-    vertexBufferData.emplace_back(v);
-    v.pos[0] = right; v.pos[1] = y; v.pos[2] = maxZ;
-    v.tex[0] = 1; v.tex[1] = 0;
-    vertexBufferData.emplace_back(v);
-    v.pos[0] = right; v.pos[1] = y; v.pos[2] = minZ;
-    v.tex[0] = 1; v.tex[1] = 1;
-    vertexBufferData.emplace_back(v);
-
-    v.pos[0] = left; v.pos[1] = y; v.pos[2] = minZ;
-    v.tex[0] = 0; v.tex[1] = 1;
-    vertexBufferData.emplace_back(v);
-    v.pos[0] = left; v.pos[1] = y; v.pos[2] = maxZ;
-    v.tex[0] = 0; v.tex[1] = 0;
-    vertexBufferData.emplace_back(v);
-    v.pos[0] = right; v.pos[1] = y; v.pos[2] = maxZ;
-    v.tex[0] = 1; v.tex[1] = 0;
-    vertexBufferData.emplace_back(v);
-}
-
-static void addFontQuadYZ(std::vector<FontVertex>& vertexBufferData,
-    GLfloat x, GLfloat top, GLfloat bot, GLfloat maxZ, GLfloat minZ,
-    GLfloat R, GLfloat G, GLfloat B, GLfloat alpha)
-{
-    FontVertex v;
-    v.col[0] = R; v.col[1] = G; v.col[2] = B; v.col[3] = alpha;
-
-    // Invert the Y texture coordinate so that we draw the textures
-    // right-side up.
-    // Switch the order so we have clockwise front-facing.
-    v.pos[0] = x; v.pos[1] = bot; v.pos[2] = minZ;
-    v.tex[0] = 0; v.tex[1] = 1;
-    vertexBufferData.emplace_back(v);
-    v.pos[0] = x; v.pos[1] = top; v.pos[2] = maxZ;
-    v.tex[0] = 1; v.tex[1] = 0;
-    vertexBufferData.emplace_back(v);
-    v.pos[0] = x; v.pos[1] = bot; v.pos[2] = maxZ;
-    v.tex[0] = 1; v.tex[1] = 1;
-    vertexBufferData.emplace_back(v);
-
-    v.pos[0] = x; v.pos[1] = bot; v.pos[2] = minZ;
-    v.tex[0] = 0; v.tex[1] = 1;
-    vertexBufferData.emplace_back(v);
-    v.pos[0] = x; v.pos[1] = top; v.pos[2] = minZ;
-    v.tex[0] = 0; v.tex[1] = 0;
-    vertexBufferData.emplace_back(v);
-    v.pos[0] = x; v.pos[1] = top; v.pos[2] = maxZ;
-    v.tex[0] = 1; v.tex[1] = 0;
-    vertexBufferData.emplace_back(v);
-}
+// Draw calls made so far, for the metrics.  Render thread only.
+static uint64_t g_drawCalls = 0;
 
-/// @brief Render a string of text into a specified space.
+/// @brief Every texture the renderer samples, as the layers of one
+/// GL_TEXTURE_2D_ARRAY.
 ///
-///   The text will be in the X-Y plane whose z value is specified.
-/// It will be axis aligned, with the text reading towards +X with
-/// its top rendered towards +Y.
-///   The quadrilateral is rendered into whatever space is defined by
-/// the projection and model/view transforms being used by the shader.
+///   Layer WHITE_LAYER is solid white, for untextured geometry, and
+/// GLYPH_LAYER is the page of font glyphs built by GlyphAtlas.  Further
+/// tilesets or font pages go in further layers of the same size.  The array
+/// is bound to texture unit 0 once, when it is built, and never unbound, so
+/// a frame draws glyphs and untextured geometry without any texture binds;
+/// each draw picks its layer instead, from a uniform or from its instance
+/// data.  The layers are single-channel, swizzled so that they sample as
+/// (l, l, l, 1), and share the glyph page's mip chain.
 ///
-/// @param [in] projection The OpenGL projection matrix to pass to the shader.
-/// @param [in] modelView The OpenGL model/view matrix to pass to the shader.
-/// @param [in] text The null-terminated string of text to be rendered.
-/// @param [in] x Coordinates of the center of the text.
-/// @param [in] y Coordinates of the center of the text.
-/// @param [in] z Coordinates of the center of the text.
-/// @param [in] sx Spacing for the text in x.
-/// @param [in] sy Spacing for the text in y.
-
-bool render_text(const GLdouble projection[], const GLdouble modelView[],
-    const char *text, float x, float y, float z, float sx, float sy, int plane)
-{
-  if (!g_face) {
-    std::cerr << "render_text(): No face" << std::endl;
-    return false;
-  }
-  FT_GlyphSlot g = g_face->glyph;
-  GLenum err;
-
-  // Use the font shader to render this.  It may activate a different texture unit, so we
-  // need to make sure we active the first one once we are using the program.
-  sampleShader.useProgram(projection, modelView);
-
-  err = glGetError();
-  if (err != GL_NO_ERROR) {
-    std::cerr << "render_text(): Error after use program: "
-      << err << std::endl;
-    return false;
-  }
-
-  glActiveTexture(GL_TEXTURE0);
-
-  err = glGetError();
-  if (err != GL_NO_ERROR) {
-    std::cerr << "render_text(): Error after texture set: "
-      << err << std::endl;
-    return false;
-  }
+///   With compress set, every level of every layer is compressed to RGTC1
+/// on the CPU, which halves the memory and the bandwidth of sampling them.
+/// Without RGTC support they are stored uncompressed.
+class Tileset {
+  public:
+    enum Layer {
+        WHITE_LAYER = 0,
+        GLYPH_LAYER = 1,
+        NUM_LAYERS = 2
+    };
 
-  std::vector<FontVertex> vertexBufferData;
+    Tileset() {}
 
-  // Enable blending using alpha.
-  glEnable(GL_BLEND);
-  glBlendFunc(GL_SRC_COLOR, GL_ONE_MINUS_SRC_ALPHA);
+    ~Tileset() {
+        if (tex) {
+            glDeleteTextures(1, &tex);
+        }
+    }
 
-  err = glGetError();
-  if (err != GL_NO_ERROR) {
-    std::cerr << "render_text(): Error after blend enable: "
-      << err << std::endl;
-    return false;
-  }
+    /// @brief Layer that the map draws a kind of tile from.
+    static GLint layerFor(TileKind kind) {
+        return kind == TILE_NONE ? WHITE_LAYER : GLYPH_LAYER;
+    }
 
-  // Generate the font texture if we don't yet have it.  In any case, bind it as
-  // the active texture.
-  if (!g_font_tex) {
-    // Note that we don't really have a good place to destroy this texture
-    // because the rendering window is destroyed by each subclass in its own
-    // main() thread instance and it would have to be destroyed just before that
-    // in each.  When the window is destroyed, hopefully all of its texture
-    // resources are also cleaned up by the driver.
-    glGenTextures(1, &g_font_tex);
-  }
-  glBindTexture(GL_TEXTURE_2D, g_font_tex);
-  err = glGetError();
-  if (err != GL_NO_ERROR) {
-    std::cerr << "render_text(): Error binding texture: "
-      << err << std::endl;
-    return false;
-  }
+    /// @brief Create the array from the glyph page and bind it to texture
+    /// unit 0, replacing any earlier one.
+    /// @param [in] glyphChain Mip chain of the glyph page, 8-bit
+    ///             single-channel, or empty to make the array with a blank
+    ///             glyph layer.
+    /// @param [in] width, height Size of level 0 of the glyph page.
+    /// @return True on success, false if the texture could not be written.
+    bool build(TaskScheduler& scheduler,
+               const std::vector<std::vector<GLubyte> >& glyphChain,
+               int width, int height, bool compress) {
+        std::vector<std::vector<GLubyte> > blank;
+        if (glyphChain.empty()) {
+            width = height = 4;
+            blank.assign(1, std::vector<GLubyte>(width * height, 0));
+        }
+        const std::vector<std::vector<GLubyte> >& glyphs =
+            glyphChain.empty() ? blank : glyphChain;
+
+        // Each level holds all of the layers, one after the other.
+        std::vector<std::vector<GLubyte> > levels(glyphs.size());
+        for (size_t level = 0; level < glyphs.size(); level++) {
+            size_t layerBytes = glyphs[level].size();
+            levels[level].assign(layerBytes * NUM_LAYERS, 0);
+            std::fill(levels[level].begin() + WHITE_LAYER * layerBytes,
+                      levels[level].begin() + (WHITE_LAYER + 1) * layerBytes,
+                      255);
+            std::copy(glyphs[level].begin(), glyphs[level].end(),
+                      levels[level].begin() + GLYPH_LAYER * layerBytes);
+        }
 
-  // Blend the characters in, so we see them written above the background.
-  // We use color for the alpha channel so it appears wherever the character appears.
-  // Go through each character and render it until we get to the NULL terminator.
-  for (const char *p = text; *p; p++) {
-    if (FT_Load_Char(g_face, *p, FT_LOAD_RENDER))
-      continue;
-
-    // Set the parameters we need to render the text properly.
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, g->bitmap.width);
-    err = glGetError();
-    if (err != GL_NO_ERROR) {
-      std::cerr << "render_text(): Error setting texture params: "
-        << err << std::endl;
-      return false;
-    }
-#ifdef __APPLE__
-    // Trying to send GL_LUMINANCE textures fails on the mac, though it
-    // work on Windows.  So to fix this, we make a 4-times copy of the
-    // data and then send that as RGBA.
-    std::vector<GLubyte> tex(4 * g->bitmap.width * g->bitmap.rows);
-    for (int r = 0; r < g->bitmap.rows; r++) {
-      for (int c = 0; c < g->bitmap.width; c++) {
-        GLubyte val = g->bitmap.buffer[c + g->bitmap.width * r];
-        for (int i = 0; i < 4; i++) {
-          tex[i + 4 * (c + (g->bitmap.width * r))] = val;
+        if (tex) {
+            glDeleteTextures(1, &tex);
         }
-      }
+        glGenTextures(1, &tex);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                        GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL,
+                        static_cast<GLint>(levels.size()) - 1);
+        if (GLEW_EXT_texture_filter_anisotropic) {
+            GLfloat maxAnisotropy = 1;
+            glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &maxAnisotropy);
+            glTexParameterf(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_ANISOTROPY_EXT,
+                            std::min(16.0f, maxAnisotropy));
+        }
+        GLint swizzle[] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+        glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        if (!compress || !uploadCompressed(scheduler, levels, width, height)) {
+            for (size_t level = 0; level < levels.size(); level++) {
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(level),
+                             GL_R8, width >> level, height >> level, NUM_LAYERS,
+                             0, GL_RED, GL_UNSIGNED_BYTE, levels[level].data());
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        GLenum err = glGetError();
+        if (err != GL_NO_ERROR) {
+            std::cerr << "Tileset::build(): Error writing texture array: "
+                      << err << std::endl;
+            glDeleteTextures(1, &tex);
+            tex = 0;
+            return false;
+        }
+        return true;
     }
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, g->bitmap.width, g->bitmap.rows,
-      0, GL_RGBA, GL_UNSIGNED_BYTE, tex.data());
-#else
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, g->bitmap.width, g->bitmap.rows,
-      0, GL_LUMINANCE, GL_UNSIGNED_BYTE, g->bitmap.buffer);
-#endif
-    err = glGetError();
-    if (err != GL_NO_ERROR) {
-      std::cerr << "render_text(): Error writing texture: "
-        << err << std::endl;
-      return false;
-    }
-
-    float x2; float y2; float z2; float w; float h;
-    
-    switch (plane) 
-    case 0: { //xy
-         x2 = x + g->bitmap_left * sx;
-         y2 = y + g->bitmap_top * sy;
-         w = g->bitmap.width * sx;
-         h = g->bitmap.rows * sy;
-        // Blend in the text, fully opaque (inverse alpha) and fully white.
-        vertexBufferData.clear();
-        addFontQuad(vertexBufferData, x2, x2 + w, y2, y2 - h, z, 1, 1, 1, 0);
-        break;
-    case 1:  //xz
-         x2 = x + g->bitmap_left * sx;
-         z2 = z + g->bitmap_top * sy;
-         w = g->bitmap.width * sx;
-         h = g->bitmap.rows * sy;
-        // Blend in the text, fully opaque (inverse alpha) and fully white.
-        vertexBufferData.clear();
-        addFontQuadXZ(vertexBufferData, x2, x2 + w, y, z2-h, z2, 1, 1, 1, 0);
-        break;
-    
-    case 2:  //yz
-         z2 = z + g->bitmap_left * sx;
-         y2 = y + g->bitmap_top * sy;
-         w = g->bitmap.width * sx;
-         h = g->bitmap.rows * sy;
-        // Blend in the text, fully opaque (inverse alpha) and fully white.
-        vertexBufferData.clear();
-        addFontQuadYZ(vertexBufferData, x, y2, y2 - h, z2, z2+w, 1, 1, 1, 0);
-        break;
-    
-    }
-
-     // Blend in the text, fully opaque (inverse alpha) and fully white.
-    //vertexBufferData.clear();
-    //addFontQuad(vertexBufferData, x2, x2 + w, y2, y2 - h, z, 1,1,1,0);
-    //addFontQuadXZ(vertexBufferData, x2, x2+w, y, z2, z2-h, 1, 1, 1, 0);
-
-    glBindBuffer(GL_ARRAY_BUFFER, g_fontVertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER,
-      sizeof(vertexBufferData[0]) * vertexBufferData.size(),
-      &vertexBufferData[0], GL_STATIC_DRAW);
-    err = glGetError();
-    if (err != GL_NO_ERROR) {
-      std::cerr << "render_text(): Error buffering data: "
-        << err << std::endl;
-      return false;
-    }
-
-    // Configure the vertex-buffer objects.
-    glBindBuffer(GL_ARRAY_BUFFER, g_fontVertexBuffer);
-    glBindVertexArray(g_fontVertexArrayId);
-    {
-      size_t const stride = sizeof(vertexBufferData[0]);
-      // VBO
-      glEnableVertexAttribArray(0);
-      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
-        (GLvoid*)(offsetof(FontVertex, pos)));
-
-      // color
-      glEnableVertexAttribArray(1);
-      glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride,
-        (GLvoid*)(offsetof(FontVertex, col)));
-
-      // texture
-      glEnableVertexAttribArray(2);
-      glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride,
-        (GLvoid*)(offsetof(FontVertex, tex)));
-    }
-
-    // Draw the quad.
-    {
-      GLsizei numElements = static_cast<GLsizei>(vertexBufferData.size());
-      glDrawArrays(GL_TRIANGLES, 0, numElements);
-    }
-    glBindVertexArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    x += (g->advance.x / 64) * sx;
-    y += (g->advance.y / 64) * sy;
-  }
 
-  // Set things back to the defaults
-  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
-  glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    GLuint texture() const { return tex; }
 
-  // Use the always-on texture when we're not rendering text.
-  glBindTexture(GL_TEXTURE_2D, g_on_tex);
-  glDisable(GL_BLEND);
+  private:
+    Tileset(const Tileset&) = delete;
+    Tileset& operator=(const Tileset&) = delete;
+
+    GLuint tex = 0;
+
+    /// @brief Compress every level of every layer and upload them to the
+    /// bound array.
+    /// @return True on success, false if RGTC is not supported or the
+    ///         upload failed, leaving the array to be filled uncompressed.
+    static bool uploadCompressed(TaskScheduler& scheduler,
+                                 const std::vector<std::vector<GLubyte> >& levels,
+                                 int width, int height) {
+        if (!GLEW_VERSION_3_0 && !GLEW_ARB_texture_compression_rgtc) {
+            std::cerr << "Tileset: RGTC is not supported, storing the layers "
+                      << "uncompressed" << std::endl;
+            return false;
+        }
+        // Clear any earlier error, so that one seen next is from the upload.
+        glGetError();
+        size_t compressedBytes = 0;
+        size_t uncompressedBytes = 0;
+        for (size_t level = 0; level < levels.size(); level++) {
+            int w = width >> level;
+            int h = height >> level;
+            size_t layerPixels = static_cast<size_t>(w) * h;
+            size_t layerBlocks = rgtc1Size(w, h);
+            std::vector<GLubyte> blocks(layerBlocks * NUM_LAYERS);
+            int blockRows = (h + 3) / 4;
+            const std::vector<GLubyte>& pixels = levels[level];
+            scheduler.parallelFor(0, blockRows * NUM_LAYERS, 4, [&](size_t n) {
+                size_t layer = n / blockRows;
+                int row = static_cast<int>(n % blockRows);
+                encodeRgtc1Rows(pixels.data() + layer * layerPixels, w, h, row,
+                                row + 1, blocks.data() + layer * layerBlocks);
+            });
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, static_cast<GLint>(level),
+                                   GL_COMPRESSED_RED_RGTC1, w, h, NUM_LAYERS, 0,
+                                   static_cast<GLsizei>(blocks.size()),
+                                   blocks.data());
+            compressedBytes += blocks.size();
+            uncompressedBytes += pixels.size();
+        }
+        GLenum err = glGetError();
+        if (err != GL_NO_ERROR) {
+            std::cerr << "Tileset: Could not upload the compressed layers ("
+                      << err << "), storing them uncompressed" << std::endl;
+            return false;
+        }
+        std::cerr << "Tileset: " << NUM_LAYERS << " layers of " << width << "x"
+                  << height << " and " << levels.size() - 1 << " mip levels in "
+                  << compressedBytes << " bytes as RGTC1, rather than "
+                  << uncompressedBytes << std::endl;
+        return true;
+    }
+};
+static Tileset tileset;
 
-  return true;
-}
+// Things needed for Freetype font display
+FT_Library g_ft = nullptr;
+FT_Face g_face = nullptr;
+std::vector<const char*> FONTS = {"./COURIER.TTF"};
+const char* g_fontFile = nullptr;  ///< The entry of FONTS that g_face came from
+const int FONT_SIZE = 48;
+GLuint g_fontShader = 0;
 
 /// @brief Class to handle creating and rendering a cube in OpenGL.
 class Cube {
@@ -630,94 +498,2749 @@ class Cube {
                             scale,  -scale, scale,  -scale, -scale, scale,
                             -scale, -scale, -scale,
 
-                            -scale, scale,  scale, // +Z
-                            -scale, -scale, scale,  scale,  -scale, scale,
+                            -scale, scale,  scale, // +Z
+                            -scale, -scale, scale,  scale,  -scale, scale,
+
+                            scale,  scale,  scale,  -scale, scale,  scale,
+                            scale,  -scale, scale,
+
+                            scale,  scale,  -scale, // -Z
+                            -scale, -scale, -scale, -scale, scale,  -scale,
+
+                            scale,  scale,  -scale, scale,  -scale, -scale,
+                            -scale, -scale, -scale};
+    }
+
+    ~Cube() {
+        if (initialized) {
+            glDeleteBuffers(1, &vertexBuffer);
+            glDeleteVertexArrays(1, &vertexArrayId);
+        }
+    }
+
+    /// @brief Must be called before draw() can be used.
+    void init() {
+        if (!initialized) {
+            // Vertex buffer
+            glGenBuffers(1, &vertexBuffer);
+            glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+            glBufferData(GL_ARRAY_BUFFER,
+                         sizeof(vertexBufferData[0]) * vertexBufferData.size(),
+                         &vertexBufferData[0], GL_STATIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            // Color buffer
+            glGenBuffers(1, &colorBuffer);
+            glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
+            glBufferData(GL_ARRAY_BUFFER,
+                         sizeof(colorBufferData[0]) * colorBufferData.size(),
+                         &colorBufferData[0], GL_STATIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+            // Vertex array object
+            glGenVertexArrays(1, &vertexArrayId);
+            glBindVertexArray(vertexArrayId);
+            {
+                // color
+                glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
+                glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
+
+                // VBO
+                glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
+
+                glEnableVertexAttribArray(0);
+                glEnableVertexAttribArray(1);
+            }
+            glBindVertexArray(0);
+            initialized = true;
+        }
+    }
+
+    /// @brief Render the cube in the specified space.
+    /// @param [in] projection The OpenGL projection matrix to pass to the shader.
+    /// @param [in] modelView The OpenGL model/view matrix to pass to the shader.
+    void draw(const GLdouble projection[], const GLdouble modelView[]) {
+        init();
+
+        sampleShader.useProgram(projection, modelView, Tileset::WHITE_LAYER);
+
+        glBindVertexArray(vertexArrayId);
+        {
+            glDrawArrays(GL_TRIANGLES, 0,
+                         static_cast<GLsizei>(vertexBufferData.size()));
+            g_drawCalls++;
+        }
+        glBindVertexArray(0);
+    }
+
+  private:
+    Cube(const Cube&) = delete;
+    Cube& operator=(const Cube&) = delete;
+    bool initialized = false;
+    GLuint colorBuffer = 0;
+    GLuint vertexBuffer = 0;
+    GLuint vertexArrayId = 0;
+    std::vector<GLfloat> colorBufferData;
+    std::vector<GLfloat> vertexBufferData;
+};
+
+static Cube roomCube(5.0f);
+static Cube handsCube(0.05f);
+
+// The map that umoria writes out for us, re-read every frame, and where its
+// cells are placed in the world.
+static const char* MAP_FILE_NAME =
+    "../../../UBuild/umoria/print_floor_test.txt";
+static MapGrid g_map;
+static MapGrid g_nextMap;  ///< Read while g_map is being drawn
+
+// When the map snapshots in g_map and g_nextMap were written and how far
+// each has got towards the screen, and how long the ones that have been
+// drawn spent in each stage.  Reported at exit.
+static MapStageTimes g_mapTimes;
+static MapStageTimes g_nextMapTimes;
+static MapLatency g_mapLatency;
+static uint64_t g_mapSequence = 0;       ///< Of the last snapshot read
+static uint64_t g_shownMapSequence = 0;  ///< Of the last snapshot drawn
+
+// Set from the command line to page a tiled map in around the viewer
+// rather than reading MAP_FILE_NAME whole every frame.
+static TiledMapFile g_tiledMap;
+static MapPager g_pager;
+static const float MAP_CELL_SPACING = 4.0f;
+static const float MAP_GLYPH_Y = -2.0f;
+static const float MAP_GLYPH_SCALE = 0.1f;
+static const float MAP_WALL_HALF_WIDTH = 1.0f;
+
+// Set from the command line to draw the map from a GPU-resident texture
+// rather than building its geometry on the CPU every frame.
+static bool g_useGpuTerrain = false;
+
+// Set from the command line to cull the GPU terrain chunks on the CPU even
+// when compute shaders are available.
+static bool g_cpuCull = false;
+
+// Set from the command line to skip GPU terrain chunks that are hidden
+// behind nearer ones, using occlusion queries.
+static bool g_occlusion = false;
+
+// The eye that SetupEye() was last called for, so that the render callbacks
+// can tell the eyes apart.
+static size_t g_currentEye = 0;
+
+// Set from the command line to draw the map from chunk meshes that are
+// built on the CPU, in parallel, only when their cells change.
+static bool g_useMeshTerrain = false;
+
+// Runs CPU work such as chunk meshing and glyph rasterization across all of
+// the cores.  Created in main() once the thread count is known.
+static std::unique_ptr<TaskScheduler> g_scheduler;
+
+// Set from the command line to pin the render thread and the other threads
+// to cores, to schedule them in real time and to lock the process in memory.
+static ThreadTuning g_threadTuning;
+
+// How long each frame took, and how long frame steps waited to start once
+// they were ready, on the render thread and on the others.  Reported at
+// exit, to show whether the thread tuning shortens the tail.
+static LatencyHistogram g_frameTimes;
+static LatencyHistogram g_renderStepLatency;
+static LatencyHistogram g_workerStepLatency;
+
+// Set from the command line to limit how many frames the CPU may have
+// submitted before the GPU finishes the oldest of them.
+static size_t g_maxFramesInFlight = 2;
+
+// Set from the command line, for displays where presenting blocks until the
+// vertical sync, to start each frame just in time to render it before the
+// next sync rather than as soon as the last one has been presented.
+static bool g_jitStart = false;
+static FrameScheduler g_frameScheduler;
+static GLuint g_drawnQuery = 0;  ///< GPU time when the world was last drawn
+
+// Always on: keeps the phase timings and events of the last few thousand
+// frames, and writes the seconds before a frame-time spike to a trace file.
+// The spike threshold, history and file names can be set from the command
+// line.
+static FlightRecorder g_flightRecorder;
+
+// Set from the command line to export frame and pipeline metrics for
+// monitoring, to a Prometheus text file or on a Unix socket.  The render
+// loop updates them once a frame, and the exporter's thread writes them out.
+static MetricsRegistry g_metrics;
+static MetricsExporter g_metricsExporter(g_metrics);
+
+// Count every allocation, for the flight recorder.
+void* operator new(std::size_t size) { return countedAllocate(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+
+// Set from the command line to store the glyph atlas RGTC1-compressed.
+static bool g_compressAtlas = false;
+
+// Mip levels below the full-size glyph atlas.  The smallest glyphs are
+// 48 / 16 = 3 texels, about as small as a floor cell gets on screen.
+static const int ATLAS_MIP_LEVELS = 4;
+
+/// @brief All of the printable characters of the font in one page.
+///
+///   The glyphs are laid out on a grid of equal-sized cells, 16 to a row,
+/// each glyph in the top-left corner of its cell.  The page is the glyph
+/// layer of the tileset, with a mip chain sampled trilinearly and
+/// anisotropically where that is supported, so that floor glyphs seen at a
+/// grazing angle neither shimmer nor read texels scattered across the
+/// page.  The cells are padded so that no level bleeds one glyph into the
+/// next.  Shared by the text, GPU terrain and chunk mesh paths.
+///
+///   With g_compressAtlas set, the tileset holding the page is compressed
+/// to RGTC1 when it is built.
+class GlyphAtlas {
+  public:
+    static const int FIRST_GLYPH = 32;
+    static const int NUM_GLYPHS = 95;
+    static const int COLUMNS = 16;
+
+    GlyphAtlas() {}
+
+    /// @brief Rasterize the glyphs and build the tileset from them, if not
+    /// done yet.
+    ///
+    /// Must be called after OpenGL and FreeType are initialized.  The glyphs
+    /// are rendered by tasks on the scheduler, each with its own face.
+    /// @return True on success, false if the font could not be rendered.
+    bool build(TaskScheduler& scheduler) {
+        if (ready) {
+            return true;
+        }
+        if (!g_ft || !g_fontFile) {
+            std::cerr << "GlyphAtlas::build(): No font" << std::endl;
+            return false;
+        }
+
+        // A face may only be used by one thread at a time, and creating or
+        // destroying one changes the library, so each task opens its own
+        // face under the lock and renders its share of the glyphs without it.
+        std::vector<Glyph> glyphs(NUM_GLYPHS);
+        std::mutex libraryMutex;
+        std::atomic<bool> ok(true);
+        size_t grain = (NUM_GLYPHS + scheduler.threadCount() - 1) /
+                       scheduler.threadCount();
+        TaskScheduler::TaskGroup group;
+        for (size_t first = 0; first < NUM_GLYPHS; first += grain) {
+            size_t last = std::min(first + grain, static_cast<size_t>(NUM_GLYPHS));
+            scheduler.spawn(group, [&, first, last]() {
+                FT_Face face = nullptr;
+                {
+                    std::lock_guard<std::mutex> lock(libraryMutex);
+                    if (FT_New_Face(g_ft, g_fontFile, 0, &face)) {
+                        ok = false;
+                        return;
+                    }
+                }
+                FT_Set_Pixel_Sizes(face, 0, FONT_SIZE);
+                for (size_t i = first; i < last; i++) {
+                    rasterize(face, static_cast<int>(i), glyphs[i]);
+                }
+                std::lock_guard<std::mutex> lock(libraryMutex);
+                FT_Done_Face(face);
+            });
+        }
+        scheduler.wait(group);
+        if (!ok) {
+            std::cerr << "GlyphAtlas::build(): Could not open font "
+                      << g_fontFile << std::endl;
+            return false;
+        }
+
+        int cellSize = 0;
+        for (const Glyph& g : glyphs) {
+            cellSize = std::max(cellSize, std::max(g.width, g.rows));
+        }
+        cellSize = mipAlignedCellSize(cellSize, ATLAS_MIP_LEVELS);
+        int rows = (NUM_GLYPHS + COLUMNS - 1) / COLUMNS;
+        int atlasWidth = COLUMNS * cellSize;
+        int atlasHeight = rows * cellSize;
+        std::vector<std::vector<GLubyte> > chain(1);
+        std::vector<GLubyte>& pixels = chain[0];
+        pixels.assign(atlasWidth * atlasHeight, 0);
+        for (int i = 0; i < NUM_GLYPHS; i++) {
+            const Glyph& g = glyphs[i];
+            int x0 = (i % COLUMNS) * cellSize;
+            int y0 = (i / COLUMNS) * cellSize;
+            for (int r = 0; r < g.rows; r++) {
+                std::copy(g.pixels.begin() + r * g.width,
+                          g.pixels.begin() + (r + 1) * g.width,
+                          pixels.begin() + (y0 + r) * atlasWidth + x0);
+            }
+            metrics[4 * i + 0] = static_cast<GLfloat>(g.left);
+            metrics[4 * i + 1] = static_cast<GLfloat>(g.top);
+            metrics[4 * i + 2] = static_cast<GLfloat>(g.width);
+            metrics[4 * i + 3] = static_cast<GLfloat>(g.rows);
+            advances[i] = static_cast<GLfloat>(g.advance);
+        }
+        cellU = static_cast<GLfloat>(cellSize) / atlasWidth;
+        cellV = static_cast<GLfloat>(cellSize) / atlasHeight;
+        texelU = 1.0f / atlasWidth;
+        texelV = 1.0f / atlasHeight;
+        buildMipChain(chain, atlasWidth, atlasHeight, ATLAS_MIP_LEVELS);
+        ready = tileset.build(scheduler, chain, atlasWidth, atlasHeight,
+                              g_compressAtlas);
+        return ready;
+    }
+
+    /// @brief Whether build() has succeeded.
+    bool built() const { return ready; }
+
+    /// @brief (left, top, width, rows) in pixels for each glyph.
+    const GLfloat* glyphMetrics() const { return metrics; }
+
+    /// @brief Horizontal advance in pixels for each glyph.
+    const GLfloat* glyphAdvances() const { return advances; }
+
+    /// @brief Texture coordinates (s0, t0, s1, t1) of a glyph's top-left
+    /// and bottom-right corners in the glyph layer.
+    /// @param [in] index Glyph index, the character minus FIRST_GLYPH.
+    void glyphTexCoords(int index, GLfloat st[4]) const {
+        st[0] = (index % COLUMNS) * cellU;
+        st[1] = (index / COLUMNS) * cellV;
+        st[2] = st[0] + metrics[4 * index + 2] * texelU;
+        st[3] = st[1] + metrics[4 * index + 3] * texelV;
+    }
+
+    /// @brief Size of one atlas cell, in texture coordinates.
+    GLfloat cellWidth() const { return cellU; }
+    GLfloat cellHeight() const { return cellV; }
+
+    /// @brief Size of one texel, in texture coordinates.
+    GLfloat texelWidth() const { return texelU; }
+    GLfloat texelHeight() const { return texelV; }
+
+  private:
+    GlyphAtlas(const GlyphAtlas&) = delete;
+    GlyphAtlas& operator=(const GlyphAtlas&) = delete;
+
+    struct Glyph {
+        int left = 0;
+        int top = 0;
+        int width = 0;
+        int rows = 0;
+        int advance = 0;
+        std::vector<GLubyte> pixels;  ///< Tightly packed, width * rows
+    };
+
+    bool ready = false;
+    GLfloat metrics[4 * NUM_GLYPHS] = {};
+    GLfloat advances[NUM_GLYPHS] = {};
+    GLfloat cellU = 0;
+    GLfloat cellV = 0;
+    GLfloat texelU = 0;
+    GLfloat texelV = 0;
+
+    static void rasterize(FT_Face face, int index, Glyph& out) {
+        if (FT_Load_Char(face, FIRST_GLYPH + index, FT_LOAD_RENDER)) {
+            return;
+        }
+        FT_GlyphSlot g = face->glyph;
+        out.left = g->bitmap_left;
+        out.top = g->bitmap_top;
+        out.width = static_cast<int>(g->bitmap.width);
+        out.rows = static_cast<int>(g->bitmap.rows);
+        out.advance = static_cast<int>(g->advance.x / 64);
+        out.pixels.resize(out.width * out.rows);
+        for (int r = 0; r < out.rows; r++) {
+            for (int c = 0; c < out.width; c++) {
+                out.pixels[r * out.width + c] =
+                    g->bitmap.buffer[c + g->bitmap.pitch * r];
+            }
+        }
+    }
+};
+static GlyphAtlas glyphAtlas;
+
+/// @brief Where the text run cache keeps each run: laid out at the origin
+/// into its own vertex buffer, and moved into place by the model/view
+/// matrix when drawn.  Must only be used on the render thread.
+struct GLTextRuns {
+    struct Run {
+        GLuint vertexArray = 0;
+        GLuint buffer = 0;
+        GLsizei count = 0;  ///< Vertices in buffer
+    };
+
+    static void store(Run& run, const std::vector<FontVertex>& vertices) {
+        run.count = static_cast<GLsizei>(vertices.size());
+        if (run.count == 0) {
+            return;
+        }
+        glGenVertexArrays(1, &run.vertexArray);
+        glGenBuffers(1, &run.buffer);
+        glBindVertexArray(run.vertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, run.buffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(FontVertex) * vertices.size(),
+                     vertices.data(), GL_STATIC_DRAW);
+        size_t const stride = sizeof(FontVertex);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
+                              (GLvoid*)(offsetof(FontVertex, pos)));
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride,
+                              (GLvoid*)(offsetof(FontVertex, col)));
+        glEnableVertexAttribArray(2);
+        glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride,
+                              (GLvoid*)(offsetof(FontVertex, tex)));
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    static void release(Run& run) {
+        if (run.buffer) {
+            glDeleteBuffers(1, &run.buffer);
+            glDeleteVertexArrays(1, &run.vertexArray);
+        }
+    }
+};
+
+/// @brief Retained meshes of the strings render_text() has drawn, at
+/// FONT_SIZE.
+static TextRunCache<GlyphAtlas, GLTextRuns> textRuns(glyphAtlas);
+
+/// @brief Render a string of text into a specified space.
+///
+///   The text will be in the X-Y plane whose z value is specified.
+/// It will be axis aligned, with the text reading towards +X with
+/// its top rendered towards +Y.
+///   The quadrilateral is rendered into whatever space is defined by
+/// the projection and model/view transforms being used by the shader.
+///   The glyphs come from the glyph layer of the tileset, so the whole
+/// string is drawn with one call.  The string's mesh is kept in textRuns,
+/// so drawing the same string again only moves it into place.
+///
+/// @param [in] projection The OpenGL projection matrix to pass to the shader.
+/// @param [in] modelView The OpenGL model/view matrix to pass to the shader.
+/// @param [in] text The null-terminated string of text to be rendered.
+/// @param [in] x Coordinates of the center of the text.
+/// @param [in] y Coordinates of the center of the text.
+/// @param [in] z Coordinates of the center of the text.
+/// @param [in] sx Spacing for the text in x.
+/// @param [in] sy Spacing for the text in y.
+
+bool render_text(const GLdouble projection[], const GLdouble modelView[],
+    const char *text, float x, float y, float z, float sx, float sy, int plane)
+{
+  if (!glyphAtlas.built()) {
+    std::cerr << "render_text(): No glyph atlas" << std::endl;
+    return false;
+  }
+
+  const GLTextRuns::Run& run = textRuns.get(text, sx, sy, plane);
+  if (run.count == 0) {
+    return true;
+  }
+
+  // The run was laid out at the origin, so move it to (x, y, z).
+  GLdouble shifted[16];
+  std::copy(modelView, modelView + 16, shifted);
+  for (int i = 0; i < 4; i++) {
+    shifted[12 + i] += modelView[i] * x + modelView[4 + i] * y +
+                       modelView[8 + i] * z;
+  }
+  sampleShader.useProgram(projection, shifted, Tileset::GLYPH_LAYER);
+
+  // Enable blending using alpha.
+  glEnable(GL_BLEND);
+  glBlendFunc(GL_SRC_COLOR, GL_ONE_MINUS_SRC_ALPHA);
+
+  // Draw the quads.
+  glBindVertexArray(run.vertexArray);
+  glDrawArrays(GL_TRIANGLES, 0, run.count);
+  g_drawCalls++;
+  glBindVertexArray(0);
+  glDisable(GL_BLEND);
+
+  GLenum err = glGetError();
+  if (err != GL_NO_ERROR) {
+    std::cerr << "render_text(): Error drawing text: "
+      << err << std::endl;
+    return false;
+  }
+  return true;
+}
+
+/// @brief Vertex shader for the GPU terrain path.
+///
+///   The only vertex attribute is the per-instance index of the map cell,
+/// which lets the cells be ordered so each chunk of the map is a contiguous
+/// range of instances.  Each of the cell's 30 vertices is generated from
+/// gl_VertexID: vertices 0-5 are the floor or standing glyph for the cell
+/// and 6-29 are the four faces of a draw_box-style wall.  The cell and its
+/// neighbours are fetched from an integer texture holding the raw map
+/// characters, and the tile table in MapGrid.h, uploaded as tileKinds,
+/// decides which of the quads are used; as on the CPU paths, characters
+/// without a glyph in the atlas are not drawn.  Unused quads and wall faces
+/// that are hidden by a neighbouring wall are moved outside the clip volume
+/// so they are discarded.
+/// @param [in] cellIndex Row-major index of the map cell for this instance.
+/// @param [in] map The map, one GL_R8UI texel per cell.
+/// @param [in] glyphMetrics Per-character (left, top, width, rows) in pixels.
+/// @param [in] tileKinds tileKindFor() of each byte, four to a uint.
+/// @param [in] tileLayers Tileset layer for each TileKind.
+static const GLchar* terrainVertexShader =
+    "#version 330 core\n"
+    "layout(location = 0) in uint cellIndex;\n"
+    "uniform usampler2D map;\n"
+    "uniform vec4 glyphMetrics[95];\n"
+    "uniform uvec4 tileKinds[16];\n"
+    "uniform int tileLayers[4];\n"
+    "uniform vec2 atlasCellSize;\n"
+    "uniform vec2 atlasTexelSize;\n"
+    "uniform ivec2 playerCell;\n"
+    "uniform float spacing;\n"
+    "uniform float glyphY;\n"
+    "uniform float glyphScale;\n"
+    "uniform float wallHalfWidth;\n"
+    "uniform mat4 modelView;\n"
+    "uniform mat4 projection;\n"
+    "out vec3 textureCoord;\n"
+    "const vec2 corners[6] = vec2[6](vec2(0,1), vec2(1,0), vec2(1,1),\n"
+    "                                vec2(0,1), vec2(0,0), vec2(1,0));\n"
+    "uint tileKind(uint c) {\n"
+    "   uint word = tileKinds[c / 16u][(c / 4u) % 4u];\n"
+    "   return (word >> (8u * (c % 4u))) & 255u;\n"
+    "}\n"
+    "uint cellAt(ivec2 cell, ivec2 size) {\n"
+    "   if (any(lessThan(cell, ivec2(0))) || any(greaterThanEqual(cell, size))) {\n"
+    "       return 32u;\n"
+    "   }\n"
+    "   return texelFetch(map, cell, 0).r;\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "   ivec2 size = textureSize(map, 0);\n"
+    "   ivec2 cell = ivec2(int(cellIndex) % size.x, int(cellIndex) / size.x);\n"
+    "   uint c = cellAt(cell, size);\n"
+    "   uint kind = tileKind(c);\n"
+    "   int quad = gl_VertexID / 6;\n"
+    "   vec2 uv = corners[gl_VertexID % 6];\n"
+    "   gl_Position = vec4(2.0, 2.0, 2.0, 1.0);\n"
+    "   textureCoord = vec3(0.0);\n"
+    "   bool wall = (kind == 1u);\n"
+    "   if (kind == 0u || c < 32u || c > 126u || (quad == 0) == wall) return;\n"
+    "   vec3 center = vec3(spacing * float(cell.y - playerCell.y), glyphY,\n"
+    "                      spacing * float(playerCell.x - cell.x));\n"
+    "   int plane = (kind == 2u) ? 1 : 0;\n"
+    "   if (wall) {\n"
+    "       ivec2 offsets[4] = ivec2[4](ivec2(0,1), ivec2(0,-1), ivec2(-1,0), ivec2(1,0));\n"
+    "       ivec2 neighbor = cell + offsets[quad - 1];\n"
+    "       if (tileKind(cellAt(neighbor, size)) == 1u) return;\n"
+    "       if (quad <= 2) {\n"
+    "           plane = 2;\n"
+    "           center.x += (quad == 1) ? wallHalfWidth : -wallHalfWidth;\n"
+    "       } else {\n"
+    "           center.z += (quad == 3) ? wallHalfWidth : -wallHalfWidth;\n"
+    "       }\n"
+    "   }\n"
+    "   vec4 m = glyphMetrics[int(c) - 32];\n"
+    "   float w = m.z * glyphScale;\n"
+    "   float h = m.w * glyphScale;\n"
+    "   vec3 p;\n"
+    "   if (plane == 0) {\n"
+    "       p = vec3(center.x + m.x * glyphScale + uv.x * w,\n"
+    "                center.y + m.y * glyphScale - uv.y * h, center.z);\n"
+    "   } else if (plane == 1) {\n"
+    "       p = vec3(center.x + m.x * glyphScale + uv.x * w, center.y,\n"
+    "                center.z + m.y * glyphScale - (1.0 - uv.y) * h);\n"
+    "   } else {\n"
+    "       p = vec3(center.x, center.y + m.y * glyphScale - uv.y * h,\n"
+    "                center.z + m.x * glyphScale + (1.0 - uv.x) * w);\n"
+    "   }\n"
+    "   int index = int(c) - 32;\n"
+    "   vec2 origin = vec2(index % 16, index / 16) * atlasCellSize;\n"
+    "   textureCoord = vec3(origin + uv * m.zw * atlasTexelSize,\n"
+    "                       float(tileLayers[kind]));\n"
+    "   gl_Position = projection * modelView * vec4(p, 1.0);\n"
+    "}\n";
+
+/// @brief Fragment shader for the GPU terrain path.
+///
+///   Produces the same color as the text path does with the glyph layer
+/// and a white, zero-alpha vertex color.
+static const GLchar* terrainFragmentShader =
+    "#version 330 core\n"
+    "in vec3 textureCoord;\n"
+    "layout(location = 0) out vec4 color;\n"
+    "uniform sampler2DArray atlas;\n"
+    "void main()\n"
+    "{\n"
+    "   float l = texture(atlas, textureCoord).r;\n"
+    "   color = vec4(l, l, l, 0.0);\n"
+    "}\n";
+
+/// @brief Compute shader that culls map chunks for the GPU terrain path.
+///
+///   Each invocation tests one chunk's bounding box against the view
+/// frustums of all of the eyes and writes the indirect draw command for
+/// that chunk, with zero instances if no eye can see it.  The commands are
+/// then drawn with a single glMultiDrawArraysIndirect().
+/// @param [in] viewProjection Projection times view matrix for each eye.
+/// @param [in] numViews How many of the viewProjection matrices are used.
+static const GLchar* terrainCullShader =
+    "#version 430 core\n"
+    "layout(local_size_x = 64) in;\n"
+    "struct Chunk {\n"
+    "   vec4 boxMin;\n"
+    "   vec4 boxMax;\n"
+    "   uint firstInstance;\n"
+    "   uint instanceCount;\n"
+    "   uint pad0;\n"
+    "   uint pad1;\n"
+    "};\n"
+    "struct DrawArraysIndirectCommand {\n"
+    "   uint count;\n"
+    "   uint instanceCount;\n"
+    "   uint first;\n"
+    "   uint baseInstance;\n"
+    "};\n"
+    "layout(std430, binding = 0) readonly buffer Chunks { Chunk chunks[]; };\n"
+    "layout(std430, binding = 1) writeonly buffer Commands {\n"
+    "   DrawArraysIndirectCommand commands[];\n"
+    "};\n"
+    "uniform mat4 viewProjection[2];\n"
+    "uniform int numViews;\n"
+    "uniform uint numChunks;\n"
+    "uniform uint verticesPerCell;\n"
+    "bool insideFrustum(mat4 m, vec3 lo, vec3 hi) {\n"
+    "   vec4 c[8];\n"
+    "   for (int i = 0; i < 8; i++) {\n"
+    "       vec3 p = vec3((i & 1) != 0 ? hi.x : lo.x, (i & 2) != 0 ? hi.y : lo.y,\n"
+    "                     (i & 4) != 0 ? hi.z : lo.z);\n"
+    "       c[i] = m * vec4(p, 1.0);\n"
+    "   }\n"
+    "   for (int axis = 0; axis < 3; axis++) {\n"
+    "       bool allBelow = true;\n"
+    "       bool allAbove = true;\n"
+    "       for (int i = 0; i < 8; i++) {\n"
+    "           allBelow = allBelow && (c[i][axis] < -c[i].w);\n"
+    "           allAbove = allAbove && (c[i][axis] > c[i].w);\n"
+    "       }\n"
+    "       if (allBelow || allAbove) return false;\n"
+    "   }\n"
+    "   return true;\n"
+    "}\n"
+    "void main()\n"
+    "{\n"
+    "   uint i = gl_GlobalInvocationID.x;\n"
+    "   if (i >= numChunks) return;\n"
+    "   Chunk chunk = chunks[i];\n"
+    "   bool visible = false;\n"
+    "   for (int v = 0; v < numViews; v++) {\n"
+    "       visible = visible ||\n"
+    "           insideFrustum(viewProjection[v], chunk.boxMin.xyz, chunk.boxMax.xyz);\n"
+    "   }\n"
+    "   commands[i].count = verticesPerCell;\n"
+    "   commands[i].instanceCount = visible ? chunk.instanceCount : 0u;\n"
+    "   commands[i].first = 0u;\n"
+    "   commands[i].baseInstance = chunk.firstInstance;\n"
+    "}\n";
+
+/// @brief Shaders used to draw chunk bounding boxes for occlusion queries.
+///
+///   The 36 vertices of the box are generated from gl_VertexID, with the
+/// corners taken from the boxMin and boxMax uniforms.  Nothing is written to
+/// the color buffer so the fragment shader is trivial.
+static const GLchar* boxVertexShader =
+    "#version 330 core\n"
+    "uniform vec3 boxMin;\n"
+    "uniform vec3 boxMax;\n"
+    "uniform mat4 modelView;\n"
+    "uniform mat4 projection;\n"
+    "const int corners[36] = int[36](0,2,6, 0,6,4,  1,5,7, 1,7,3,\n"
+    "                                0,4,5, 0,5,1,  2,3,7, 2,7,6,\n"
+    "                                0,1,3, 0,3,2,  4,6,7, 4,7,5);\n"
+    "void main()\n"
+    "{\n"
+    "   int c = corners[gl_VertexID];\n"
+    "   vec3 p = vec3((c & 1) != 0 ? boxMax.x : boxMin.x,\n"
+    "                 (c & 2) != 0 ? boxMax.y : boxMin.y,\n"
+    "                 (c & 4) != 0 ? boxMax.z : boxMin.z);\n"
+    "   gl_Position = projection * modelView * vec4(p, 1.0);\n"
+    "}\n";
+
+static const GLchar* boxFragmentShader =
+    "#version 330 core\n"
+    "layout(location = 0) out vec4 color;\n"
+    "void main()\n"
+    "{\n"
+    "   color = vec4(1.0);\n"
+    "}\n";
+
+/// @brief Vertex shader for the actor batch.
+///
+///   Every actor is one instance of a six-vertex glyph quad standing in
+/// the X-Y plane, placed the same way the terrain paths place a standing
+/// glyph.  The per-instance attributes come straight from the
+/// structure-of-arrays actor list in MapGrid.h.
+/// @param [in] actorX Row of the actor's cell.
+/// @param [in] actorZ Column of the actor's cell.
+/// @param [in] actorKind Map character of the actor.
+/// @param [in] actorColor Color the glyph is tinted.
+/// @param [in] actorLayer Tileset layer the glyph is taken from.
+static const GLchar* actorVertexShader =
+    "#version 330 core\n"
+    "layout(location = 0) in float actorX;\n"
+    "layout(location = 1) in float actorZ;\n"
+    "layout(location = 2) in uint actorKind;\n"
+    "layout(location = 3) in vec4 actorColor;\n"
+    "layout(location = 4) in uint actorLayer;\n"
+    "uniform vec4 glyphMetrics[95];\n"
+    "uniform vec2 atlasCellSize;\n"
+    "uniform vec2 atlasTexelSize;\n"
+    "uniform float spacing;\n"
+    "uniform float glyphY;\n"
+    "uniform float glyphScale;\n"
+    "uniform mat4 modelView;\n"
+    "uniform mat4 projection;\n"
+    "out vec3 textureCoord;\n"
+    "out vec4 fragmentColor;\n"
+    "const vec2 corners[6] = vec2[6](vec2(0,1), vec2(1,0), vec2(1,1),\n"
+    "                                vec2(0,1), vec2(0,0), vec2(1,0));\n"
+    "void main()\n"
+    "{\n"
+    "   vec2 uv = corners[gl_VertexID];\n"
+    "   int index = int(actorKind) - 32;\n"
+    "   vec4 m = glyphMetrics[index];\n"
+    "   vec3 p = vec3(spacing * actorX + m.x * glyphScale + uv.x * m.z * glyphScale,\n"
+    "                 glyphY + m.y * glyphScale - uv.y * m.w * glyphScale,\n"
+    "                 -spacing * actorZ);\n"
+    "   vec2 origin = vec2(index % 16, index / 16) * atlasCellSize;\n"
+    "   textureCoord = vec3(origin + uv * m.zw * atlasTexelSize,\n"
+    "                       float(actorLayer));\n"
+    "   fragmentColor = actorColor;\n"
+    "   gl_Position = projection * modelView * vec4(p, 1.0);\n"
+    "}\n";
+
+/// @brief Fragment shader for the actor batch.  Like the terrain fragment
+/// shader, but tinted by the actor's color.
+static const GLchar* actorFragmentShader =
+    "#version 330 core\n"
+    "in vec3 textureCoord;\n"
+    "in vec4 fragmentColor;\n"
+    "layout(location = 0) out vec4 color;\n"
+    "uniform sampler2DArray atlas;\n"
+    "void main()\n"
+    "{\n"
+    "   float l = texture(atlas, textureCoord).r;\n"
+    "   color = vec4(fragmentColor.rgb * l, 0.0);\n"
+    "}\n";
+
+/// @brief Draws the actors on the map (player, monsters and items) as a
+/// single instanced batch.
+///
+///   The actors change every turn while the terrain almost never does, so
+/// they are kept out of the terrain meshes entirely.  Each turn the whole
+/// actor list is re-sent as one small instance buffer laid out the same
+/// way as MapActors: all of the x values, then z, then kind, then color,
+/// followed by the tileset layer of each actor's glyph.
+class ActorBatch {
+  public:
+    ActorBatch() {}
+
+    ~ActorBatch() {
+        if (initialized) {
+            glDeleteVertexArrays(1, &vertexArrayId);
+            glDeleteBuffers(1, &instanceBuffer);
+            glDeleteProgram(programId);
+        }
+    }
+
+    /// @brief Must be called after the glyph atlas is built.
+    /// @return True on success, false if the shaders did not build.
+    bool init() {
+        if (initialized) {
+            return true;
+        }
+        if (!buildProgram()) {
+            return false;
+        }
+        glGenVertexArrays(1, &vertexArrayId);
+        glGenBuffers(1, &instanceBuffer);
+        initialized = true;
+        return true;
+    }
+
+    /// @brief Replace the actors with a new list.  Must be called on the
+    /// render thread.
+    void upload(const MapActors& actors) {
+        if (!initialized) {
+            return;
+        }
+        count = static_cast<GLsizei>(actors.size());
+        if (count == 0) {
+            return;
+        }
+        // Keep each array four-byte aligned.
+        size_t n = actors.size();
+        size_t zOffset = n * sizeof(float);
+        size_t kindOffset = 2 * n * sizeof(float);
+        size_t colorOffset = kindOffset + ((n + 3) & ~size_t(3));
+        size_t layerOffset = colorOffset + n * sizeof(uint32_t);
+        size_t bytes = layerOffset + n;
+        layers.resize(n);
+        for (size_t i = 0; i < n; i++) {
+            layers[i] = static_cast<GLubyte>(
+                Tileset::layerFor(tileKindFor(actors.kind[i])));
+        }
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        // Orphan the old storage so we never wait on a frame still using it.
+        glBufferData(GL_ARRAY_BUFFER, bytes, nullptr, GL_STREAM_DRAW);
+        glBufferSubData(GL_ARRAY_BUFFER, 0, zOffset, actors.x.data());
+        glBufferSubData(GL_ARRAY_BUFFER, zOffset, zOffset, actors.z.data());
+        glBufferSubData(GL_ARRAY_BUFFER, kindOffset, n, actors.kind.data());
+        glBufferSubData(GL_ARRAY_BUFFER, colorOffset, n * sizeof(uint32_t),
+                        actors.color.data());
+        glBufferSubData(GL_ARRAY_BUFFER, layerOffset, n, layers.data());
+
+        glBindVertexArray(vertexArrayId);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 1, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
+        glVertexAttribDivisor(0, 1);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 1, GL_FLOAT, GL_FALSE, 0, (GLvoid*)zOffset);
+        glVertexAttribDivisor(1, 1);
+        glEnableVertexAttribArray(2);
+        glVertexAttribIPointer(2, 1, GL_UNSIGNED_BYTE, 0, (GLvoid*)kindOffset);
+        glVertexAttribDivisor(2, 1);
+        glEnableVertexAttribArray(3);
+        glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, 0,
+                              (GLvoid*)colorOffset);
+        glVertexAttribDivisor(3, 1);
+        glEnableVertexAttribArray(4);
+        glVertexAttribIPointer(4, 1, GL_UNSIGNED_BYTE, 0, (GLvoid*)layerOffset);
+        glVertexAttribDivisor(4, 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    /// @brief Draw all of the actors with one call.  Expects blending to be
+    /// set up as for the terrain.
+    void draw(const GLdouble projection[], const GLdouble modelView[]) {
+        if (!initialized || count == 0) {
+            return;
+        }
+        GLfloat projectionf[16];
+        GLfloat modelViewf[16];
+        for (int i = 0; i < 16; i++) {
+            projectionf[i] = static_cast<GLfloat>(projection[i]);
+            modelViewf[i] = static_cast<GLfloat>(modelView[i]);
+        }
+        glUseProgram(programId);
+        glUniformMatrix4fv(projectionUniformId, 1, GL_FALSE, projectionf);
+        glUniformMatrix4fv(modelViewUniformId, 1, GL_FALSE, modelViewf);
+        glBindVertexArray(vertexArrayId);
+        glDrawArraysInstanced(GL_TRIANGLES, 0, 6, count);
+        g_drawCalls++;
+        glBindVertexArray(0);
+    }
+
+  private:
+    ActorBatch(const ActorBatch&) = delete;
+    ActorBatch& operator=(const ActorBatch&) = delete;
+
+    bool initialized = false;
+    GLuint programId = 0;
+    GLuint vertexArrayId = 0;
+    GLuint instanceBuffer = 0;
+    GLsizei count = 0;  ///< Actors in instanceBuffer
+    std::vector<GLubyte> layers;  ///< Staging for the layer of each actor
+    GLint projectionUniformId = -1;
+    GLint modelViewUniformId = -1;
+
+    bool buildProgram() {
+        GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
+        GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(vertexShaderId, 1, &actorVertexShader, NULL);
+        glCompileShader(vertexShaderId);
+        glShaderSource(fragmentShaderId, 1, &actorFragmentShader, NULL);
+        glCompileShader(fragmentShaderId);
+        programId = glCreateProgram();
+        glAttachShader(programId, vertexShaderId);
+        glAttachShader(programId, fragmentShaderId);
+        glLinkProgram(programId);
+        glDeleteShader(vertexShaderId);
+        glDeleteShader(fragmentShaderId);
+
+        GLint result = GL_FALSE;
+        glGetProgramiv(programId, GL_LINK_STATUS, &result);
+        if (result == GL_FALSE) {
+            int infoLength = 0;
+            glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &infoLength);
+            std::vector<GLchar> errorMessage(infoLength + 1);
+            glGetProgramInfoLog(programId, infoLength, NULL, &errorMessage[0]);
+            std::cerr << "ActorBatch: Shader program link failed: "
+                      << &errorMessage[0] << std::endl;
+            glDeleteProgram(programId);
+            programId = 0;
+            return false;
+        }
+
+        projectionUniformId = glGetUniformLocation(programId, "projection");
+        modelViewUniformId = glGetUniformLocation(programId, "modelView");
+        glUseProgram(programId);
+        glUniform1i(glGetUniformLocation(programId, "atlas"), 0);
+        glUniform1f(glGetUniformLocation(programId, "spacing"), MAP_CELL_SPACING);
+        glUniform1f(glGetUniformLocation(programId, "glyphY"), MAP_GLYPH_Y);
+        glUniform1f(glGetUniformLocation(programId, "glyphScale"), MAP_GLYPH_SCALE);
+        glUniform4fv(glGetUniformLocation(programId, "glyphMetrics"),
+                     GlyphAtlas::NUM_GLYPHS, glyphAtlas.glyphMetrics());
+        glUniform2f(glGetUniformLocation(programId, "atlasCellSize"),
+                    glyphAtlas.cellWidth(), glyphAtlas.cellHeight());
+        glUniform2f(glGetUniformLocation(programId, "atlasTexelSize"),
+                    glyphAtlas.texelWidth(), glyphAtlas.texelHeight());
+        glUseProgram(0);
+        return true;
+    }
+};
+
+/// @brief Class to draw the map from a GPU-resident copy of it.
+///
+///   The map is stored in a GL_R8UI texture with one texel per cell holding
+/// the raw character, and all of the printable glyphs are packed into a
+/// single atlas texture.  The vertex shader builds the geometry for every
+/// cell, so the CPU does no tessellation at all.  When the map changes, only
+/// the span of rows that differ from what is on the GPU is re-sent.
+///
+///   The map is split into square chunks of cells that are culled against
+/// the eye frustums each frame.  When OpenGL 4.3 is available this is done
+/// by a compute shader that writes indirect draw commands, so all of the
+/// visible chunks are drawn with one call and the CPU never looks at them.
+/// Otherwise the chunks are culled on the CPU and drawn one at a time.
+///
+///   Only the static terrain goes into the map texture.  The player,
+/// monsters and items are split off and drawn as one instanced batch, so a
+/// monster moving never re-sends a row of the texture.
+class GpuTerrain {
+  public:
+    GpuTerrain() {}
+
+    ~GpuTerrain() {
+        if (initialized) {
+            glDeleteProgram(programId);
+            glDeleteVertexArrays(1, &vertexArrayId);
+            glDeleteBuffers(1, &instanceBuffer);
+            glDeleteTextures(1, &mapTex);
+        }
+        if (gpuCull) {
+            glDeleteProgram(cullProgramId);
+            glDeleteBuffers(1, &chunkBuffer);
+            glDeleteBuffers(1, &commandBuffer);
+        }
+        if (occlusion) {
+            glDeleteProgram(boxProgramId);
+            for (int f = 0; f < 2; f++) {
+                for (size_t e = 0; e < MAX_VIEWS; e++) {
+                    glDeleteQueries(static_cast<GLsizei>(queries[f][e].size()),
+                                    queries[f][e].data());
+                }
+            }
+        }
+    }
+
+    /// @brief Must be called after OpenGL and the font are initialized.
+    /// @param [in] allowGpuCull Use the compute-shader culling path if the
+    ///             OpenGL version supports it.
+    /// @return True on success, false if the shaders or atlas could not be built.
+    bool init(bool allowGpuCull = true) {
+        if (initialized) {
+            return true;
+        }
+        if (!g_face) {
+            std::cerr << "GpuTerrain::init(): No face" << std::endl;
+            return false;
+        }
+        if (!buildProgram() || !buildAtlas() || !actors.init()) {
+            return false;
+        }
+        glGenTextures(1, &mapTex);
+        glGenBuffers(1, &instanceBuffer);
+        glGenVertexArrays(1, &vertexArrayId);
+        glBindVertexArray(vertexArrayId);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glEnableVertexAttribArray(0);
+        glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, 0, (GLvoid*)0);
+        glVertexAttribDivisor(0, 1);
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        if (allowGpuCull && GLEW_VERSION_4_3) {
+            gpuCull = buildCullProgram();
+            if (!gpuCull) {
+                std::cerr << "GpuTerrain::init(): Culling chunks on the CPU"
+                          << std::endl;
+            }
+        }
+        initialized = true;
+        return true;
+    }
+
+    /// @brief Bring the GPU copy of the map up to date.
+    ///
+    /// Re-creates the texture if the terrain changed size; otherwise sends
+    /// a single glTexSubImage2D covering the rows of terrain that changed,
+    /// if any.  The actors are re-sent only when they changed.
+    void update(const MapGrid& map) {
+        if (!init()) {
+            return;
+        }
+        MapActors mapActors;
+        splitMapLayers(map, terrain, mapActors);
+        if (mapActors != uploadedActors) {
+            actors.upload(mapActors);
+            uploadedActors = mapActors;
+        }
+        if (terrain.width == 0 || terrain.height == 0) {
+            width = height = 0;
+            chunks.clear();
+            return;
+        }
+
+        bool resized = (terrain.width != width || terrain.height != height);
+        bool moved = (terrain.playerRow != playerRow ||
+                      terrain.playerCol != playerCol);
+        playerRow = terrain.playerRow;
+        playerCol = terrain.playerCol;
+
+        // The map stays bound to unit 1, which nothing else uses, so draw()
+        // does not need to bind it.
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, mapTex);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+        if (resized) {
+            width = terrain.width;
+            height = terrain.height;
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_R8UI, width, height, 0,
+                         GL_RED_INTEGER, GL_UNSIGNED_BYTE, terrain.cells.data());
+            cells = terrain.cells;
+        } else {
+            int first = height;
+            int last = -1;
+            for (int r = 0; r < height; r++) {
+                if (!std::equal(terrain.cells.begin() + r * width,
+                                terrain.cells.begin() + (r + 1) * width,
+                                cells.begin() + r * width)) {
+                    if (first == height) {
+                        first = r;
+                    }
+                    last = r;
+                }
+            }
+            if (last >= first) {
+                glTexSubImage2D(GL_TEXTURE_2D, 0, 0, first, width,
+                                last - first + 1, GL_RED_INTEGER,
+                                GL_UNSIGNED_BYTE, &terrain.cells[first * width]);
+                std::copy(terrain.cells.begin() + first * width,
+                          terrain.cells.begin() + (last + 1) * width,
+                          cells.begin() + first * width);
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glActiveTexture(GL_TEXTURE0);
+
+        if (resized || moved) {
+            buildChunks(resized);
+        }
+
+        GLenum err = glGetError();
+        if (err != GL_NO_ERROR) {
+            std::cerr << "GpuTerrain::update(): Error writing map texture: "
+                      << err << std::endl;
+        }
+    }
+
+    /// @brief Decide which chunks are visible from any of the eyes.
+    ///
+    ///   This must be called once per frame, before Render(), with the
+    /// per-eye information for that frame.  The result is used by every
+    /// draw() until the next call.  If there are more eyes than the culling
+    /// handles, nothing is culled.
+    ///
+    ///   Render() reads the head pose again, so the frame may be drawn
+    /// looking a little away from where it was culled.  The frustums are
+    /// widened on every side by margin so that chunks at their edges are
+    /// not culled and then found to be in view.
+    /// @param [in] margin Radians the head may turn before Render().
+    void cull(const std::vector<osvr::renderkit::RenderInfo>& eyes,
+              double margin = 0) {
+        culled = false;
+        if (!initialized || chunks.empty() || eyes.empty() ||
+            eyes.size() > MAX_VIEWS) {
+            return;
+        }
+        GLfloat viewProjection[MAX_VIEWS][16];
+        for (size_t e = 0; e < eyes.size(); e++) {
+            GLdouble projectionGL[16];
+            osvr::renderkit::OSVR_Projection_to_OpenGL(projectionGL,
+                                                       eyes[e].projection);
+            widenFrustum(projectionGL, margin);
+            GLdouble viewGL[16];
+            osvr::renderkit::OSVR_PoseState_to_OpenGL(viewGL, eyes[e].pose);
+            for (int col = 0; col < 4; col++) {
+                for (int row = 0; row < 4; row++) {
+                    GLdouble sum = 0;
+                    for (int k = 0; k < 4; k++) {
+                        sum += projectionGL[k * 4 + row] * viewGL[col * 4 + k];
+                    }
+                    viewProjection[e][col * 4 + row] = static_cast<GLfloat>(sum);
+                }
+            }
+        }
+
+        if (gpuCull) {
+            glUseProgram(cullProgramId);
+            glUniformMatrix4fv(viewProjectionUniformId,
+                               static_cast<GLsizei>(eyes.size()), GL_FALSE,
+                               &viewProjection[0][0]);
+            glUniform1i(numViewsUniformId, static_cast<GLint>(eyes.size()));
+            glUniform1ui(numChunksUniformId, static_cast<GLuint>(chunks.size()));
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, chunkBuffer);
+            glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, commandBuffer);
+            glDispatchCompute(
+                static_cast<GLuint>((chunks.size() + CULL_GROUP_SIZE - 1) /
+                                    CULL_GROUP_SIZE), 1, 1);
+            glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+            glUseProgram(0);
+        } else {
+            visibleChunks.clear();
+            for (size_t i = 0; i < chunks.size(); i++) {
+                for (size_t e = 0; e < eyes.size(); e++) {
+                    if (chunkInFrustum(viewProjection[e], chunks[i])) {
+                        visibleChunks.push_back(i);
+                        break;
+                    }
+                }
+            }
+        }
+        culled = true;
+    }
+
+    /// @brief Render the map in the specified space.
+    ///
+    ///   When occlusion culling is on, the chunks near the viewer are drawn
+    /// first and fill the depth buffer.  The bounding box of every other
+    /// chunk is then tested against it with an occlusion query, and the
+    /// chunk itself is drawn under conditional rendering on the query that
+    /// was issued for it in the previous frame.  The conditional rendering
+    /// does not wait for results that are not ready yet, so the CPU never
+    /// stalls on the GPU; the cost is that a chunk that comes out from
+    /// behind a wall appears one frame late.
+    /// @param [in] projection The OpenGL projection matrix to pass to the shader.
+    /// @param [in] modelView The OpenGL model/view matrix to pass to the shader.
+    /// @param [in] eye Which eye is being drawn, used to keep the occlusion
+    ///             queries for each eye apart.
+    void draw(const GLdouble projection[], const GLdouble modelView[],
+              size_t eye = 0) {
+        if (!initialized || width == 0 || height == 0) {
+            return;
+        }
+        GLfloat projectionf[16];
+        GLfloat modelViewf[16];
+        for (int i = 0; i < 16; i++) {
+            projectionf[i] = static_cast<GLfloat>(projection[i]);
+            modelViewf[i] = static_cast<GLfloat>(modelView[i]);
+        }
+
+        glUseProgram(programId);
+        glUniformMatrix4fv(projectionUniformId, 1, GL_FALSE, projectionf);
+        glUniformMatrix4fv(modelViewUniformId, 1, GL_FALSE, modelViewf);
+        glUniform2i(playerCellUniformId, playerCol, playerRow);
+
+        // Same blending as render_text() so the two paths look the same.
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_COLOR, GL_ONE_MINUS_SRC_ALPHA);
+
+        glBindVertexArray(vertexArrayId);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        if (gpuCull && culled) {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandBuffer);
+        }
+        if (occlusion && eye < MAX_VIEWS) {
+            drawWithOcclusion(projectionf, modelViewf, modelView, eye);
+        } else if (gpuCull && culled) {
+            glMultiDrawArraysIndirect(GL_TRIANGLES, 0,
+                                      static_cast<GLsizei>(chunks.size()), 0);
+            g_drawCalls++;
+        } else {
+            size_t count = culled ? visibleChunks.size() : chunks.size();
+            for (size_t i = 0; i < count; i++) {
+                drawChunk(culled ? visibleChunks[i] : i);
+            }
+        }
+        if (gpuCull && culled) {
+            glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+        }
+        // The indirect draws rely on the base instance rather than on the
+        // attribute offset that drawChunk() moves around.
+        glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, 0, (GLvoid*)0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        glBindVertexArray(0);
+
+        // The actors are placed from the corner of the map, so move the
+        // player's cell to the origin as the terrain shader does.
+        GLdouble shifted[16];
+        std::copy(modelView, modelView + 16, shifted);
+        GLdouble tx = -MAP_CELL_SPACING * playerRow;
+        GLdouble tz = MAP_CELL_SPACING * playerCol;
+        for (int i = 0; i < 4; i++) {
+            shifted[12 + i] += modelView[i] * tx + modelView[8 + i] * tz;
+        }
+        actors.draw(projection, shifted);
+
+        glDisable(GL_BLEND);
+    }
+
+    /// @brief Turn on occlusion culling of the chunks.  Must be called after
+    /// init().
+    /// @return True if occlusion culling is now on.
+    bool enableOcclusion() {
+        if (!initialized) {
+            return false;
+        }
+        if (!occlusion) {
+            occlusion = buildBoxProgram();
+            // The conservative query is cheaper for the GPU but is only
+            // available from 4.3 on; the exact one works just as well.
+            queryTarget = GLEW_VERSION_4_3 ? GL_ANY_SAMPLES_PASSED_CONSERVATIVE
+                                           : GL_ANY_SAMPLES_PASSED;
+            resetQueries();
+        }
+        return occlusion;
+    }
+
+    /// @brief Number of chunk occlusion tests whose results have been read
+    /// back, and how many of those found the chunk completely hidden.
+    void occlusionStats(size_t& tests, size_t& hidden) const {
+        tests = occlusionTests;
+        hidden = occlusionHidden;
+    }
+
+  private:
+    GpuTerrain(const GpuTerrain&) = delete;
+    GpuTerrain& operator=(const GpuTerrain&) = delete;
+
+    static const int VERTICES_PER_CELL = 30;
+    static const int CHUNK_SIZE = 16;       ///< Cells on a side of a chunk
+    static const size_t MAX_VIEWS = 2;      ///< Eyes handled by cull()
+    static const size_t CULL_GROUP_SIZE = 64;
+
+    /// @brief Bounding box and instance range of one chunk, laid out to
+    /// match the std430 Chunk struct in the culling shader.
+    struct Chunk {
+        GLfloat boxMin[4];
+        GLfloat boxMax[4];
+        GLuint firstInstance;
+        GLuint instanceCount;
+        GLuint pad[2];
+    };
+
+    bool initialized = false;
+    bool gpuCull = false;
+    bool culled = false;
+    GLuint programId = 0;
+    GLuint cullProgramId = 0;
+    GLuint vertexArrayId = 0;
+    GLuint instanceBuffer = 0;
+    GLuint chunkBuffer = 0;
+    GLuint commandBuffer = 0;
+    GLuint mapTex = 0;
+    GLint projectionUniformId = -1;
+    GLint modelViewUniformId = -1;
+    GLint playerCellUniformId = -1;
+    GLint viewProjectionUniformId = -1;
+    GLint numViewsUniformId = -1;
+    GLint numChunksUniformId = -1;
+    int width = 0;
+    int height = 0;
+    int playerRow = 0;
+    int playerCol = 0;
+    std::vector<char> cells;   ///< What is currently in mapTex
+    MapGrid terrain;           ///< Last map given to update(), minus actors
+    MapActors uploadedActors;  ///< What is currently in actors
+    ActorBatch actors;
+    std::vector<Chunk> chunks;
+    std::vector<size_t> visibleChunks;  ///< Result of CPU culling
+
+    // Occlusion culling state.  The queries are double-buffered per eye so
+    // that one frame's draws can use the previous frame's results.
+    bool occlusion = false;
+    GLenum queryTarget = GL_ANY_SAMPLES_PASSED;
+    GLuint boxProgramId = 0;
+    GLint boxProjectionUniformId = -1;
+    GLint boxModelViewUniformId = -1;
+    GLint boxMinUniformId = -1;
+    GLint boxMaxUniformId = -1;
+    std::vector<GLuint> queries[2][MAX_VIEWS];
+    std::vector<char> queryIssued[2][MAX_VIEWS];
+    unsigned queryFrame[MAX_VIEWS] = {};
+    std::vector<size_t> nearChunks;
+    std::vector<size_t> farChunks;
+    std::vector<char> tested;  ///< Scratch for the next queryIssued entry
+    size_t occlusionTests = 0;
+    size_t occlusionHidden = 0;
+
+    /// @brief Split the map into chunks and compute their bounding boxes.
+    ///
+    ///   The boxes are in the same space the vertex shader places cells in,
+    /// which is centered on the player, so they are recomputed whenever the
+    /// player moves.  The instance buffer only changes with the map size.
+    /// @param [in] resized The map changed size, so re-order the instances.
+    void buildChunks(bool resized) {
+        // Glyphs can hang off of the cell that they belong to, so pad the
+        // boxes by the largest glyph and by the wall offset.
+        const float pad = 2 * FONT_SIZE * MAP_GLYPH_SCALE + MAP_WALL_HALF_WIDTH;
+
+        std::vector<GLuint> instances;
+        if (resized) {
+            instances.reserve(static_cast<size_t>(width) * height);
+        }
+        chunks.clear();
+        for (int r0 = 0; r0 < height; r0 += CHUNK_SIZE) {
+            int r1 = std::min(r0 + CHUNK_SIZE, height);
+            for (int c0 = 0; c0 < width; c0 += CHUNK_SIZE) {
+                int c1 = std::min(c0 + CHUNK_SIZE, width);
+                Chunk chunk;
+                chunk.boxMin[0] = MAP_CELL_SPACING * (r0 - playerRow) - pad;
+                chunk.boxMax[0] = MAP_CELL_SPACING * (r1 - 1 - playerRow) + pad;
+                chunk.boxMin[1] = MAP_GLYPH_Y - pad;
+                chunk.boxMax[1] = MAP_GLYPH_Y + pad;
+                chunk.boxMin[2] = MAP_CELL_SPACING * (playerCol - (c1 - 1)) - pad;
+                chunk.boxMax[2] = MAP_CELL_SPACING * (playerCol - c0) + pad;
+                chunk.boxMin[3] = chunk.boxMax[3] = 1;
+                chunk.firstInstance = static_cast<GLuint>(
+                    (r0 * width) + c0 * (r1 - r0));
+                chunk.instanceCount = static_cast<GLuint>((r1 - r0) * (c1 - c0));
+                chunk.pad[0] = chunk.pad[1] = 0;
+                chunks.push_back(chunk);
+
+                if (resized) {
+                    for (int r = r0; r < r1; r++) {
+                        for (int c = c0; c < c1; c++) {
+                            instances.push_back(static_cast<GLuint>(r * width + c));
+                        }
+                    }
+                }
+            }
+        }
+
+        if (resized) {
+            glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(GLuint) * instances.size(),
+                         instances.data(), GL_STATIC_DRAW);
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+        if (gpuCull) {
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, chunkBuffer);
+            glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(Chunk) * chunks.size(),
+                         chunks.data(), GL_DYNAMIC_DRAW);
+            if (resized) {
+                glBindBuffer(GL_SHADER_STORAGE_BUFFER, commandBuffer);
+                glBufferData(GL_SHADER_STORAGE_BUFFER,
+                             4 * sizeof(GLuint) * chunks.size(), NULL,
+                             GL_DYNAMIC_DRAW);
+            }
+            glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+        }
+        if (occlusion && resized) {
+            resetQueries();
+        }
+        culled = false;
+    }
+
+    /// @brief CPU version of the test done by terrainCullShader.
+    /// @brief Widen the left, right, bottom and top planes of an OpenGL
+    /// projection by an angle.
+    ///
+    ///   Scaling the x (or y) row of the projection by s keeps the center of
+    /// the frustum in that axis and divides its half-width, as a tangent, by
+    /// s; s is chosen so that both edges move out by at least angle.  An
+    /// edge that would pass 90 degrees leaves that axis unculled.
+    static void widenFrustum(GLdouble p[16], double angle) {
+        if (!(angle > 0)) {
+            return;
+        }
+        const double limit = 1.5;  // Just under 90 degrees
+        for (int axis = 0; axis < 2; axis++) {
+            GLdouble scale = p[axis * 5];
+            if (!(scale > 0)) {
+                continue;
+            }
+            double center = p[8 + axis] / scale;
+            double half = 1 / scale;
+            double high = std::atan(center + half) + angle;
+            double low = std::atan(center - half) - angle;
+            double s = 0;
+            if (high < limit && low > -limit) {
+                double needed = std::max(std::tan(high) - center,
+                                         center - std::tan(low));
+                s = half / needed;
+            }
+            for (int col = 0; col < 4; col++) {
+                p[col * 4 + axis] *= s;
+            }
+        }
+    }
+
+    static bool chunkInFrustum(const GLfloat m[16], const Chunk& chunk) {
+        GLfloat c[8][4];
+        for (int i = 0; i < 8; i++) {
+            GLfloat p[3] = { (i & 1) ? chunk.boxMax[0] : chunk.boxMin[0],
+                             (i & 2) ? chunk.boxMax[1] : chunk.boxMin[1],
+                             (i & 4) ? chunk.boxMax[2] : chunk.boxMin[2] };
+            for (int row = 0; row < 4; row++) {
+                c[i][row] = m[row] * p[0] + m[4 + row] * p[1] +
+                            m[8 + row] * p[2] + m[12 + row];
+            }
+        }
+        for (int axis = 0; axis < 3; axis++) {
+            bool allBelow = true;
+            bool allAbove = true;
+            for (int i = 0; i < 8; i++) {
+                allBelow = allBelow && (c[i][axis] < -c[i][3]);
+                allAbove = allAbove && (c[i][axis] > c[i][3]);
+            }
+            if (allBelow || allAbove) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /// @brief Draw one chunk, using the indirect command written by the
+    /// culling shader when there is one.
+    void drawChunk(size_t i) {
+        if (gpuCull && culled) {
+            glDrawArraysIndirect(GL_TRIANGLES,
+                                 (GLvoid*)(4 * sizeof(GLuint) * i));
+        } else {
+            // Point the instance attribute at the start of the chunk, which
+            // works without base-instance support.
+            glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, 0,
+                (GLvoid*)(sizeof(GLuint) * chunks[i].firstInstance));
+            glDrawArraysInstanced(GL_TRIANGLES, 0, VERTICES_PER_CELL,
+                                  chunks[i].instanceCount);
+        }
+        g_drawCalls++;
+    }
+
+    /// @brief Body of draw() when occlusion culling is on.
+    void drawWithOcclusion(const GLfloat projectionf[],
+                           const GLfloat modelViewf[],
+                           const GLdouble modelView[], size_t eye) {
+        // Find the viewer in the space that the chunk boxes are in, assuming
+        // the model/view matrix is a rigid transform.
+        GLdouble viewer[3];
+        for (int i = 0; i < 3; i++) {
+            viewer[i] = -(modelView[i * 4 + 0] * modelView[12] +
+                          modelView[i * 4 + 1] * modelView[13] +
+                          modelView[i * 4 + 2] * modelView[14]);
+        }
+
+        // Only the chunks in this eye's view are drawn or tested.  The
+        // compute shader's culling results stay on the GPU, so the chunks
+        // are checked against the frustum here as well; otherwise every
+        // chunk in the level would get a query.
+        GLfloat viewProjection[16];
+        for (int col = 0; col < 4; col++) {
+            for (int row = 0; row < 4; row++) {
+                GLfloat sum = 0;
+                for (int k = 0; k < 4; k++) {
+                    sum += projectionf[k * 4 + row] * modelViewf[col * 4 + k];
+                }
+                viewProjection[col * 4 + row] = sum;
+            }
+        }
+
+        // Split the chunks that might be visible into the ones close enough
+        // to be drawn as occluders (within a chunk's width of the viewer) and
+        // the ones to be tested.
+        const GLdouble occluderDistance = CHUNK_SIZE * MAP_CELL_SPACING;
+        nearChunks.clear();
+        farChunks.clear();
+        size_t count = (culled && !gpuCull) ? visibleChunks.size() : chunks.size();
+        for (size_t n = 0; n < count; n++) {
+            size_t i = (culled && !gpuCull) ? visibleChunks[n] : n;
+            if (!chunkInFrustum(viewProjection, chunks[i])) {
+                continue;
+            }
+            GLdouble distance2 = 0;
+            for (int a = 0; a < 3; a++) {
+                GLdouble d = 0;
+                if (viewer[a] < chunks[i].boxMin[a]) {
+                    d = chunks[i].boxMin[a] - viewer[a];
+                } else if (viewer[a] > chunks[i].boxMax[a]) {
+                    d = viewer[a] - chunks[i].boxMax[a];
+                }
+                distance2 += d * d;
+            }
+            if (distance2 < occluderDistance * occluderDistance) {
+                nearChunks.push_back(i);
+            } else {
+                farChunks.push_back(i);
+            }
+        }
+
+        int current = queryFrame[eye] & 1;
+        int previous = current ^ 1;
+        std::vector<GLuint>& issue = queries[current][eye];
+        std::vector<char>& issued = queryIssued[current][eye];
+        const std::vector<GLuint>& last = queries[previous][eye];
+        const std::vector<char>& lastIssued = queryIssued[previous][eye];
+
+        for (size_t i : nearChunks) {
+            drawChunk(i);
+        }
+
+        // Test the boxes of the far chunks against the depth of the near ones
+        // without touching the color or depth buffers.  Only the chunks
+        // tested this frame keep a query, so a result from a frame long ago
+        // never decides whether a chunk is drawn.
+        tested.assign(chunks.size(), 0);
+        glUseProgram(boxProgramId);
+        glUniformMatrix4fv(boxProjectionUniformId, 1, GL_FALSE, projectionf);
+        glUniformMatrix4fv(boxModelViewUniformId, 1, GL_FALSE, modelViewf);
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+        for (size_t i : farChunks) {
+            // Collect the result from two frames ago if it is ready, without
+            // waiting for it, before the query is re-used.
+            if (issued[i]) {
+                GLuint available = 0;
+                glGetQueryObjectuiv(issue[i], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (available) {
+                    GLuint passed = 0;
+                    glGetQueryObjectuiv(issue[i], GL_QUERY_RESULT, &passed);
+                    occlusionTests++;
+                    if (!passed) {
+                        occlusionHidden++;
+                    }
+                }
+            }
+            glUniform3fv(boxMinUniformId, 1, chunks[i].boxMin);
+            glUniform3fv(boxMaxUniformId, 1, chunks[i].boxMax);
+            glBeginQuery(queryTarget, issue[i]);
+            glDrawArrays(GL_TRIANGLES, 0, 36);
+            glEndQuery(queryTarget);
+            g_drawCalls++;
+            tested[i] = 1;
+        }
+        issued.swap(tested);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthMask(GL_TRUE);
+        glUseProgram(programId);
+
+        // Draw the far chunks, skipping the ones that last frame's queries
+        // found to be hidden.  Chunks that were not tested are always drawn.
+        for (size_t i : farChunks) {
+            if (lastIssued[i]) {
+                glBeginConditionalRender(last[i], GL_QUERY_NO_WAIT);
+                drawChunk(i);
+                glEndConditionalRender();
+            } else {
+                drawChunk(i);
+            }
+        }
+        queryFrame[eye]++;
+    }
+
+    /// @brief Make one set of queries per chunk for each eye and each of the
+    /// two frames in flight, forgetting any earlier results.
+    void resetQueries() {
+        for (int f = 0; f < 2; f++) {
+            for (size_t e = 0; e < MAX_VIEWS; e++) {
+                if (!queries[f][e].empty()) {
+                    glDeleteQueries(static_cast<GLsizei>(queries[f][e].size()),
+                                    queries[f][e].data());
+                }
+                queries[f][e].assign(chunks.size(), 0);
+                if (!chunks.empty()) {
+                    glGenQueries(static_cast<GLsizei>(chunks.size()),
+                                 queries[f][e].data());
+                }
+                queryIssued[f][e].assign(chunks.size(), 0);
+            }
+        }
+        for (size_t e = 0; e < MAX_VIEWS; e++) {
+            queryFrame[e] = 0;
+        }
+    }
+
+    bool buildBoxProgram() {
+        GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
+        GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(vertexShaderId, 1, &boxVertexShader, NULL);
+        glCompileShader(vertexShaderId);
+        glShaderSource(fragmentShaderId, 1, &boxFragmentShader, NULL);
+        glCompileShader(fragmentShaderId);
+        boxProgramId = glCreateProgram();
+        glAttachShader(boxProgramId, vertexShaderId);
+        glAttachShader(boxProgramId, fragmentShaderId);
+        glLinkProgram(boxProgramId);
+        glDeleteShader(vertexShaderId);
+        glDeleteShader(fragmentShaderId);
+
+        GLint result = GL_FALSE;
+        glGetProgramiv(boxProgramId, GL_LINK_STATUS, &result);
+        if (result == GL_FALSE) {
+            int infoLength = 0;
+            glGetProgramiv(boxProgramId, GL_INFO_LOG_LENGTH, &infoLength);
+            std::vector<GLchar> errorMessage(infoLength + 1);
+            glGetProgramInfoLog(boxProgramId, infoLength, NULL, &errorMessage[0]);
+            std::cerr << "GpuTerrain: Box program link failed: "
+                      << &errorMessage[0] << std::endl;
+            glDeleteProgram(boxProgramId);
+            boxProgramId = 0;
+            return false;
+        }
+        boxProjectionUniformId = glGetUniformLocation(boxProgramId, "projection");
+        boxModelViewUniformId = glGetUniformLocation(boxProgramId, "modelView");
+        boxMinUniformId = glGetUniformLocation(boxProgramId, "boxMin");
+        boxMaxUniformId = glGetUniformLocation(boxProgramId, "boxMax");
+        return true;
+    }
+
+    bool buildCullProgram() {
+        GLuint shaderId = glCreateShader(GL_COMPUTE_SHADER);
+        glShaderSource(shaderId, 1, &terrainCullShader, NULL);
+        glCompileShader(shaderId);
+        cullProgramId = glCreateProgram();
+        glAttachShader(cullProgramId, shaderId);
+        glLinkProgram(cullProgramId);
+        glDeleteShader(shaderId);
+
+        GLint result = GL_FALSE;
+        glGetProgramiv(cullProgramId, GL_LINK_STATUS, &result);
+        if (result == GL_FALSE) {
+            int infoLength = 0;
+            glGetProgramiv(cullProgramId, GL_INFO_LOG_LENGTH, &infoLength);
+            std::vector<GLchar> errorMessage(infoLength + 1);
+            glGetProgramInfoLog(cullProgramId, infoLength, NULL, &errorMessage[0]);
+            std::cerr << "GpuTerrain: Cull program link failed: "
+                      << &errorMessage[0] << std::endl;
+            glDeleteProgram(cullProgramId);
+            cullProgramId = 0;
+            return false;
+        }
+        viewProjectionUniformId =
+            glGetUniformLocation(cullProgramId, "viewProjection");
+        numViewsUniformId = glGetUniformLocation(cullProgramId, "numViews");
+        numChunksUniformId = glGetUniformLocation(cullProgramId, "numChunks");
+        glUseProgram(cullProgramId);
+        glUniform1ui(glGetUniformLocation(cullProgramId, "verticesPerCell"),
+                     VERTICES_PER_CELL);
+        glUseProgram(0);
+
+        glGenBuffers(1, &chunkBuffer);
+        glGenBuffers(1, &commandBuffer);
+        return true;
+    }
+
+    bool buildProgram() {
+        GLuint vertexShaderId = glCreateShader(GL_VERTEX_SHADER);
+        GLuint fragmentShaderId = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(vertexShaderId, 1, &terrainVertexShader, NULL);
+        glCompileShader(vertexShaderId);
+        glShaderSource(fragmentShaderId, 1, &terrainFragmentShader, NULL);
+        glCompileShader(fragmentShaderId);
+        programId = glCreateProgram();
+        glAttachShader(programId, vertexShaderId);
+        glAttachShader(programId, fragmentShaderId);
+        glLinkProgram(programId);
+        glDeleteShader(vertexShaderId);
+        glDeleteShader(fragmentShaderId);
+
+        GLint result = GL_FALSE;
+        glGetProgramiv(programId, GL_LINK_STATUS, &result);
+        if (result == GL_FALSE) {
+            int infoLength = 0;
+            glGetProgramiv(programId, GL_INFO_LOG_LENGTH, &infoLength);
+            std::vector<GLchar> errorMessage(infoLength + 1);
+            glGetProgramInfoLog(programId, infoLength, NULL, &errorMessage[0]);
+            std::cerr << "GpuTerrain: Shader program link failed: "
+                      << &errorMessage[0] << std::endl;
+            return false;
+        }
+
+        projectionUniformId = glGetUniformLocation(programId, "projection");
+        modelViewUniformId = glGetUniformLocation(programId, "modelView");
+        playerCellUniformId = glGetUniformLocation(programId, "playerCell");
+        glUseProgram(programId);
+        glUniform1i(glGetUniformLocation(programId, "atlas"), 0);
+        glUniform1i(glGetUniformLocation(programId, "map"), 1);
+        GLuint kinds[64] = {};
+        for (int c = 0; c < 256; c++) {
+            kinds[c / 4] |= static_cast<GLuint>(tileKindFor(static_cast<char>(c)))
+                            << (8 * (c % 4));
+        }
+        glUniform4uiv(glGetUniformLocation(programId, "tileKinds"), 16, kinds);
+        glUniform1f(glGetUniformLocation(programId, "spacing"), MAP_CELL_SPACING);
+        glUniform1f(glGetUniformLocation(programId, "glyphY"), MAP_GLYPH_Y);
+        glUniform1f(glGetUniformLocation(programId, "glyphScale"), MAP_GLYPH_SCALE);
+        glUniform1f(glGetUniformLocation(programId, "wallHalfWidth"),
+                    MAP_WALL_HALF_WIDTH);
+        glUseProgram(0);
+        return true;
+    }
+
+    /// @brief Build the shared glyph atlas and hand its metrics to the shader.
+    bool buildAtlas() {
+        if (!g_scheduler || !glyphAtlas.build(*g_scheduler)) {
+            return false;
+        }
+        glUseProgram(programId);
+        glUniform4fv(glGetUniformLocation(programId, "glyphMetrics"),
+                     GlyphAtlas::NUM_GLYPHS, glyphAtlas.glyphMetrics());
+        glUniform2f(glGetUniformLocation(programId, "atlasCellSize"),
+                    glyphAtlas.cellWidth(), glyphAtlas.cellHeight());
+        glUniform2f(glGetUniformLocation(programId, "atlasTexelSize"),
+                    glyphAtlas.texelWidth(), glyphAtlas.texelHeight());
+        GLint layers[4];
+        for (int kind = 0; kind < 4; kind++) {
+            layers[kind] = Tileset::layerFor(static_cast<TileKind>(kind));
+        }
+        glUniform1iv(glGetUniformLocation(programId, "tileLayers"), 4, layers);
+        glUseProgram(0);
+        return true;
+    }
+};
+static GpuTerrain gpuTerrain;
+
+// Set from the command line to record every map and input sample to a file,
+// or to play a recording back instead of reading the map file and devices.
+static MapRecorder g_recorder;
+static MapReplayer g_replayer;
+static bool g_replaying = false;
+static bool g_replayFast = false;  ///< Play back as fast as possible
+
+// The head orientation is predicted to when each frame will be shown, from
+// the tracker's angular velocity, unless turned off from the command line.
+// Replays also score the predictions against the samples that follow.
+static bool g_predictHead = true;
+static PosePredictor g_posePredictor;
+static PredictionErrorLog g_predictionErrors;
+static OSVR_TimeValue g_inputTime;  ///< When this frame's inputs were read
+
+// Head turning speed, in radians per second, assumed when the tracker does
+// not report one: a fast turn.
+static const double MAX_HEAD_SPEED = 4.0;
+
+// Set from the command line, for windowed displays that are watched rather
+// than worn, to draw only frames that would look different from the last
+// one and otherwise wait for the map file to change.  Head-mounted displays
+// need every frame, so this is off by default.
+static bool g_redrawOnChange = false;
+static RedrawPolicy g_redraw;
+static MapFileWatch g_mapWatch;
+
+// Set from the command line to create and fill OpenGL objects on a
+// background thread rather than in the render loop.
+static bool g_useUploadThread = false;
+
+/// @brief Background thread that creates and fills OpenGL buffers and
+/// textures using its own context, shared with the RenderManager one.
+///
+///   Each job runs on the upload thread with its context current, and is
+/// followed by a fence.  Once the GPU has passed the fence, poll() runs the
+/// job's ready callback on the render thread, which is where the names of
+/// the new objects are handed over.  Buffers and textures are shared between
+/// the contexts but vertex arrays are not, so jobs must not create those.
+class UploadThread {
+  public:
+    typedef std::function<void()> Job;
+
+    UploadThread() {}
+
+    ~UploadThread() { stop(); }
+
+    /// @brief Create the shared context and start the thread.  Must be
+    /// called on the render thread with the RenderManager context current.
+    /// @return True on success, false if the context could not be created.
+    bool start() {
+        if (thread.joinable()) {
+            return true;
+        }
+        window = SDL_GL_GetCurrentWindow();
+        SDL_GLContext renderContext = SDL_GL_GetCurrentContext();
+        if (!window || !renderContext) {
+            std::cerr << "UploadThread::start(): No current SDL OpenGL context"
+                      << std::endl;
+            return false;
+        }
+        SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+        context = SDL_GL_CreateContext(window);
+        SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+        // Creating the context made it current; give the render thread its
+        // own back.
+        SDL_GL_MakeCurrent(window, renderContext);
+        if (!context) {
+            std::cerr << "UploadThread::start(): Could not create shared context: "
+                      << SDL_GetError() << std::endl;
+            return false;
+        }
+        stopping = false;
+        thread = std::thread(&UploadThread::loop, this);
+        return true;
+    }
+
+    bool running() const { return thread.joinable(); }
+
+    /// @brief Queue a job.
+    /// @param [in] work Run on the upload thread to create and fill objects.
+    /// @param [in] ready Run on the render thread, from poll(), once the
+    ///             objects can be used there.
+    void submit(Job work, Job ready) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(Pending{ std::move(work), std::move(ready) });
+        }
+        wake.notify_one();
+    }
+
+    /// @brief Run the ready callbacks of the jobs that the GPU has finished.
+    /// Must be called on the render thread.  Never blocks.
+    void poll() {
+        std::vector<Job> readyJobs;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            while (!finished.empty()) {
+                GLenum status = glClientWaitSync(finished.front().fence, 0, 0);
+                if (status != GL_ALREADY_SIGNALED &&
+                    status != GL_CONDITION_SATISFIED) {
+                    break;
+                }
+                glDeleteSync(finished.front().fence);
+                readyJobs.push_back(std::move(finished.front().ready));
+                finished.pop_front();
+            }
+        }
+        for (Job& ready : readyJobs) {
+            ready();
+        }
+    }
+
+    /// @brief Wait until every queued job has run on the upload thread, so
+    /// that the CPU data they read may be changed.  Any thread may call this.
+    void waitIdle() {
+        std::unique_lock<std::mutex> lock(mutex);
+        idle.wait(lock, [this]() { return queue.empty() && !busy; });
+    }
+
+    /// @brief Wait for every queued job to run and for the GPU to finish
+    /// it, then run all of the ready callbacks.  Must be called on the
+    /// render thread.  Blocks, so only use it where a stall is expected.
+    void finish() {
+        waitIdle();
+        runFinished();
+    }
+
+    /// @brief Finish the queued jobs and run their ready callbacks, then
+    /// stop the thread and destroy its context.  Must be called on the
+    /// render thread before the RenderManager is destroyed.
+    void stop() {
+        if (!thread.joinable()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_one();
+        // The thread runs every queued job before it exits.
+        thread.join();
+        runFinished();
+        SDL_GL_DeleteContext(context);
+        context = nullptr;
+    }
+
+  private:
+    UploadThread(const UploadThread&) = delete;
+    UploadThread& operator=(const UploadThread&) = delete;
+
+    struct Pending {
+        Job work;
+        Job ready;
+    };
+
+    struct Finished {
+        GLsync fence;
+        Job ready;
+    };
+
+    SDL_Window* window = nullptr;
+    SDL_GLContext context = nullptr;
+    std::thread thread;
+    std::mutex mutex;              ///< Guards the fields below
+    std::condition_variable wake;  ///< Signalled when work is queued
+    std::condition_variable idle;  ///< Signalled when a job has run
+    std::deque<Pending> queue;
+    std::deque<Finished> finished;
+    bool busy = false;
+    bool stopping = false;
+
+    /// @brief Wait for the GPU to finish every job that has run, then run
+    /// their ready callbacks.  Must be called on the render thread.
+    void runFinished() {
+        std::vector<Job> readyJobs;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (Finished& f : finished) {
+                glClientWaitSync(f.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                 GL_TIMEOUT_IGNORED);
+                glDeleteSync(f.fence);
+                readyJobs.push_back(std::move(f.ready));
+            }
+            finished.clear();
+        }
+        for (Job& ready : readyJobs) {
+            ready();
+        }
+    }
+
+    void loop() {
+        tuneWorkerThread(g_threadTuning, "upload");
+        SDL_GL_MakeCurrent(window, context);
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                break;
+            }
+            Pending job = std::move(queue.front());
+            queue.pop_front();
+            busy = true;
+            lock.unlock();
+
+            job.work();
+            GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            // Make sure the commands and the fence reach the GPU, since
+            // nothing else will flush this context.
+            glFlush();
+
+            lock.lock();
+            finished.push_back(Finished{ fence, std::move(job.ready) });
+            busy = false;
+            idle.notify_all();
+        }
+        SDL_GL_MakeCurrent(window, nullptr);
+    }
+};
+static UploadThread g_uploader;
+
+/// @brief Map geometry built on the CPU as one mesh per chunk of cells.
+///
+///   Only the chunks whose cells changed are rebuilt, each by its own task
+/// on the scheduler, writing into that chunk's vertex array, which keeps its
+/// storage from one rebuild to the next.  The quads match the GPU terrain
+/// path: same glyph atlas, same placement, and wall faces that touch another
+/// wall are left out.  Cells are placed relative to the corner of the map
+/// rather than the player, so the player moving does not dirty any chunks;
+/// draw() applies the player offset instead.
+///
+///   Only the static terrain is meshed.  The player, monsters and items are
+/// split off into an actor list that is drawn as one instanced batch, so a
+/// monster moving never dirties a chunk.
+///
+///   When most of the terrain is replaced at once, as when the player takes
+/// the stairs, the meshes and buffers of the level being left are kept in a
+/// cache, so that going back to it, or to any level seen before, swaps them
+/// back in rather than building the level again.
+class MeshTerrain {
+  public:
+    MeshTerrain() {}
+
+    ~MeshTerrain() {
+        if (initialized) {
+            glDeleteVertexArrays(1, &vertexArrayId);
+            deleteBuffers();
+            cache.clear();
+        }
+    }
+
+    /// @brief Set how many bytes of buffers to keep for levels other than
+    /// the current one.  Zero keeps none.
+    void setCacheBudget(size_t bytes) { cache.budget = bytes; }
+
+    /// @brief Also save the meshes of levels that are left into a directory,
+    /// and look there for levels that are not in memory.
+    void setCacheDirectory(const std::string& dir) { cache.directory = dir; }
+
+    /// @brief Report how often a level was found in the cache.
+    void printCacheStats() const { cache.printStats(); }
+
+    /// @brief Must be called after OpenGL and the font are initialized.
+    /// @return True on success, false if the glyph atlas could not be built.
+    bool init() {
+        if (initialized) {
+            return true;
+        }
+        if (!g_scheduler || !glyphAtlas.build(*g_scheduler) || !actors.init()) {
+            return false;
+        }
+        glGenVertexArrays(1, &vertexArrayId);
+
+        // The meshes depend on the glyph layout as well as on the map.
+        GLfloat cell[2] = { glyphAtlas.cellWidth(), glyphAtlas.cellHeight() };
+        atlasHash = LevelCache::hashBytes(
+            glyphAtlas.glyphMetrics(), 4 * GlyphAtlas::NUM_GLYPHS * sizeof(GLfloat),
+            LevelCache::hashBytes(cell, sizeof(cell), LevelCache::HASH_SEED));
+        initialized = true;
+        return true;
+    }
+
+    /// @brief Rebuild the meshes of the chunks that changed.
+    ///
+    /// Makes no OpenGL calls, so it can run on any thread while the render
+    /// thread is drawing; upload() then sends the new meshes to OpenGL.
+    void prepare(const MapGrid& map) {
+        if (!initialized) {
+            return;
+        }
+        // The upload thread may still be reading the last meshes.
+        if (g_uploader.running()) {
+            g_uploader.waitIdle();
+        }
+        pendingPlayerRow = map.playerRow;
+        pendingPlayerCol = map.playerCol;
+
+        MapActors mapActors;
+        splitMapLayers(map, terrain, mapActors);
+        if (mapActors != pendingActors) {
+            pendingActors = mapActors;
+            actorsChanged = true;
+        }
+
+        if (terrain.width == width && terrain.height == height &&
+            terrain.cells == cells) {
+            return;
+        }
+        bool resized = (terrain.width != width || terrain.height != height);
+        size_t changed = 0;
+        if (!resized) {
+            for (size_t i = 0; i < cells.size(); i++) {
+                changed += (terrain.cells[i] != cells[i]) ? 1 : 0;
+            }
+        }
+
+        // A new size or a mostly different map is a new level, such as the
+        // one down the stairs, rather than an edit of this one.
+        auto start = std::chrono::steady_clock::now();
+        bool newLevel = resized || 4 * changed > cells.size();
+        if (newLevel) {
+            if (!cells.empty()) {
+                uint64_t key = hashLevel(width, height, cells);
+                cache.storeMeshes(key, width, height, cells, chunks);
+                // If the last level never got as far as upload(), the
+                // buffers are still those of the level before it.
+                if (!levelChanged) {
+                    departedKey = key;
+                    levelChanged = true;
+                }
+            }
+            width = terrain.width;
+            height = terrain.height;
+            chunkCols = (width + CHUNK_SIZE - 1) / CHUNK_SIZE;
+            chunkRows = (height + CHUNK_SIZE - 1) / CHUNK_SIZE;
+            chunks.clear();
+            chunks.resize(chunkCols * chunkRows);
+            layoutChanged = true;
+
+            currentKey = hashLevel(width, height, terrain.cells);
+            restoredFrom = cache.takeMeshes(currentKey, width, height,
+                                            terrain.cells, chunks);
+            if (restoredFrom != LevelCache::NOT_FOUND) {
+                // upload() decides whether they need uploading.
+                for (Chunk& chunk : chunks) {
+                    chunk.dirty = false;
+                }
+            }
+        } else {
+            // A changed cell can show or hide a wall face of its neighbors,
+            // which may be in the next chunk over.
+            for (size_t i = 0; i < cells.size(); i++) {
+                if (terrain.cells[i] != cells[i]) {
+                    markDirty(static_cast<int>(i) / width,
+                              static_cast<int>(i) % width);
+                }
+            }
+        }
+        cells = terrain.cells;
+
+        TaskScheduler::TaskGroup group;
+        size_t meshed = 0;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            if (chunks[i].dirty) {
+                g_scheduler->spawn(group, [this, i]() { meshChunk(terrain, i); });
+                meshed++;
+            }
+        }
+        g_scheduler->wait(group);
+
+        if (newLevel) {
+            double ms = std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+            if (restoredFrom != LevelCache::NOT_FOUND) {
+                std::cerr << "MeshTerrain: Restored the level from the cache in "
+                          << ms << " ms" << std::endl;
+            } else {
+                std::cerr << "MeshTerrain: Meshed " << meshed << " chunks in "
+                          << ms << " ms on " << g_scheduler->threadCount()
+                          << " threads" << std::endl;
+            }
+        }
+    }
+
+    /// @brief Send the meshes built by prepare() to OpenGL.  Must be called
+    /// on the render thread, and not while prepare() is running.
+    ///
+    /// With the upload thread running, the new buffers are made there and
+    /// swapped in by a later call once they are ready.
+    void upload() {
+        if (!initialized) {
+            return;
+        }
+        playerRow = pendingPlayerRow;
+        playerCol = pendingPlayerCol;
+        if (actorsChanged) {
+            actors.upload(pendingActors);
+            actorsChanged = false;
+        }
+        if (g_uploader.running()) {
+            // The buffers of a level being left must be complete before
+            // they go into the cache.
+            if (levelChanged) {
+                g_uploader.finish();
+            } else {
+                g_uploader.poll();
+            }
+        }
+        if (layoutChanged) {
+            std::vector<DrawChunk> restored;
+            bool haveBuffers = restoredFrom == LevelCache::FROM_MEMORY &&
+                cache.takeBuffers(currentKey, chunks.size(), restored);
+            if (restoredFrom != LevelCache::NOT_FOUND && !haveBuffers) {
+                for (Chunk& chunk : chunks) {
+                    chunk.meshed = true;
+                }
+            }
+            restoredFrom = LevelCache::NOT_FOUND;
+            if (levelChanged) {
+                cache.storeBuffers(departedKey, buffers);
+                levelChanged = false;
+            }
+            deleteBuffers();
+            if (haveBuffers) {
+                buffers.swap(restored);
+            } else {
+                buffers.assign(chunks.size(), DrawChunk());
+            }
+            layout++;
+            layoutChanged = false;
+        }
+
+        std::vector<size_t> meshed;
+        for (size_t i = 0; i < chunks.size(); i++) {
+            if (chunks[i].meshed) {
+                meshed.push_back(i);
+                chunks[i].meshed = false;
+            }
+        }
+        if (meshed.empty()) {
+            return;
+        }
+
+        if (!g_uploader.running()) {
+            for (size_t i : meshed) {
+                if (!buffers[i].buffer) {
+                    glGenBuffers(1, &buffers[i].buffer);
+                }
+                buffers[i].count = fillBuffer(buffers[i].buffer, chunks[i]);
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+            return;
+        }
+
+        // Fill new buffers on the upload thread, then swap them in for the
+        // old ones, unless the map changed size in the meantime.
+        std::shared_ptr<std::vector<DrawChunk> > made(
+            new std::vector<DrawChunk>(meshed.size()));
+        unsigned submittedLayout = layout;
+        g_uploader.submit(
+            [this, meshed, made]() {
+                for (size_t n = 0; n < meshed.size(); n++) {
+                    glGenBuffers(1, &(*made)[n].buffer);
+                    (*made)[n].count = fillBuffer((*made)[n].buffer, chunks[meshed[n]]);
+                }
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+            },
+            [this, meshed, made, submittedLayout]() {
+                for (size_t n = 0; n < meshed.size(); n++) {
+                    if (submittedLayout != layout) {
+                        glDeleteBuffers(1, &(*made)[n].buffer);
+                        continue;
+                    }
+                    glDeleteBuffers(1, &buffers[meshed[n]].buffer);
+                    buffers[meshed[n]] = (*made)[n];
+                }
+            });
+    }
+
+    /// @brief Draw all of the chunks.
+    void draw(const GLdouble projection[], const GLdouble modelView[]) {
+        if (!initialized || buffers.empty()) {
+            return;
+        }
+
+        // Move the player's cell to the origin, as the other paths do.
+        GLdouble shifted[16];
+        std::copy(modelView, modelView + 16, shifted);
+        GLdouble tx = -MAP_CELL_SPACING * playerRow;
+        GLdouble tz = MAP_CELL_SPACING * playerCol;
+        for (int i = 0; i < 4; i++) {
+            shifted[12 + i] += modelView[i] * tx + modelView[8 + i] * tz;
+        }
+        sampleShader.useProgram(projection, shifted, Tileset::GLYPH_LAYER);
+
+        // Same blending as render_text() so the paths look the same.
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_COLOR, GL_ONE_MINUS_SRC_ALPHA);
+
+        glBindVertexArray(vertexArrayId);
+        glEnableVertexAttribArray(0);
+        glEnableVertexAttribArray(1);
+        glEnableVertexAttribArray(2);
+        size_t const stride = sizeof(FontVertex);
+        for (const DrawChunk& chunk : buffers) {
+            if (chunk.count == 0) {
+                continue;
+            }
+            glBindBuffer(GL_ARRAY_BUFFER, chunk.buffer);
+            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
+                (GLvoid*)(offsetof(FontVertex, pos)));
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, stride,
+                (GLvoid*)(offsetof(FontVertex, col)));
+            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride,
+                (GLvoid*)(offsetof(FontVertex, tex)));
+            glDrawArrays(GL_TRIANGLES, 0, chunk.count);
+            g_drawCalls++;
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        actors.draw(projection, shifted);
+
+        glDisable(GL_BLEND);
+    }
+
+  private:
+    MeshTerrain(const MeshTerrain&) = delete;
+    MeshTerrain& operator=(const MeshTerrain&) = delete;
+
+    static const int CHUNK_SIZE = 16;   ///< Cells on a side of a chunk
+
+    /// @brief A chunk as seen by prepare().
+    struct Chunk {
+        std::vector<FontVertex> vertices;  ///< Rebuilt in place by meshChunk()
+        bool dirty = true;                 ///< Needs to be meshed
+        bool meshed = false;               ///< Needs to be uploaded
+    };
+
+    /// @brief A chunk as seen by upload() and draw().
+    struct DrawChunk {
+        GLuint buffer = 0;
+        GLsizei count = 0;  ///< Vertices in buffer
+    };
+
+    /// @brief The meshes and buffers of levels other than the current one.
+    ///
+    ///   Levels are keyed by a hash of their terrain and of the glyph atlas,
+    /// and also keep their terrain so that a hash collision is a miss.  The
+    /// meshes are stored and taken by prepare() and the buffers by upload(),
+    /// which never run at the same time.  Past the budget the least recently
+    /// used levels are dropped.  With a directory set, the meshes of each
+    /// level that is left are also saved there, so that even a level that
+    /// was dropped, or seen by an earlier run, need not be meshed again.
+    class LevelCache {
+      public:
+        enum Source { NOT_FOUND, FROM_MEMORY, FROM_DISK };
+        static const uint64_t HASH_SEED = 14695981039346656037ULL;
+
+        size_t budget = 64 << 20;  ///< Bytes of buffers to keep
+        std::string directory;     ///< Where to save meshes, if not empty
+
+        /// @brief 64-bit FNV-1a, carrying on from an earlier hash.
+        static uint64_t hashBytes(const void* data, size_t size, uint64_t hash) {
+            const unsigned char* bytes = static_cast<const unsigned char*>(data);
+            for (size_t i = 0; i < size; i++) {
+                hash = (hash ^ bytes[i]) * 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        /// @brief Take the meshes of a level that is being left.  Leaves
+        /// the chunks' vertex arrays empty.
+        void storeMeshes(uint64_t key, int width, int height,
+                         const std::vector<char>& cells,
+                         std::vector<Chunk>& chunks) {
+            Level& level = levels[key];
+            level.width = width;
+            level.height = height;
+            level.cells = cells;
+            level.meshes.resize(chunks.size());
+            level.bytes = 0;
+            for (size_t i = 0; i < chunks.size(); i++) {
+                level.meshes[i].swap(chunks[i].vertices);
+                level.bytes += sizeof(FontVertex) * level.meshes[i].size();
+            }
+            level.lastUse = ++clock;
+            if (!directory.empty()) {
+                save(key, level);
+            }
+            if (level.bytes > budget) {
+                // Too big to keep.  Buffers left from an earlier visit can
+                // only be deleted on the render thread, by storeBuffers().
+                if (level.buffers.empty()) {
+                    levels.erase(key);
+                    evictions++;
+                } else {
+                    level.meshes.clear();
+                    tooBig.push_back(key);
+                }
+            }
+        }
+
+        /// @brief Give the meshes of a level back to its new chunks.
+        /// @return Where they were found.  If they came from memory, the
+        ///         buffers may be there too.
+        Source takeMeshes(uint64_t key, int width, int height,
+                          const std::vector<char>& cells,
+                          std::vector<Chunk>& chunks) {
+            auto it = levels.find(key);
+            if (it != levels.end() && it->second.width == width &&
+                it->second.height == height && it->second.cells == cells &&
+                it->second.meshes.size() == chunks.size()) {
+                for (size_t i = 0; i < chunks.size(); i++) {
+                    chunks[i].vertices.swap(it->second.meshes[i]);
+                }
+                it->second.meshes.clear();
+                it->second.lastUse = ++clock;
+                memoryHits++;
+                return FROM_MEMORY;
+            }
+            if (!directory.empty() && load(key, width, height, cells, chunks)) {
+                diskHits++;
+                return FROM_DISK;
+            }
+            misses++;
+            return NOT_FOUND;
+        }
+
+        /// @brief Take the buffers of a level that is being left.  Must be
+        /// called on the render thread, after storeMeshes() for the level.
+        void storeBuffers(uint64_t key, std::vector<DrawChunk>& buffers) {
+            // Drop the levels left since the last call that were too big
+            // to keep but still had buffers.
+            for (uint64_t k : tooBig) {
+                auto big = levels.find(k);
+                if (big != levels.end() && big->second.meshes.empty()) {
+                    drop(k);
+                    evictions++;
+                }
+            }
+            tooBig.clear();
+
+            auto it = levels.find(key);
+            if (it == levels.end()) {
+                return;
+            }
+            if (it->second.meshes.empty()) {
+                drop(key);
+                evictions++;
+                return;
+            }
+            deleteBuffers(it->second);
+            it->second.buffers.swap(buffers);
+
+            // Drop the least recently used levels until the rest fit.
+            size_t total = 0;
+            for (auto& entry : levels) {
+                total += entry.second.bytes;
+            }
+            while (total > budget && !levels.empty()) {
+                auto oldest = levels.begin();
+                for (auto i = levels.begin(); i != levels.end(); ++i) {
+                    if (i->second.lastUse < oldest->second.lastUse) {
+                        oldest = i;
+                    }
+                }
+                total -= oldest->second.bytes;
+                drop(oldest->first);
+                evictions++;
+            }
+        }
+
+        /// @brief Take the buffers of a level whose meshes came from memory.
+        /// Must be called on the render thread.
+        /// @return True if the buffers were still there.
+        bool takeBuffers(uint64_t key, size_t chunkCount,
+                         std::vector<DrawChunk>& buffers) {
+            auto it = levels.find(key);
+            if (it == levels.end()) {
+                return false;
+            }
+            bool found = (it->second.buffers.size() == chunkCount);
+            if (found) {
+                buffers.swap(it->second.buffers);
+                bufferHits++;
+            }
+            // Its meshes are in use again, so it is no longer cached.
+            drop(key);
+            return found;
+        }
+
+        /// @brief Drop every level.  Must be called on the render thread.
+        void clear() {
+            for (auto& entry : levels) {
+                deleteBuffers(entry.second);
+            }
+            levels.clear();
+        }
+
+        void printStats() const {
+            size_t lookups = memoryHits + diskHits + misses;
+            if (lookups == 0) {
+                return;
+            }
+            std::cerr << "Level cache: " << memoryHits + diskHits << " of "
+                      << lookups << " levels found ("
+                      << 100.0 * (memoryHits + diskHits) / lookups
+                      << "% hit rate), " << memoryHits << " in memory ("
+                      << bufferHits << " with their buffers), " << diskHits
+                      << " on disk, " << evictions << " dropped for space"
+                      << std::endl;
+        }
+
+      private:
+        struct Level {
+            int width = 0;
+            int height = 0;
+            std::vector<char> cells;                       ///< Its terrain
+            std::vector<std::vector<FontVertex> > meshes;  ///< Empty once taken
+            std::vector<DrawChunk> buffers;                ///< Empty until stored
+            size_t bytes = 0;                              ///< Size of the meshes
+            uint64_t lastUse = 0;
+        };
+
+        std::map<uint64_t, Level> levels;
+        std::vector<uint64_t> tooBig;  ///< Dropped by the next storeBuffers()
+        uint64_t clock = 0;  ///< Orders the uses of the levels
+        size_t memoryHits = 0;
+        size_t bufferHits = 0;
+        size_t diskHits = 0;
+        size_t misses = 0;
+        size_t evictions = 0;
+
+        static void deleteBuffers(Level& level) {
+            for (DrawChunk& b : level.buffers) {
+                glDeleteBuffers(1, &b.buffer);
+            }
+            level.buffers.clear();
+        }
 
-                            scale,  scale,  scale,  -scale, scale,  scale,
-                            scale,  -scale, scale,
+        /// @brief Forget a level and delete its buffers.  Must be called on
+        /// the render thread.
+        void drop(uint64_t key) {
+            auto it = levels.find(key);
+            if (it != levels.end()) {
+                deleteBuffers(it->second);
+                levels.erase(it);
+            }
+        }
 
-                            scale,  scale,  -scale, // -Z
-                            -scale, -scale, -scale, -scale, scale,  -scale,
+        std::string fileName(uint64_t key) const {
+            char name[32];
+            snprintf(name, sizeof(name), "/%016llx.mesh",
+                     static_cast<unsigned long long>(key));
+            return directory + name;
+        }
 
-                            scale,  scale,  -scale, scale,  -scale, -scale,
-                            -scale, -scale, -scale};
-    }
+        /// @brief Write a level's meshes, unless an earlier run already
+        /// did.  The file is in this machine's byte order, since it is only
+        /// a cache.
+        void save(uint64_t key, const Level& level) const {
+            std::string name = fileName(key);
+            if (std::ifstream(name.c_str()).good()) {
+                return;
+            }
+            std::string temp = name + ".tmp";
+            {
+                std::ofstream out(temp.c_str(), std::ofstream::binary);
+                uint32_t header[4] = { MESH_FILE_MAGIC,
+                                       static_cast<uint32_t>(level.width),
+                                       static_cast<uint32_t>(level.height),
+                                       static_cast<uint32_t>(level.meshes.size()) };
+                out.write(reinterpret_cast<const char*>(header), sizeof(header));
+                out.write(level.cells.data(), level.cells.size());
+                for (const std::vector<FontVertex>& mesh : level.meshes) {
+                    uint32_t count = static_cast<uint32_t>(mesh.size());
+                    out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+                    out.write(reinterpret_cast<const char*>(mesh.data()),
+                              sizeof(FontVertex) * mesh.size());
+                }
+                if (!out) {
+                    std::cerr << "MeshTerrain: Could not write " << temp
+                              << std::endl;
+                    return;
+                }
+            }
+#ifdef _WIN32
+            // rename() will not replace an existing file on Windows.
+            std::remove(name.c_str());
+#endif
+            if (std::rename(temp.c_str(), name.c_str()) != 0) {
+                std::cerr << "MeshTerrain: Could not rename " << temp << std::endl;
+            }
+        }
 
-    ~Cube() {
-        if (initialized) {
-            glDeleteBuffers(1, &vertexBuffer);
-            glDeleteVertexArrays(1, &vertexArrayId);
+        /// @brief Read a level's meshes into its chunks.
+        /// @return True on success, false if there is no file for the level
+        ///         or it does not match.
+        bool load(uint64_t key, int width, int height,
+                  const std::vector<char>& cells, std::vector<Chunk>& chunks) const {
+            std::ifstream in(fileName(key).c_str(), std::ifstream::binary);
+            uint32_t header[4];
+            if (!in.read(reinterpret_cast<char*>(header), sizeof(header)) ||
+                header[0] != MESH_FILE_MAGIC ||
+                header[1] != static_cast<uint32_t>(width) ||
+                header[2] != static_cast<uint32_t>(height) ||
+                header[3] != chunks.size()) {
+                return false;
+            }
+            std::vector<char> fileCells(cells.size());
+            if (!in.read(fileCells.data(), fileCells.size()) || fileCells != cells) {
+                return false;
+            }
+            for (Chunk& chunk : chunks) {
+                uint32_t count;
+                if (!in.read(reinterpret_cast<char*>(&count), sizeof(count))) {
+                    break;
+                }
+                chunk.vertices.resize(count);
+                if (!in.read(reinterpret_cast<char*>(chunk.vertices.data()),
+                             sizeof(FontVertex) * count)) {
+                    break;
+                }
+            }
+            if (!in) {
+                for (Chunk& chunk : chunks) {
+                    chunk.vertices.clear();
+                }
+                return false;
+            }
+            return true;
         }
-    }
 
-    /// @brief Must be called before draw() can be used.
-    void init() {
-        if (!initialized) {
-            // Vertex buffer
-            glGenBuffers(1, &vertexBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         sizeof(vertexBufferData[0]) * vertexBufferData.size(),
-                         &vertexBufferData[0], GL_STATIC_DRAW);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        enum { MESH_FILE_MAGIC = 0x3148534d };  ///< "MSH1"
+    };
 
-            // Color buffer
-            glGenBuffers(1, &colorBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         sizeof(colorBufferData[0]) * colorBufferData.size(),
-                         &colorBufferData[0], GL_STATIC_DRAW);
-            glBindBuffer(GL_ARRAY_BUFFER, 0);
+    bool initialized = false;
+    GLuint vertexArrayId = 0;
 
-            // Vertex array object
-            glGenVertexArrays(1, &vertexArrayId);
-            glBindVertexArray(vertexArrayId);
-            {
-                // color
-                glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
-                glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
+    // Owned by prepare(), and read by upload() while prepare() is not running.
+    int width = 0;
+    int height = 0;
+    int chunkCols = 0;
+    int chunkRows = 0;
+    int pendingPlayerRow = 0;
+    int pendingPlayerCol = 0;
+    bool layoutChanged = false;  ///< The chunks were re-created
+    bool actorsChanged = false;  ///< pendingActors needs to be uploaded
+    MapGrid terrain;             ///< The map being meshed, without its actors
+    MapActors pendingActors;     ///< The actors split off from it
+    std::vector<char> cells;     ///< Terrain the chunks were last built from
+    std::vector<Chunk> chunks;   ///< Row-major, chunkCols * chunkRows
+    uint64_t atlasHash = 0;      ///< Seeds hashLevel(); set by init()
+    uint64_t currentKey = 0;     ///< Cache key of the last new level
+    uint64_t departedKey = 0;    ///< Cache key of the level the buffers hold
+    bool levelChanged = false;   ///< buffers need to go into the cache
+    LevelCache::Source restoredFrom = LevelCache::NOT_FOUND;
+
+    // Used by both, as LevelCache describes.
+    LevelCache cache;
+
+    // Owned by the render thread.
+    int playerRow = 0;
+    int playerCol = 0;
+    unsigned layout = 0;             ///< Bumped whenever buffers is re-made
+    std::vector<DrawChunk> buffers;  ///< Parallel to chunks once uploaded
+    ActorBatch actors;
+
+    void deleteBuffers() {
+        for (DrawChunk& b : buffers) {
+            glDeleteBuffers(1, &b.buffer);
+        }
+        buffers.clear();
+    }
 
-                // VBO
-                glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-                glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (GLvoid*)0);
+    /// @brief The level cache key of some terrain.
+    uint64_t hashLevel(int w, int h, const std::vector<char>& terrainCells) const {
+        int size[2] = { w, h };
+        uint64_t hash = LevelCache::hashBytes(size, sizeof(size), atlasHash);
+        return LevelCache::hashBytes(terrainCells.data(), terrainCells.size(), hash);
+    }
 
-                glEnableVertexAttribArray(0);
-                glEnableVertexAttribArray(1);
+    /// @brief Copy a chunk's mesh into a buffer.
+    /// @return The number of vertices in the buffer.
+    static GLsizei fillBuffer(GLuint buffer, const Chunk& chunk) {
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(FontVertex) * chunk.vertices.size(),
+                     chunk.vertices.data(), GL_STATIC_DRAW);
+        return static_cast<GLsizei>(chunk.vertices.size());
+    }
+
+    /// @brief Mark the chunks holding a cell and its four neighbors.
+    void markDirty(int row, int col) {
+        int r0 = std::max(row - 1, 0) / CHUNK_SIZE;
+        int r1 = std::min(row + 1, height - 1) / CHUNK_SIZE;
+        int c0 = std::max(col - 1, 0) / CHUNK_SIZE;
+        int c1 = std::min(col + 1, width - 1) / CHUNK_SIZE;
+        for (int r = r0; r <= r1; r++) {
+            for (int c = c0; c <= c1; c++) {
+                chunks[r * chunkCols + c].dirty = true;
             }
-            glBindVertexArray(0);
-            initialized = true;
         }
     }
 
-    /// @brief Render the cube in the specified space.
-    /// @param [in] projection The OpenGL projection matrix to pass to the shader.
-    /// @param [in] modelView The OpenGL model/view matrix to pass to the shader.
-    void draw(const GLdouble projection[], const GLdouble modelView[]) {
-        init();
+    /// @brief Whether a map character has a glyph in the atlas.
+    static bool hasGlyph(char c) {
+        return c >= GlyphAtlas::FIRST_GLYPH &&
+               c < GlyphAtlas::FIRST_GLYPH + GlyphAtlas::NUM_GLYPHS;
+    }
 
-        sampleShader.useProgram(projection, modelView);
+    /// @brief Number of quads drawn for a cell.
+    static int quadCount(const MapGrid& map, int row, int col) {
+        char c = map.at(row, col);
+        if (!hasGlyph(c)) {
+            return 0;
+        }
+        switch (tileKindFor(c)) {
+        case TILE_WALL: {
+            int faces = 0;
+            for (int face = 0; face < 4; face++) {
+                faces += map.wallFaceShown(row, col, face) ? 1 : 0;
+            }
+            return faces;
+        }
+        case TILE_FLOOR:
+        case TILE_GLYPH:
+            return 1;
+        case TILE_NONE:
+            break;
+        }
+        return 0;
+    }
 
-        glBindVertexArray(vertexArrayId);
-        {
-            glDrawArrays(GL_TRIANGLES, 0,
-                         static_cast<GLsizei>(vertexBufferData.size()));
+    /// @brief Write the six vertices of one glyph quad.
+    ///
+    /// Uses the same corner order and placement as the terrain vertex shader.
+    template <int Plane>
+    static FontVertex* emitQuad(FontVertex* out, char c,
+                                GLfloat x, GLfloat y, GLfloat z) {
+        int index = c - GlyphAtlas::FIRST_GLYPH;
+        const GLfloat* m = glyphAtlas.glyphMetrics() + 4 * index;
+        GLfloat left = m[0] * MAP_GLYPH_SCALE;
+        GLfloat top = m[1] * MAP_GLYPH_SCALE;
+        GLfloat w = m[2] * MAP_GLYPH_SCALE;
+        GLfloat h = m[3] * MAP_GLYPH_SCALE;
+        GLfloat st[4];
+        glyphAtlas.glyphTexCoords(index, st);
+        GLfloat s0 = st[0];
+        GLfloat t0 = st[1];
+        GLfloat s1 = st[2];
+        GLfloat t1 = st[3];
+        // Blend in the text, fully opaque (inverse alpha) and fully white.
+        switch (Plane) {
+        case XY:
+            return emitFontQuad<XY>(out, x + left, x + left + w, y + top - h,
+                                    y + top, z, s0, t0, s1, t1, 1, 1, 1, 0);
+        case XZ:
+            // Lying flat, the glyph's top points towards -Z.
+            return emitFontQuad<XZ>(out, x + left, x + left + w, z + top,
+                                    z + top - h, y, s0, t0, s1, t1, 1, 1, 1, 0);
+        default:
+            // Standing in Y-Z, the glyph reads towards -Z.
+            return emitFontQuad<YZ>(out, z + left + w, z + left, y + top - h,
+                                    y + top, x, s0, t0, s1, t1, 1, 1, 1, 0);
         }
-        glBindVertexArray(0);
     }
 
-  private:
-    Cube(const Cube&) = delete;
-    Cube& operator=(const Cube&) = delete;
-    bool initialized = false;
-    GLuint colorBuffer = 0;
-    GLuint vertexBuffer = 0;
-    GLuint vertexArrayId = 0;
-    std::vector<GLfloat> colorBufferData;
-    std::vector<GLfloat> vertexBufferData;
+    /// @brief Build one chunk's triangles.  Runs as a task, so it only
+    /// touches its own chunk.
+    void meshChunk(const MapGrid& map, size_t index) {
+        Chunk& chunk = chunks[index];
+        int r0 = static_cast<int>(index / chunkCols) * CHUNK_SIZE;
+        int c0 = static_cast<int>(index % chunkCols) * CHUNK_SIZE;
+        int r1 = std::min(r0 + CHUNK_SIZE, height);
+        int c1 = std::min(c0 + CHUNK_SIZE, width);
+
+        // Count first so the array is sized once and then filled in place.
+        size_t quads = 0;
+        for (int r = r0; r < r1; r++) {
+            for (int c = c0; c < c1; c++) {
+                quads += quadCount(map, r, c);
+            }
+        }
+        chunk.vertices.resize(6 * quads);
+        chunk.dirty = false;
+        chunk.meshed = true;
+
+        FontVertex* out = chunk.vertices.data();
+        for (int r = r0; r < r1; r++) {
+            GLfloat x = MAP_CELL_SPACING * r;
+            for (int c = c0; c < c1; c++) {
+                GLfloat z = -MAP_CELL_SPACING * c;
+                char ch = map.at(r, c);
+                if (!hasGlyph(ch)) {
+                    continue;
+                }
+                switch (tileKindFor(ch)) {
+                case TILE_WALL:
+                    for (int face = 0; face < 4; face++) {
+                        if (!map.wallFaceShown(r, c, face)) {
+                            continue;
+                        }
+                        GLfloat offset = (face % 2 == 0) ? MAP_WALL_HALF_WIDTH
+                                                         : -MAP_WALL_HALF_WIDTH;
+                        if (face < 2) {
+                            out = emitQuad<YZ>(out, ch, x + offset, MAP_GLYPH_Y, z);
+                        } else {
+                            out = emitQuad<XY>(out, ch, x, MAP_GLYPH_Y, z + offset);
+                        }
+                    }
+                    break;
+                case TILE_FLOOR:
+                    out = emitQuad<XZ>(out, ch, x, MAP_GLYPH_Y, z);
+                    break;
+                case TILE_GLYPH:
+                    out = emitQuad<XY>(out, ch, x, MAP_GLYPH_Y, z);
+                    break;
+                case TILE_NONE:
+                    break;
+                }
+            }
+        }
+    }
 };
-
-static Cube roomCube(5.0f);
-static Cube handsCube(0.05f);
+static MeshTerrain meshTerrain;
 
 // Set to true when it is time for the application to quit.
 // Handlers below that set it to true when the user causes
@@ -847,6 +3370,8 @@ void SetupEye(
         return;
     }
 
+    g_currentEye = whichEye;
+
     // Set the viewport
     glViewport(static_cast<GLint>(viewport.left),
       static_cast<GLint>(viewport.lower),
@@ -854,6 +3379,26 @@ void SetupEye(
       static_cast<GLint>(viewport.height));
 }
 
+/// @brief The wall-clock time of an OSVR time, or now if it is unset.
+static MapStageTimes::Clock::time_point displayTime(const OSVR_TimeValue& t)
+{
+    if (t.seconds == 0 && t.microseconds == 0) {
+        return MapStageTimes::Clock::now();
+    }
+    return MapStageTimes::Clock::time_point(
+        std::chrono::duration_cast<MapStageTimes::Clock::duration>(
+            std::chrono::seconds(t.seconds) +
+            std::chrono::microseconds(t.microseconds)));
+}
+
+/// @brief Have the GPU note the time when it gets here, so that -jitStart
+/// can tell when the world has been drawn.
+static void markWorldDrawn()
+{
+    if (g_drawnQuery != 0) {
+        glQueryCounter(g_drawnQuery, GL_TIMESTAMP);
+    }
+}
 
 /// @brief Callback to draw things in world space.
 ///
@@ -894,100 +3439,63 @@ void DrawWorld(
     osvr::renderkit::OSVR_PoseState_to_OpenGL(viewGL, pose);
 
     /// Draw a cube with a 5-meter radius as the room we are floating in.
-    glBindTexture(GL_TEXTURE_2D, g_on_tex);
     //roomCube.draw(projectionGL, viewGL);
 
-    //open text file and parse one char at a time, 
-    //carriage return at every newline
-    std::ifstream ifs;
-    // std::cerr << "attempting to open text file\n";
-    ifs.open ("../../../UBuild/umoria/print_floor_test.txt", std::ifstream::in);
-    if (ifs.is_open()) {
-        // std::cerr << "opened file\n";
-    } else {
-        std::cerr << "could not open file\n";
-        perror("file.txt ");  
-        exit(1);
+    // Learn how long frames take from their inputs to the display.
+    if (g_currentEye == 0 && (deadline.seconds != 0 || deadline.microseconds != 0)) {
+        g_posePredictor.displayed(
+            osvrTimeValueDurationSeconds(&deadline, &g_inputTime));
     }
 
-    char c;
-    float playerX = 0.0;
-    float playerZ = 0.0;
-    while (ifs.get(c)) {  //get coords for @
-        char curr = c;
-        if (curr == '@') {
-            break;
-        } 
-        else if (curr == '\n') {
-            playerX -= 4.0;
-            playerZ = 0.0;
-        } else {
-            playerZ += 4.0;
-        }
+    // The first frame to draw a map snapshot ends its trip to the screen.
+    if (g_mapTimes.sequence != 0 && g_mapTimes.sequence != g_shownMapSequence) {
+        g_shownMapSequence = g_mapTimes.sequence;
+        g_mapLatency.shown(g_mapTimes, displayTime(deadline));
     }
-    ifs.close();                // close file
 
-    ifs.open ("../../../UBuild/umoria/print_floor_test.txt", std::ifstream::in);
-    if (ifs.is_open()) {
-        // std::cerr << "opened file\n";
-    } else {
-        std::cerr << "could not open file\n";
-        perror("print_floor_test.txt ");  
-        exit(1);
-    }
-    //translate around @
-    std::cerr << "translating X:";
-    std::cerr << playerX;
-    std::cerr << "\n";
-    std::cerr << "translating Z:";
-    std::cerr << playerZ;
-    std::cerr << "\n";
-
-    float dx = playerX;
-    float dz = playerZ;
-
-    while (ifs.get(c)) {         // loop rendering characters
-        // std::cerr << c;
-        char curr = c;
-        // if (curr == '@') {
-        //   std::cerr << '@: ';
-        //   std::cerr << dx;
-        //   std::cerr << ', ';
-        //   std::cerr << dz;
-        //   std::cerr << '\n';
-        // }
-        if (curr != '\n') {
-          char* arr = new char[2];
-          arr[0] = curr;
-          arr[1] = '\0';
-          if (curr == '#') {
-              draw_box(projectionGL, viewGL, "#", dx, -2.0f, dz, 0.1f, 0.1f);
-          }
-          else if (curr == '.') {
-            if (!render_text(projectionGL, viewGL, arr, dx,-2,dz, 0.1f, 0.1f, XZ)) {
-                quit = true;
-            }
-          }
-          else {
-            if (!render_text(projectionGL, viewGL, arr, dx,-2,dz, 0.1f, 0.1f, XY)) {
-                quit = true;
+    if (g_useGpuTerrain) {
+        gpuTerrain.draw(projectionGL, viewGL, g_currentEye);
+        markWorldDrawn();
+        return;
+    }
+    if (g_useMeshTerrain) {
+        meshTerrain.draw(projectionGL, viewGL);
+        markWorldDrawn();
+        return;
+    }
+
+    // Draw each cell of the map as text, centered around the @.  How each
+    // character is drawn comes from the tile table in MapGrid.h, which the
+    // GPU terrain path also uses.
+    char arr[2] = { 0, 0 };
+    for (int r = 0; r < g_map.height; r++) {
+        float dx = MAP_CELL_SPACING * (r - g_map.playerRow);
+        for (int col = 0; col < g_map.width; col++) {
+            float dz = MAP_CELL_SPACING * (g_map.playerCol - col);
+            arr[0] = g_map.cells[r * g_map.width + col];
+            switch (tileKindFor(arr[0])) {
+            case TILE_WALL:
+                draw_box(projectionGL, viewGL, arr, dx, MAP_GLYPH_Y, dz,
+                         MAP_GLYPH_SCALE, MAP_GLYPH_SCALE);
+                break;
+            case TILE_FLOOR:
+                if (!render_text(projectionGL, viewGL, arr, dx, MAP_GLYPH_Y, dz,
+                                 MAP_GLYPH_SCALE, MAP_GLYPH_SCALE, XZ)) {
+                    quit = true;
+                }
+                break;
+            case TILE_GLYPH:
+                if (!render_text(projectionGL, viewGL, arr, dx, MAP_GLYPH_Y, dz,
+                                 MAP_GLYPH_SCALE, MAP_GLYPH_SCALE, XY)) {
+                    quit = true;
+                }
+                break;
+            case TILE_NONE:
+                break;
             }
-          }
-          dz -= 4.0;
         }
-        else {
-            dz = playerZ;
-            dx += 4.0;
-        }     
     }
-    ifs.close();                // close file
-
-    // std::cerr << "playerX after render:";
-    // std::cerr << playerX;
-    // std::cerr << "\n";
-    // std::cerr << "playerZ after render:";
-    // std::cerr << playerZ;
-    // std::cerr << "\n";
+    markWorldDrawn();
 
     // if (!render_text(projectionGL, viewGL, "#", -1,-2,0, 0.1f, 0.1f, XZ)) {
     //   quit = true;
@@ -1045,7 +3553,6 @@ void DrawHead(
   osvr::renderkit::OSVR_PoseState_to_OpenGL(viewGL, pose);
 
   // Draw some text in front of us.
-  glBindTexture(GL_TEXTURE_2D, g_on_tex);
   // if (!render_text(projectionGL, viewGL, "Hello, Head Space", -1,0,-2, 0.003f,0.003f, XY)) {
   //   quit = true;
   // }
@@ -1086,7 +3593,6 @@ void DrawHand(
 
     GLdouble viewGL[16];
     osvr::renderkit::OSVR_PoseState_to_OpenGL(viewGL, pose);
-    glBindTexture(GL_TEXTURE_2D, g_on_tex);
     handsCube.draw(projectionGL, viewGL);
 }
 
@@ -1112,9 +3618,297 @@ static void q_to_OSVR(OSVR_PoseState& pose, const q_xyz_quat_type& xform)
   osvrQuatSetW(&pose.rotation, xform.quat[Q_W]);
 }
 
+/// @brief The head pose of a sample, with its orientation predicted the
+/// given time ahead if prediction is on and the sample has an angular
+/// velocity.
+/// @param [out] predicted The orientation used, as w, x, y, z.
+static void predictHead(const InputSample& sample, double seconds,
+                        OSVR_PoseState& head, double predicted[4])
+{
+  std::copy(sample.headRotation, sample.headRotation + 4, predicted);
+  if (g_predictHead && sample.headVelocityValid) {
+    PosePredictor::predict(sample.headRotation, sample.headAngularVelocity,
+                           seconds, predicted);
+  }
+  for (int i = 0; i < 3; i++) {
+    head.translation.data[i] = sample.headPosition[i];
+  }
+  osvrQuatSetW(&head.rotation, predicted[0]);
+  osvrQuatSetX(&head.rotation, predicted[1]);
+  osvrQuatSetY(&head.rotation, predicted[2]);
+  osvrQuatSetZ(&head.rotation, predicted[3]);
+}
+
+/// @brief Page in the part of the tiled map around the viewer and make the
+/// window around it the next map.
+static void loadTiledWindow(const OSVR_PoseState& pose, double dt)
+{
+    // Undo the placement used by every map path: cell (r, c) is drawn at
+    // x = spacing * (r - playerRow), z = spacing * (playerCol - c).
+    const TiledMapFormat::Header& info = g_tiledMap.info();
+    double row = info.playerRow + pose.translation.data[0] / MAP_CELL_SPACING;
+    double col = info.playerCol - pose.translation.data[2] / MAP_CELL_SPACING;
+    g_pager.update(row, col, dt);
+    g_pager.fillWindow(g_nextMap);
+}
+
+/// @brief Read MAP_FILE_NAME into g_nextMap, timing it as a new snapshot if
+/// the file has been written since g_map was read.
+/// @param [in] first Whether this is the read at startup, which is not timed
+///        because the file was not written for the program to pick up.
+static bool loadMapFile(bool first)
+{
+    MapStageTimes::Clock::time_point written;
+    bool timed = MapLatency::fileWriteTime(MAP_FILE_NAME, written);
+    MapStageTimes::Clock::time_point readStart = MapStageTimes::Clock::now();
+    if (!g_nextMap.load(MAP_FILE_NAME)) {
+        return false;
+    }
+    if (!timed) {
+        g_nextMapTimes = MapStageTimes();
+    } else if (g_mapTimes.written == written) {
+        g_nextMapTimes = g_mapTimes;
+    } else {
+        g_nextMapTimes = MapStageTimes();
+        g_nextMapTimes.sequence = first ? 0 : ++g_mapSequence;
+        g_nextMapTimes.written = written;
+        g_nextMapTimes.readStart = readStart;
+        g_nextMapTimes.parsed = MapStageTimes::Clock::now();
+        g_nextMapTimes.built = g_nextMapTimes.parsed;
+    }
+    return true;
+}
+
+void Usage(std::string name)
+{
+    std::cerr << "Usage: " << name << " [-gpuTerrain] [-cpuCull] [-occlusion]"
+              << " [-meshTerrain] [-threads N] [-framesInFlight N] [-uploadThread]"
+              << " [-levelCacheMB N] [-levelCacheDir DIR] [-textCacheKB N]"
+              << " [-tiledMap FILE [-tiledMapMB N]] [-compressAtlas]"
+              << " [-record FILE | -replay FILE [-replayFast]]"
+              << " [-predictMs N | -noPredict]"
+              << " [-redrawOnChange [-minRedrawHz N]]"
+              << " [-renderCores LIST] [-workerCores LIST]"
+              << " [-realtime fifo|rr [-realtimePriority N]] [-lockMemory]"
+              << " [-jitStart [-jitMarginMs N]]"
+              << " [-flightSpike X] [-flightSeconds N] [-flightTrace PREFIX]"
+              << " [-metricsFile FILE] [-metricsSocket PATH] [-metricsSeconds N]"
+              << std::endl;
+    std::cerr << "  -gpuTerrain: Build the map geometry on the GPU from a map texture"
+              << std::endl;
+    std::cerr << "  -cpuCull: Cull GPU terrain chunks on the CPU, not in a compute shader"
+              << std::endl;
+    std::cerr << "  -occlusion: Skip GPU terrain chunks hidden behind nearer ones"
+              << std::endl;
+    std::cerr << "  -meshTerrain: Build the map as per-chunk meshes on the CPU"
+              << std::endl;
+    std::cerr << "  -threads: Number of threads for CPU work (default one per core)"
+              << std::endl;
+    std::cerr << "  -framesInFlight: Frames the CPU may get ahead of the GPU (default 2)"
+              << std::endl;
+    std::cerr << "  -uploadThread: Fill chunk mesh buffers on a background thread"
+              << std::endl;
+    std::cerr << "  -levelCacheMB: Chunk mesh buffers kept for other levels (default 64)"
+              << std::endl;
+    std::cerr << "  -levelCacheDir: Also save chunk meshes of levels left to DIR"
+              << std::endl;
+    std::cerr << "  -textCacheKB: Vertex buffers kept for strings drawn (default 1024)"
+              << std::endl;
+    std::cerr << "  -tiledMap: Page the map in from a tiled map FILE around the viewer"
+              << std::endl;
+    std::cerr << "  -tiledMapMB: Decoded tiled map chunks to keep in memory (default 64)"
+              << std::endl;
+    std::cerr << "  -compressAtlas: Store the glyph atlas RGTC1-compressed"
+              << std::endl;
+    std::cerr << "  -record: Record every map and input sample to FILE"
+              << std::endl;
+    std::cerr << "  -replay: Play back FILE instead of reading the map and devices"
+              << std::endl;
+    std::cerr << "  -replayFast: Play back as fast as possible, not at recorded speed"
+              << std::endl;
+    std::cerr << "  -predictMs: Predict the head orientation this far ahead until"
+              << " the renderer reports display times (default 20)" << std::endl;
+    std::cerr << "  -noPredict: Fly along the head orientation as read, and replay"
+              << " it unpredicted" << std::endl;
+    std::cerr << "  -redrawOnChange: Only draw when the view, inputs or map change;"
+              << " for windowed displays, not HMDs" << std::endl;
+    std::cerr << "  -minRedrawHz: Redraw at least this often with -redrawOnChange"
+              << " (default 1)" << std::endl;
+    std::cerr << "  -renderCores: Pin the render thread to cores, such as 2,3 or 2-3"
+              << std::endl;
+    std::cerr << "  -workerCores: Pin the task and upload threads to cores"
+              << std::endl;
+    std::cerr << "  -realtime: Schedule the threads SCHED_FIFO or SCHED_RR, if"
+              << " permitted" << std::endl;
+    std::cerr << "  -realtimePriority: Of the render thread; the others get one"
+              << " less (default 10)" << std::endl;
+    std::cerr << "  -lockMemory: Lock the process into memory before rendering"
+              << std::endl;
+    std::cerr << "  -jitStart: Start each frame just in time for the next vertical"
+              << " sync; needs verticalSyncBlockRenderingEnabled" << std::endl;
+    std::cerr << "  -jitMarginMs: Time to spare before the sync with -jitStart"
+              << " (default 2)" << std::endl;
+    std::cerr << "  -flightSpike: Write a trace when a frame takes this many times"
+              << " the median (default 3)" << std::endl;
+    std::cerr << "  -flightSeconds: Seconds before the spike to write (default 5)"
+              << std::endl;
+    std::cerr << "  -flightTrace: Write traces to PREFIX-N.json (default flight)"
+              << std::endl;
+    std::cerr << "  -metricsFile: Write metrics to FILE in the Prometheus text"
+              << " format" << std::endl;
+    std::cerr << "  -metricsSocket: Serve metrics on a Unix socket at PATH"
+              << std::endl;
+    std::cerr << "  -metricsSeconds: Seconds between writes of -metricsFile"
+              << " (default 10)" << std::endl;
+    exit(-1);
+}
+
 int main(int argc, char* argv[])
 {
-    GLenum err;
+    int threads = 0;
+
+    // Parse the command line
+    for (int i = 1; i < argc; i++) {
+        if (std::string("-gpuTerrain") == argv[i]) {
+            g_useGpuTerrain = true;
+        } else if (std::string("-cpuCull") == argv[i]) {
+            g_cpuCull = true;
+        } else if (std::string("-occlusion") == argv[i]) {
+            g_occlusion = true;
+        } else if (std::string("-meshTerrain") == argv[i]) {
+            g_useMeshTerrain = true;
+        } else if (std::string("-threads") == argv[i]) {
+            if (++i >= argc) {
+                Usage(argv[0]);
+            }
+            threads = atoi(argv[i]);
+            if (threads <= 0) {
+                Usage(argv[0]);
+            }
+        } else if (std::string("-record") == argv[i]) {
+            if (++i >= argc || !g_recorder.open(argv[i])) {
+                Usage(argv[0]);
+            }
+        } else if (std::string("-replay") == argv[i]) {
+            if (++i >= argc || !g_replayer.open(argv[i])) {
+                Usage(argv[0]);
+            }
+            g_replaying = true;
+        } else if (std::string("-replayFast") == argv[i]) {
+            g_replayFast = true;
+        } else if (std::string("-uploadThread") == argv[i]) {
+            g_useUploadThread = true;
+        } else if (std::string("-levelCacheMB") == argv[i]) {
+            if (++i >= argc || atoi(argv[i]) < 0) {
+                Usage(argv[0]);
+            }
+            meshTerrain.setCacheBudget(static_cast<size_t>(atoi(argv[i])) << 20);
+        } else if (std::string("-levelCacheDir") == argv[i]) {
+            if (++i >= argc) {
+                Usage(argv[0]);
+            }
+            meshTerrain.setCacheDirectory(argv[i]);
+        } else if (std::string("-textCacheKB") == argv[i]) {
+            if (++i >= argc || atoi(argv[i]) < 0) {
+                Usage(argv[0]);
+            }
+            textRuns.budget = static_cast<size_t>(atoi(argv[i])) << 10;
+        } else if (std::string("-tiledMap") == argv[i]) {
+            if (++i >= argc || !g_tiledMap.open(argv[i])) {
+                Usage(argv[0]);
+            }
+            g_pager.setFile(&g_tiledMap);
+        } else if (std::string("-tiledMapMB") == argv[i]) {
+            if (++i >= argc || atoi(argv[i]) <= 0) {
+                Usage(argv[0]);
+            }
+            g_pager.budget = static_cast<size_t>(atoi(argv[i])) << 20;
+        } else if (std::string("-compressAtlas") == argv[i]) {
+            g_compressAtlas = true;
+        } else if (std::string("-predictMs") == argv[i]) {
+            if (++i >= argc || atof(argv[i]) < 0) {
+                Usage(argv[0]);
+            }
+            g_posePredictor.fallbackLead = atof(argv[i]) * 1e-3;
+        } else if (std::string("-noPredict") == argv[i]) {
+            g_predictHead = false;
+        } else if (std::string("-redrawOnChange") == argv[i]) {
+            g_redrawOnChange = true;
+        } else if (std::string("-minRedrawHz") == argv[i]) {
+            if (++i >= argc || atof(argv[i]) <= 0) {
+                Usage(argv[0]);
+            }
+            g_redraw.minRedrawHz = atof(argv[i]);
+        } else if (std::string("-renderCores") == argv[i]) {
+            if (++i >= argc ||
+                !ThreadTuning::parseCores(argv[i], g_threadTuning.renderCores)) {
+                Usage(argv[0]);
+            }
+        } else if (std::string("-workerCores") == argv[i]) {
+            if (++i >= argc ||
+                !ThreadTuning::parseCores(argv[i], g_threadTuning.workerCores)) {
+                Usage(argv[0]);
+            }
+        } else if (std::string("-realtime") == argv[i]) {
+            if (++i >= argc ||
+                !ThreadTuning::parsePolicy(argv[i], g_threadTuning.policy)) {
+                Usage(argv[0]);
+            }
+        } else if (std::string("-realtimePriority") == argv[i]) {
+            if (++i >= argc || atoi(argv[i]) <= 1) {
+                Usage(argv[0]);
+            }
+            g_threadTuning.priority = atoi(argv[i]);
+        } else if (std::string("-lockMemory") == argv[i]) {
+            g_threadTuning.lockMemory = true;
+        } else if (std::string("-jitStart") == argv[i]) {
+            g_jitStart = true;
+        } else if (std::string("-jitMarginMs") == argv[i]) {
+            if (++i >= argc || atof(argv[i]) < 0) {
+                Usage(argv[0]);
+            }
+            g_frameScheduler.margin =
+                std::chrono::duration_cast<FrameScheduler::Clock::duration>(
+                    std::chrono::duration<double, std::milli>(atof(argv[i])));
+        } else if (std::string("-flightSpike") == argv[i]) {
+            if (++i >= argc || atof(argv[i]) <= 1) {
+                Usage(argv[0]);
+            }
+            g_flightRecorder.spikeFactor = atof(argv[i]);
+        } else if (std::string("-flightSeconds") == argv[i]) {
+            if (++i >= argc || atof(argv[i]) <= 0) {
+                Usage(argv[0]);
+            }
+            g_flightRecorder.dumpSeconds = atof(argv[i]);
+        } else if (std::string("-flightTrace") == argv[i]) {
+            if (++i >= argc) {
+                Usage(argv[0]);
+            }
+            g_flightRecorder.prefix = argv[i];
+        } else if (std::string("-metricsFile") == argv[i]) {
+            if (++i >= argc) {
+                Usage(argv[0]);
+            }
+            g_metricsExporter.fileName = argv[i];
+        } else if (std::string("-metricsSocket") == argv[i]) {
+            if (++i >= argc) {
+                Usage(argv[0]);
+            }
+            g_metricsExporter.socketPath = argv[i];
+        } else if (std::string("-metricsSeconds") == argv[i]) {
+            if (++i >= argc || atof(argv[i]) <= 0) {
+                Usage(argv[0]);
+            }
+            g_metricsExporter.intervalSeconds = atof(argv[i]);
+        } else if (std::string("-framesInFlight") == argv[i]) {
+            if (++i >= argc || atoi(argv[i]) <= 0) {
+                Usage(argv[0]);
+            }
+            g_maxFramesInFlight = atoi(argv[i]);
+        } else {
+            Usage(argv[0]);
+        }
+    }
 
     // Get an OSVR client context to use to access the devices
     // that we need.
@@ -1214,6 +4008,7 @@ int main(int argc, char* argv[])
       for (auto f : FONTS) {
         if (0 == FT_New_Face(g_ft, f, 0, &g_face)) {
           found = true;
+          g_fontFile = f;
         } else {
           std::cerr << "Fovea: Could not open font " << f << std::endl;
         }
@@ -1226,39 +4021,42 @@ int main(int argc, char* argv[])
         FT_Set_Pixel_Sizes(g_face, 0, FONT_SIZE);
       }
     }
-    glGenBuffers(1, &g_fontVertexBuffer);
-    glGenVertexArrays(1, &g_fontVertexArrayId);
-
-    // Make an all-on texture to use when we're not rendering text.  Fill it with all 1's.
-    // Note: We could also use a different shader for when we're not rendering textures.
-    // Set the parameters we need to render the text properly.
-    // Leave this texture bound whenever we're not drawing text.
-    glGenTextures(1, &g_on_tex);
-    glBindTexture(GL_TEXTURE_2D, g_on_tex);
-    GLubyte onTex[] = {
-      255,255,255,255,
-      255,255,255,255,
-      255,255,255,255,
-      255,255,255,255 };
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-    glPixelStorei(GL_UNPACK_ROW_LENGTH, 2);
-    err = glGetError();
-    if (err != GL_NO_ERROR) {
-      std::cerr << "Error setting parameters for 'on' texture: "
-        << err << std::endl;
-    }
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 2, 2,
-      0, GL_RGBA, GL_UNSIGNED_BYTE, onTex);
-    err = glGetError();
-    if (err != GL_NO_ERROR) {
-      std::cerr << "Error writing 'on' texture: "
-        << err << std::endl;
+
+    g_scheduler.reset(new TaskScheduler(threads, [](unsigned) {
+        tuneWorkerThread(g_threadTuning, "task");
+    }));
+
+    // Every texture the example draws with is a layer of the tileset, which
+    // stays bound to unit 0 from here on.  Without a font it holds only the
+    // white layer, which is all the cubes need.
+    if (!glyphAtlas.build(*g_scheduler) &&
+        !tileset.build(*g_scheduler, std::vector<std::vector<GLubyte> >(), 0, 0,
+                       false)) {
+      std::cerr << "Could not build the tileset" << std::endl;
       quit = true;
     }
+    if (g_useUploadThread && !g_uploader.start()) {
+      std::cerr << "Could not start the upload thread, uploading on the "
+        << "render thread" << std::endl;
+    }
+    // Only once the other threads have started, so that they do not
+    // inherit the render thread's cores and priority.
+    pinThisThread(g_threadTuning.renderCores, "render");
+    makeThisThreadRealtime(g_threadTuning.policy, g_threadTuning.priority,
+                           "render");
+    if (g_useGpuTerrain && !gpuTerrain.init(!g_cpuCull)) {
+      std::cerr << "Could not set up GPU terrain, drawing the map on the CPU"
+        << std::endl;
+      g_useGpuTerrain = false;
+    }
+    if (g_useGpuTerrain && g_occlusion && !gpuTerrain.enableOcclusion()) {
+      std::cerr << "Could not set up occlusion culling" << std::endl;
+    }
+    if (g_useMeshTerrain && !meshTerrain.init()) {
+      std::cerr << "Could not set up chunk meshes, drawing the map as text"
+        << std::endl;
+      g_useMeshTerrain = false;
+    }
 
     // Set up a world-from-room additional transformation that we will
     // adjust as the user flies around using a joystick.  They always fly
@@ -1294,39 +4092,189 @@ int main(int argc, char* argv[])
     OSVR_TimeValue  lastTime;
     osvrTimeValueGetNow(&lastTime);
 
-    // Continue rendering until it is time to quit.
-    while (!quit) {
+    // State handed from one step of a frame to the next.
+    OSVR_AnalogState triggerValue = 0;
+    OSVR_AnalogState leftStickXValue = 0;
+    OSVR_AnalogState leftStickYValue = 0;
+    OSVR_AnalogState rightStickXValue = 0;
+    OSVR_PoseState currentHead;
+    OSVR_PoseState predictedHead;  ///< currentHead at the display time
+    OSVR_ReturnCode headRet = OSVR_RETURN_FAILURE;
+    InputSample frameInput;
+    double dt = 0;
+    bool nextMapLoaded = false;
+    bool nextMapChanged = true;  ///< g_nextMap differs from g_map
+    bool mapChanged = true;      ///< This frame's map differs from the last
+    bool drawFrame = true;
+    uint64_t appliedMapSequence = 0;  ///< Of the last map snapshot uploaded
+    osvr::renderkit::RenderManager::RenderParams params;
+    params.worldFromRoomAppend = &pose;
+    std::deque<GLsync> framesInFlight;
+    FrameScheduler::Clock::time_point inputStart;  ///< After any -jitStart wait
+    std::chrono::steady_clock::time_point replayStart;
+    uint64_t firstSampleUs = 0;
+    uint64_t lastSampleUs = 0;
+    size_t replayedFrames = 0;
+
+    // Each frame is run as a graph of steps.  Steps that use OpenGL or
+    // RenderManager run on this thread; the rest run on the scheduler.  The
+    // map for the next frame is read and meshed while this frame is being
+    // culled and submitted, into g_nextMap, which becomes g_map at the start
+    // of the next frame.
+    TaskGraph frame;
+
+    // Snapshot the inputs for this frame.
+    TaskGraph::Node input = frame.add([&]() {
+        inputStart = g_jitStart ? g_frameScheduler.waitForStart()
+                                : FrameScheduler::Clock::now();
+
         // Update the context so we get our callbacks called and
         // update tracker state.
         context.update();
+        osvrTimeValueGetNow(&g_inputTime);
+        double predicted[4];
 
-        //==========================================================================
-        // This section handles flying the user around based on the analog inputs.
+        if (g_replaying) {
+            InputSample& sample = frameInput;
+            if (!g_replayer.nextInput(sample)) {
+                quit = true;
+                return;
+            }
+            if (replayedFrames == 0) {
+                replayStart = std::chrono::steady_clock::now();
+                firstSampleUs = lastSampleUs = sample.timeUs;
+            }
+            replayedFrames++;
+            if (!g_replayFast) {
+                std::this_thread::sleep_until(replayStart +
+                    std::chrono::microseconds(sample.timeUs - firstSampleUs));
+                // Pacing the replay is waiting, not work of the frame.
+                inputStart = FrameScheduler::Clock::now();
+            }
+            // Step by the recorded time, so the flight path is the same at
+            // any playback speed.
+            dt = (sample.timeUs - lastSampleUs) * 1e-6;
+            lastSampleUs = sample.timeUs;
+            triggerValue = sample.trigger;
+            leftStickXValue = sample.leftStickX;
+            leftStickYValue = sample.leftStickY;
+            rightStickXValue = sample.rightStickX;
+            headRet = sample.headValid ? OSVR_RETURN_SUCCESS : OSVR_RETURN_FAILURE;
+            for (int i = 0; i < 3; i++) {
+                currentHead.translation.data[i] = sample.headPosition[i];
+            }
+            osvrQuatSetW(&currentHead.rotation, sample.headRotation[0]);
+            osvrQuatSetX(&currentHead.rotation, sample.headRotation[1]);
+            osvrQuatSetY(&currentHead.rotation, sample.headRotation[2]);
+            osvrQuatSetZ(&currentHead.rotation, sample.headRotation[3]);
+            // Render from the recorded head pose too, not the live one, and
+            // predict it as the renderer would have.
+            double seconds = g_posePredictor.lead();
+            predictHead(sample, seconds, predictedHead, predicted);
+            params.roomFromHeadReplace = sample.headValid ? &predictedHead : nullptr;
+            if (sample.headValid) {
+                g_predictionErrors.sample(sample.timeUs, sample.headRotation);
+                if (g_predictHead && sample.headVelocityValid) {
+                    g_predictionErrors.predicted(
+                        sample.timeUs + static_cast<uint64_t>(seconds * 1e6),
+                        predicted, sample.headRotation);
+                }
+            }
+            return;
+        }
 
         // Read the current value of the analogs we want
         OSVR_TimeValue  ignore;
-        OSVR_AnalogState triggerValue = 0;
         osvrGetAnalogState(analogTrigger.get(), &ignore, &triggerValue);
-        OSVR_AnalogState leftStickXValue = 0;
         osvrGetAnalogState(analogLeftStickX.get(), &ignore, &leftStickXValue);
-        OSVR_AnalogState leftStickYValue = 0;
         osvrGetAnalogState(analogLeftStickY.get(), &ignore, &leftStickYValue);
-        OSVR_AnalogState rightStickXValue = 0;
         osvrGetAnalogState(analogRightStickX.get(), &ignore, &rightStickXValue);
+        OSVR_TimeValue headTime = g_inputTime;
+        headRet = osvrGetPoseState(headSpace.get(), &headTime, &currentHead);
+        OSVR_AngularVelocityState headVelocity;
+        bool velocityRead = osvrGetAngularVelocityState(headSpace.get(), &ignore,
+            &headVelocity) == OSVR_RETURN_SUCCESS;
+
+        // Keep the inputs as a sample, to record them and to tell whether
+        // they have changed.
+        InputSample& sample = frameInput;
+        sample.trigger = triggerValue;
+        sample.leftStickX = leftStickXValue;
+        sample.leftStickY = leftStickYValue;
+        sample.rightStickX = rightStickXValue;
+        sample.headValid = (headRet == OSVR_RETURN_SUCCESS);
+        for (int i = 0; i < 3; i++) {
+            sample.headPosition[i] = currentHead.translation.data[i];
+        }
+        sample.headRotation[0] = osvrQuatGetW(&currentHead.rotation);
+        sample.headRotation[1] = osvrQuatGetX(&currentHead.rotation);
+        sample.headRotation[2] = osvrQuatGetY(&currentHead.rotation);
+        sample.headRotation[3] = osvrQuatGetZ(&currentHead.rotation);
+        sample.headVelocityValid = false;
+        if (velocityRead) {
+            double increment[4] = {
+                osvrQuatGetW(&headVelocity.incrementalRotation),
+                osvrQuatGetX(&headVelocity.incrementalRotation),
+                osvrQuatGetY(&headVelocity.incrementalRotation),
+                osvrQuatGetZ(&headVelocity.incrementalRotation)
+            };
+            sample.headVelocityValid = PosePredictor::angularVelocity(
+                increment, headVelocity.dt, sample.headAngularVelocity);
+        }
+        if (g_recorder.isOpen()) {
+            g_recorder.recordInput(sample);
+        }
+
+        // Predict from when the tracker reported the pose, which may be a
+        // little before it was read.
+        double age = std::max(0.0, std::min(g_posePredictor.maxLead,
+            osvrTimeValueDurationSeconds(&g_inputTime, &headTime)));
+        predictHead(sample, g_posePredictor.lead() + age, predictedHead, predicted);
 
+        OSVR_TimeValue  now;
+        osvrTimeValueGetNow(&now);
+        OSVR_TimeValue nowCopy = now;
+        osvrTimeValueDifference(&now, &lastTime);
+        lastTime = nowCopy;
+        dt = now.seconds + now.microseconds * 1e-6;
+    }, {}, TaskGraph::CALLING_THREAD);
+
+    // Switch to the map that was read during the last frame and send
+    // whatever changed in it to OpenGL.
+    TaskGraph::Node applyMap = frame.add([&]() {
+        if (!nextMapLoaded) {
+            std::cerr << "could not open file\n";
+            perror(MAP_FILE_NAME);
+            exit(1);
+        }
+        MapStageTimes::Clock::time_point applyStart = MapStageTimes::Clock::now();
+        std::swap(g_map, g_nextMap);
+        std::swap(g_mapTimes, g_nextMapTimes);
+        mapChanged = nextMapChanged;
+        if (g_useGpuTerrain) {
+            gpuTerrain.update(g_map);
+        } else if (g_useMeshTerrain) {
+            meshTerrain.upload();
+        }
+        // A snapshot that is read again unchanged keeps its first times.
+        if (g_mapTimes.sequence != 0 && g_mapTimes.sequence != appliedMapSequence) {
+            g_mapTimes.applyStart = applyStart;
+            g_mapTimes.uploaded = MapStageTimes::Clock::now();
+            appliedMapSequence = g_mapTimes.sequence;
+        }
+    }, {}, TaskGraph::CALLING_THREAD);
+
+
+    //==========================================================================
+    // This section handles flying the user around based on the analog inputs.
+    TaskGraph::Node integrate = frame.add([&]() {
         // Figure out how much to move and in which directions based
         // on how much time as passed and what the analog values are.
         const double X_SPEED_SCALE = 3.0;
         const double Y_SPEED_SCALE = -3.0;  // Y axis on controller is backwards
         const double Z_SPEED_SCALE = -2.0;
         const double SPIN_SPEED_SCALE = -Q_PI / 2;  // Want to spin the other way
-        OSVR_TimeValue  now;
-        osvrTimeValueGetNow(&now);
-        OSVR_TimeValue nowCopy = now;
-        osvrTimeValueDifference(&now, &lastTime);
-        lastTime = nowCopy;
 
-        double dt = now.seconds + now.microseconds * 1e-6;
         double right = dt * leftStickXValue * X_SPEED_SCALE;
         double forward = dt * leftStickYValue * Y_SPEED_SCALE;
         double up = dt * triggerValue * Z_SPEED_SCALE;
@@ -1342,9 +4290,7 @@ int main(int argc, char* argv[])
 
         // Make forward be along -Z in head space.
         // Remember that room space is rotated w.r.t. world space
-        OSVR_PoseState currentHead;
-        OSVR_ReturnCode ret = osvrGetPoseState(headSpace.get(), &ignore, &currentHead);
-        if (ret == OSVR_RETURN_SUCCESS) {
+        if (headRet == OSVR_RETURN_SUCCESS) {
 
           // Adjust the rotation by spinning around the vertical (Y) axis
           q_type rot;
@@ -1354,9 +4300,10 @@ int main(int argc, char* argv[])
           q_mult(cur_pose.quat, rot, cur_pose.quat);
           q_to_OSVR(pose, cur_pose);
 
-          // Get the current head pose in room space.
+          // Get the head pose in room space, as it will be when this frame
+          // is shown.
           q_xyz_quat_type poseXform;
-          q_from_OSVR(poseXform, currentHead);
+          q_from_OSVR(poseXform, predictedHead);
 
           // Find -Z in world space by catenating the room-to-world
           // rotation.
@@ -1388,24 +4335,342 @@ int main(int argc, char* argv[])
             pose.translation.data[2] += deltaZ;
           }
         }
+    }, { input });
+
+    // Read and mesh the map for the next frame.  The previous contents of
+    // g_nextMap are no longer needed once applyMap has run.  A tiled map is
+    // paged around where the viewer has flown to, so that waits for
+    // integrate.
+    TaskGraph::Node loadMap = frame.add([&]() {
+        if (g_replaying) {
+            // Past the end of the recording this keeps the last map.
+            uint64_t arrivalUs;
+            g_replayer.nextMap(g_nextMap, arrivalUs);
+            g_nextMapTimes = MapStageTimes();
+            nextMapLoaded = true;
+        } else if (g_tiledMap.isOpen()) {
+            loadTiledWindow(pose, dt);
+            g_nextMapTimes = MapStageTimes();
+            nextMapLoaded = true;
+        } else if (g_mapWatch.isOpen() && !g_mapWatch.changed()) {
+            // Not written since it was last read.
+            g_nextMap = g_map;
+            g_nextMapTimes = g_mapTimes;
+            nextMapLoaded = true;
+        } else {
+            nextMapLoaded = loadMapFile(false);
+        }
+        if (nextMapLoaded && !g_replaying) {
+            g_recorder.recordMap(g_nextMap);
+        }
+        if (g_redrawOnChange) {
+            nextMapChanged = !(g_nextMap == g_map);
+        }
+    }, { applyMap, integrate });
+    TaskGraph::Node prepareMesh = frame.add([&]() {
+        if (g_useMeshTerrain && nextMapLoaded) {
+            meshTerrain.prepare(g_nextMap);
+            if (g_nextMapTimes.sequence != g_mapTimes.sequence) {
+                g_nextMapTimes.built = MapStageTimes::Clock::now();
+            }
+        }
+    }, { loadMap });
 
-        //==========================================================================
-        // Render the scene, sending it the current roomToWorld transform that
-        // tells it about how we are flying.
-        osvr::renderkit::RenderManager::RenderParams params;
-        params.worldFromRoomAppend = &pose;
+    // Decide whether this frame needs drawing at all.
+    TaskGraph::Node decide = frame.add([&]() {
+        if (!g_redrawOnChange) {
+            drawFrame = true;
+            return;
+        }
+        RedrawPolicy::Clock::time_point now = RedrawPolicy::Clock::now();
+        drawFrame = g_redraw.needsRedraw(frameInput, pose.translation.data,
+                                         pose.rotation.data, mapChanged, now);
+        if (drawFrame) {
+            g_redraw.drawn(frameInput, pose.translation.data,
+                           pose.rotation.data, now);
+        }
+    }, { applyMap, integrate }, TaskGraph::CALLING_THREAD);
+
+    // Cull the map chunks once against both eyes for this frame.  Live
+    // frames are drawn from a head pose that Render() reads again later, so
+    // the frustums are widened by as far as the head turns in one refresh.
+    // A replay that hands Render() its head pose culls with that very pose.
+    TaskGraph::Node cull = frame.add([&]() {
+        if (g_useGpuTerrain && drawFrame) {
+            double margin = 0;
+            if (!params.roomFromHeadReplace) {
+                double speed = MAX_HEAD_SPEED;
+                if (frameInput.headVelocityValid) {
+                    const double* w = frameInput.headAngularVelocity;
+                    speed = std::sqrt(w[0] * w[0] + w[1] * w[1] + w[2] * w[2]);
+                }
+                double period = g_frameScheduler.refreshPeriod();
+                margin = speed * (period > 0 ? period : 1.0 / 60);
+            }
+            gpuTerrain.cull(render->GetRenderInfo(params), margin);
+        }
+    }, { decide }, TaskGraph::CALLING_THREAD);
+
+    //==========================================================================
+    // Render the scene, sending it the current roomToWorld transform that
+    // tells it about how we are flying.
+    TaskGraph::Node present = frame.add([&]() {
+        if (!drawFrame) {
+            // Nothing to show has changed, so rather than spin, sleep until
+            // the map is written or it is time to read the inputs again.
+            g_mapWatch.wait(g_redraw.pollInterval());
+            g_frameScheduler.skipped();
+            return;
+        }
+        // With -jitStart, line the GPU's clock up with ours so that the time
+        // DrawWorld() has the GPU note can be compared with the frame start.
+        GLint64 gpuBefore = 0;
+        FrameScheduler::Clock::time_point cpuBefore;
+        if (g_jitStart) {
+            if (g_drawnQuery == 0) {
+                // Noting a time now makes the query exist, with a time that
+                // is ignored below.
+                glGenQueries(1, &g_drawnQuery);
+                glQueryCounter(g_drawnQuery, GL_TIMESTAMP);
+            }
+            glGetInteger64v(GL_TIMESTAMP, &gpuBefore);
+            cpuBefore = FrameScheduler::Clock::now();
+        }
         if (!render->Render(params)) {
             std::cerr
                 << "Render() returned false, maybe because it was asked to quit"
                 << std::endl;
             quit = true;
         }
+        // Recorded with or without -jitStart, to compare the pose ages.
+        g_frameScheduler.presented(inputStart, FrameScheduler::Clock::now());
+        if (g_jitStart) {
+            // Presenting blocks until the sync, so the world has long since
+            // been drawn unless the frame missed it.
+            GLint ready = 0;
+            glGetQueryObjectiv(g_drawnQuery, GL_QUERY_RESULT_AVAILABLE, &ready);
+            GLuint64 gpuDrawn = 0;
+            if (ready) {
+                glGetQueryObjectui64v(g_drawnQuery, GL_QUERY_RESULT, &gpuDrawn);
+            }
+            // A time from before Render() is from a frame that did not draw
+            // the world.
+            if (ready && static_cast<GLint64>(gpuDrawn) >= gpuBefore) {
+                FrameScheduler::Clock::time_point drawn = cpuBefore +
+                    std::chrono::duration_cast<FrameScheduler::Clock::duration>(
+                        std::chrono::nanoseconds(
+                            static_cast<GLint64>(gpuDrawn) - gpuBefore));
+                g_frameScheduler.rendered(drawn - inputStart);
+                g_flightRecorder.counter("GPU drawn (us)",
+                    std::chrono::duration_cast<std::chrono::microseconds>(
+                        drawn - inputStart).count());
+            }
+        }
+
+        // Don't let the CPU get more than the allowed number of frames
+        // ahead of the GPU.
+        framesInFlight.push_back(glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+        FlightRecorder::Clock::time_point waitStart = FlightRecorder::Clock::now();
+        while (framesInFlight.size() > g_maxFramesInFlight) {
+            glClientWaitSync(framesInFlight.front(), GL_SYNC_FLUSH_COMMANDS_BIT,
+                             1000000000);
+            glDeleteSync(framesInFlight.front());
+            framesInFlight.pop_front();
+        }
+        g_flightRecorder.phase("wait for GPU", waitStart,
+                               FlightRecorder::Clock::now());
+    }, { cull }, TaskGraph::CALLING_THREAD);
+
+    if (g_redrawOnChange && !g_replaying && !g_tiledMap.isOpen() &&
+        !g_mapWatch.open(MAP_FILE_NAME)) {
+        std::cerr << "Could not watch " << MAP_FILE_NAME << " for changes, "
+                  << "reading it every frame" << std::endl;
+    }
+
+    // Read the first map before the first frame needs it.
+    if (g_replaying) {
+        uint64_t arrivalUs;
+        g_replayer.nextMap(g_nextMap, arrivalUs);
+        nextMapLoaded = true;
+    } else {
+        if (g_tiledMap.isOpen()) {
+            loadTiledWindow(pose, 0);
+            nextMapLoaded = true;
+        } else {
+            nextMapLoaded = loadMapFile(true);
+        }
+        if (nextMapLoaded) {
+            g_recorder.recordMap(g_nextMap);
+        }
+    }
+    if (g_useMeshTerrain && nextMapLoaded) {
+        meshTerrain.prepare(g_nextMap);
+        g_nextMapTimes.built = MapStageTimes::Clock::now();
+    }
+
+    // Everything the frames use has been allocated by now.
+    if (g_threadTuning.lockMemory) {
+        lockProcessMemory();
+    }
+    frame.recordLatency(&g_renderStepLatency, &g_workerStepLatency);
+    frame.recordTimes(true);
+    frame.setName(input, "input");
+    frame.setName(applyMap, "apply map");
+    frame.setName(integrate, "integrate");
+    frame.setName(loadMap, "load map");
+    frame.setName(prepareMesh, "prepare mesh");
+    frame.setName(decide, "decide");
+    frame.setName(cull, "cull");
+    frame.setName(present, "render");
+    uint64_t recordedMapSequence = 0;
+    size_t occlusionTests = 0;
+    size_t occlusionHidden = 0;
+
+    // Every metric is registered before the exporter starts reading them.
+    MetricsRegistry::Counter& framesMetric = g_metrics.counter(
+        "fly_frames_total", "Frames run, including ones with nothing to draw");
+    g_metrics.histogram("fly_frame_seconds",
+                        "Time each drawn frame took, not counting waits",
+                        g_frameTimes);
+    MetricsRegistry::Counter& droppedMetric = g_metrics.counter(
+        "fly_dropped_frames_total",
+        "Refreshes that showed an old frame because a new one was late");
+    MetricsRegistry::Counter& drawCallsMetric = g_metrics.counter(
+        "fly_draw_calls_total", "OpenGL draw calls made");
+    MetricsRegistry::Counter& mapReloadsMetric = g_metrics.counter(
+        "fly_map_reloads_total", "New map snapshots read from the map file");
+    g_metrics.histogram("fly_map_latency_seconds",
+                        "Time from writing a map snapshot to displaying it",
+                        g_mapLatency.stage(MapLatency::TOTAL));
+    MetricsRegistry::Counter& textHitsMetric = g_metrics.counter(
+        "fly_text_cache_hits_total", "Strings drawn from cached glyph quads");
+    MetricsRegistry::Counter& textMissesMetric = g_metrics.counter(
+        "fly_text_cache_misses_total", "Strings whose glyph quads were built");
+    MetricsRegistry::Gauge& textHitRatioMetric = g_metrics.gauge(
+        "fly_text_cache_hit_ratio", "Fraction of strings drawn from the cache");
+    // Free video memory is only known through vendor extensions.  It is
+    // read about once a second, not every frame.
+    MetricsRegistry::Gauge* gpuFreeMetric = nullptr;
+    if (GLEW_NVX_gpu_memory_info) {
+        GLint totalKB = 0;
+        glGetIntegerv(GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX, &totalKB);
+        g_metrics.gauge("fly_gpu_memory_bytes", "Dedicated video memory")
+            .set(1024.0 * totalKB);
+    }
+    if (GLEW_NVX_gpu_memory_info || GLEW_ATI_meminfo) {
+        gpuFreeMetric = &g_metrics.gauge("fly_gpu_memory_free_bytes",
+                                         "Video memory available");
+    }
+    std::chrono::steady_clock::time_point gpuMemoryRead;
+    if (!g_metricsExporter.start()) {
+        std::cerr << "Could not start exporting metrics" << std::endl;
+    }
+
+    // Continue rendering until it is time to quit.
+    while (!quit) {
+        uint64_t allocations = allocationCount().load(std::memory_order_relaxed);
+        frame.run(*g_scheduler);
+        std::chrono::steady_clock::time_point frameEnd =
+            std::chrono::steady_clock::now();
+        // The time before inputStart was spent waiting on purpose, for
+        // -jitStart or to pace a replay, and frames that were not drawn
+        // slept while idle, so neither counts as frame time.
+        if (drawFrame) {
+            g_frameTimes.add(frameEnd - inputStart);
+        }
+
+        // Leave evidence of every stall in the flight recorder.
+        for (TaskGraph::Node n = 0; n < frame.size(); n++) {
+            g_flightRecorder.phase(frame.name(n), frame.startTime(n),
+                                   frame.finishTime(n),
+                                   frame.affinity(n) == TaskGraph::CALLING_THREAD ? 0 : 1);
+        }
+        g_flightRecorder.counter("allocations",
+            allocationCount().load(std::memory_order_relaxed) - allocations,
+            frameEnd);
+        if (g_mapTimes.sequence != recordedMapSequence) {
+            recordedMapSequence = g_mapTimes.sequence;
+            g_flightRecorder.mark("map snapshot", recordedMapSequence,
+                                  frame.startTime(applyMap));
+        }
+        if (g_useGpuTerrain && g_occlusion) {
+            size_t tests, hidden;
+            gpuTerrain.occlusionStats(tests, hidden);
+            g_flightRecorder.counter("occlusion tests", tests - occlusionTests,
+                                     frameEnd);
+            g_flightRecorder.counter("occlusion hidden", hidden - occlusionHidden,
+                                     frameEnd);
+            occlusionTests = tests;
+            occlusionHidden = hidden;
+        }
+        g_flightRecorder.frame(inputStart, frameEnd, drawFrame);
+
+        framesMetric.add();
+        droppedMetric.set(g_frameScheduler.droppedFrames());
+        drawCallsMetric.set(g_drawCalls);
+        mapReloadsMetric.set(g_mapSequence);
+        size_t textHits = textRuns.hitCount();
+        size_t textMisses = textRuns.missCount();
+        textHitsMetric.set(textHits);
+        textMissesMetric.set(textMisses);
+        if (textHits + textMisses > 0) {
+            textHitRatioMetric.set(double(textHits) / (textHits + textMisses));
+        }
+        if (gpuFreeMetric && frameEnd - gpuMemoryRead >= std::chrono::seconds(1)) {
+            gpuMemoryRead = frameEnd;
+            // The ATI query gives the free memory of the texture pool
+            // first, then of other kinds.
+            GLint freeKB[4] = { 0, 0, 0, 0 };
+            glGetIntegerv(GLEW_NVX_gpu_memory_info
+                              ? GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX
+                              : GL_TEXTURE_FREE_MEMORY_ATI,
+                          freeKB);
+            gpuFreeMetric->set(1024.0 * freeKB[0]);
+        }
+    }
+    g_flightRecorder.stop();
+    g_metricsExporter.stop();
+    for (GLsync sync : framesInFlight) {
+        glDeleteSync(sync);
+    }
+    if (g_drawnQuery != 0) {
+        glDeleteQueries(1, &g_drawnQuery);
+        g_drawnQuery = 0;
+    }
+    g_uploader.stop();
+    g_recorder.close();
+    if (g_replaying && replayedFrames > 0) {
+        double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - replayStart).count();
+        std::cerr << "Replayed " << replayedFrames << " frames in " << seconds
+                  << " s, " << 1000 * seconds / replayedFrames << " ms per frame"
+                  << std::endl;
+    }
+
+    if (g_useGpuTerrain && g_occlusion) {
+        // Only chunks inside the view are tested, so this shows how much
+        // occlusion culling adds to frustum culling.
+        size_t tests, hidden;
+        gpuTerrain.occlusionStats(tests, hidden);
+        std::cerr << "Occlusion culling: " << hidden << " of " << tests
+                  << " chunk tests found the chunk hidden" << std::endl;
+    }
+    if (g_useMeshTerrain) {
+        meshTerrain.printCacheStats();
+    }
+    if (g_tiledMap.isOpen()) {
+        g_pager.printStats();
     }
 
-    glDeleteVertexArrays(1, &g_fontVertexArrayId);
-    glDeleteBuffers(1, &g_fontVertexBuffer);
-    glDeleteTextures(1, &g_on_tex);
-    glDeleteTextures(1, &g_font_tex);
+    textRuns.printStats();
+    textRuns.clear();
+    g_frameTimes.print(std::cerr, "Frame times");
+    g_renderStepLatency.print(std::cerr, "Render thread step start latency");
+    g_workerStepLatency.print(std::cerr, "Task thread step start latency");
+    g_mapLatency.print(std::cerr);
+    g_predictionErrors.print(std::cerr);
+    g_frameScheduler.print(std::cerr);
+    g_flightRecorder.printStats(std::cerr);
     if (g_face) { FT_Done_Face(g_face); g_face = nullptr; }
     if (g_ft) { FT_Done_FreeType(g_ft); g_ft = nullptr; }
 
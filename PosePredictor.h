@@ -0,0 +1,225 @@
+/** @file
+    @brief Prediction of the head orientation to the time a frame reaches
+           the display, from the tracker's angular velocity, and a log of
+           how far the predictions were off.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Standard includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+
+/// @brief Extrapolates the head orientation to when a frame will be shown.
+///
+///   Quaternions are w, x, y, z, as in InputSample.  The angular velocity is
+/// taken to be in head space, as the IMU's gyros measure it, so it is
+/// applied on the right of the orientation.  How long frames take to reach
+/// the display is learned from the deadlines that the renderer hands to the
+/// draw callbacks; until one is seen, fallbackLead is used.
+class PosePredictor {
+public:
+  double fallbackLead = 0.020;  ///< Seconds from reading inputs to display
+  double maxLead = 0.100;       ///< Longer leads are taken to be mistakes
+
+  /// @brief Seconds from reading a frame's inputs to showing it.
+  double lead() const { return seenLead ? smoothedLead : fallbackLead; }
+
+  /// @brief Learn from a frame that was to be shown lead seconds after its
+  /// inputs were read.  Implausible leads are ignored.
+  void displayed(double lead) {
+    if (lead <= 0 || lead > maxLead) {
+      return;
+    }
+    smoothedLead = seenLead ? smoothedLead + 0.1 * (lead - smoothedLead) : lead;
+    seenLead = true;
+  }
+
+  /// @brief Turn an OSVR incremental rotation over dt seconds into an
+  /// angular velocity.
+  /// @return False if dt is not positive.
+  static bool angularVelocity(const double increment[4], double dt,
+                              double velocity[3]) {
+    if (!(dt > 0)) {
+      return false;
+    }
+    double s = std::sqrt(increment[1] * increment[1] +
+                         increment[2] * increment[2] +
+                         increment[3] * increment[3]);
+    if (s < 1e-12) {
+      velocity[0] = velocity[1] = velocity[2] = 0;
+      return true;
+    }
+    // The shorter way round: q and -q are the same rotation.
+    double w = increment[0];
+    double sign = (w < 0) ? -1 : 1;
+    double angle = 2 * std::atan2(s, sign * w);
+    for (int i = 0; i < 3; i++) {
+      velocity[i] = sign * increment[i + 1] / s * angle / dt;
+    }
+    return true;
+  }
+
+  /// @brief Rotate an orientation on by an angular velocity for a time.
+  static void predict(const double rotation[4], const double velocity[3],
+                      double seconds, double predicted[4]) {
+    double wx = velocity[0] * seconds;
+    double wy = velocity[1] * seconds;
+    double wz = velocity[2] * seconds;
+    double angle = std::sqrt(wx * wx + wy * wy + wz * wz);
+    double step[4] = { 1, 0, 0, 0 };
+    if (angle > 1e-12) {
+      double s = std::sin(angle / 2) / angle;
+      step[0] = std::cos(angle / 2);
+      step[1] = wx * s;
+      step[2] = wy * s;
+      step[3] = wz * s;
+    }
+    multiply(rotation, step, predicted);
+    normalize(predicted);
+  }
+
+  /// @brief Angle in radians of the rotation between two orientations.
+  static double angleBetween(const double q0[4], const double q1[4]) {
+    double dot = std::abs(q0[0] * q1[0] + q0[1] * q1[1] + q0[2] * q1[2] +
+                          q0[3] * q1[3]);
+    return 2 * std::acos(std::min(1.0, dot));
+  }
+
+  /// @brief Spherical interpolation from q0 (t = 0) to q1 (t = 1).
+  static void slerp(const double q0[4], const double q1[4], double t,
+                    double out[4]) {
+    double dot = q0[0] * q1[0] + q0[1] * q1[1] + q0[2] * q1[2] + q0[3] * q1[3];
+    double sign = (dot < 0) ? -1 : 1;
+    dot *= sign;
+    double a = 1 - t, b = t;
+    if (dot < 0.9995) {
+      double theta = std::acos(dot);
+      a = std::sin((1 - t) * theta) / std::sin(theta);
+      b = std::sin(t * theta) / std::sin(theta);
+    }
+    for (int i = 0; i < 4; i++) {
+      out[i] = a * q0[i] + b * sign * q1[i];
+    }
+    normalize(out);
+  }
+
+private:
+  bool seenLead = false;
+  double smoothedLead = 0;
+
+  static void multiply(const double a[4], const double b[4], double out[4]) {
+    double w = a[0] * b[0] - a[1] * b[1] - a[2] * b[2] - a[3] * b[3];
+    double x = a[0] * b[1] + a[1] * b[0] + a[2] * b[3] - a[3] * b[2];
+    double y = a[0] * b[2] - a[1] * b[3] + a[2] * b[0] + a[3] * b[1];
+    double z = a[0] * b[3] + a[1] * b[2] - a[2] * b[1] + a[3] * b[0];
+    out[0] = w;
+    out[1] = x;
+    out[2] = y;
+    out[3] = z;
+  }
+
+  static void normalize(double q[4]) {
+    double n = std::sqrt(q[0] * q[0] + q[1] * q[1] + q[2] * q[2] + q[3] * q[3]);
+    if (n > 0) {
+      for (int i = 0; i < 4; i++) {
+        q[i] /= n;
+      }
+    }
+  }
+};
+
+/// @brief Compares predicted orientations with the ones the tracker later
+/// reported for the predicted times.
+///
+///   Each prediction waits until a sample at or after its time arrives, and
+/// is compared with the orientation interpolated between that sample and
+/// the one before.  The orientation the prediction started from is compared
+/// too, to show what predicting gained.
+class PredictionErrorLog {
+public:
+  PredictionErrorLog() {}
+
+  /// @brief Note a prediction for a time.
+  /// @param [in] from The orientation the prediction started from.
+  void predicted(uint64_t timeUs, const double predicted[4],
+                 const double from[4]) {
+    Prediction p;
+    p.timeUs = timeUs;
+    std::copy(predicted, predicted + 4, p.predicted);
+    std::copy(from, from + 4, p.from);
+    pending.push_back(p);
+  }
+
+  /// @brief Score the predictions up to a newly read orientation.
+  void sample(uint64_t timeUs, const double rotation[4]) {
+    while (!pending.empty() && pending.front().timeUs <= timeUs) {
+      const Prediction& p = pending.front();
+      if (havePrevious && p.timeUs >= previousUs) {
+        double actual[4];
+        double t = (timeUs == previousUs) ? 1.0
+            : double(p.timeUs - previousUs) / double(timeUs - previousUs);
+        PosePredictor::slerp(previous, rotation, t, actual);
+        double error = PosePredictor::angleBetween(p.predicted, actual);
+        double baseline = PosePredictor::angleBetween(p.from, actual);
+        count++;
+        errorSum += error;
+        baselineSum += baseline;
+        errorMax = std::max(errorMax, error);
+        baselineMax = std::max(baselineMax, baseline);
+      }
+      pending.pop_front();
+    }
+    havePrevious = true;
+    previousUs = timeUs;
+    std::copy(rotation, rotation + 4, previous);
+  }
+
+  /// @brief Print the mean and largest errors, in degrees.
+  void print(std::ostream& out) const {
+    if (count == 0) {
+      return;
+    }
+    const double DEGREES = 180 / 3.14159265358979323846;
+    out << "Head prediction error over " << count << " predictions: mean "
+        << DEGREES * errorSum / count << " deg, max " << DEGREES * errorMax
+        << " deg; without prediction: mean " << DEGREES * baselineSum / count
+        << " deg, max " << DEGREES * baselineMax << " deg" << std::endl;
+  }
+
+private:
+  PredictionErrorLog(const PredictionErrorLog&) = delete;
+  PredictionErrorLog& operator=(const PredictionErrorLog&) = delete;
+
+  struct Prediction {
+    uint64_t timeUs;
+    double predicted[4];
+    double from[4];
+  };
+  std::deque<Prediction> pending;
+  bool havePrevious = false;
+  uint64_t previousUs = 0;
+  double previous[4] = { 1, 0, 0, 0 };
+  size_t count = 0;
+  double errorSum = 0;
+  double baselineSum = 0;
+  double errorMax = 0;
+  double baselineMax = 0;
+};
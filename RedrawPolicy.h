@@ -0,0 +1,232 @@
+/** @file
+    @brief Redraw-on-change for displays that are not head-mounted: skips
+           frames whose view, inputs and map are the same as the last one
+           drawn, and waits on the map file rather than spinning.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "MapRecording.h"
+
+// Standard includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <thread>
+
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+/// @brief Notices when a file is rewritten, so that it need only be read
+/// again when it has changed.
+///
+///   On Linux this watches the file's directory with inotify for the file
+/// being closed after writing or renamed into place, which also catches
+/// writers that replace the file rather than rewrite it.  Elsewhere, or if
+/// the watch cannot be set up, the file is always reported as changed and
+/// wait() just sleeps.
+///
+///   changed() and wait() may be called from different threads: wait()
+/// only looks for pending events, and changed() is the one that reads them.
+class MapFileWatch {
+public:
+  MapFileWatch() {}
+
+  ~MapFileWatch() { close(); }
+
+  /// @brief Start watching a file, which need not exist yet.
+  /// @return True if changes will be noticed, false if the file will always
+  ///         be reported as changed.
+  bool open(const std::string& fileName) {
+    close();
+    pending = true;
+#ifdef __linux__
+    std::string::size_type slash = fileName.find_last_of('/');
+    std::string directory =
+        (slash == std::string::npos) ? "." : fileName.substr(0, slash + 1);
+    name = (slash == std::string::npos) ? fileName : fileName.substr(slash + 1);
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) {
+      return false;
+    }
+    if (inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+      close();
+      return false;
+    }
+    return true;
+#else
+    (void)fileName;
+    return false;
+#endif
+  }
+
+  void close() {
+#ifdef __linux__
+    if (fd >= 0) {
+      ::close(fd);
+      fd = -1;
+    }
+#endif
+  }
+
+  bool isOpen() const {
+#ifdef __linux__
+    return fd >= 0;
+#else
+    return false;
+#endif
+  }
+
+  /// @brief Whether the file has been written since the last call.  The
+  /// first call after open() returns true.
+  bool changed() {
+    if (!isOpen()) {
+      return true;
+    }
+    bool result = pending;
+    pending = false;
+#ifdef __linux__
+    // Each read returns whole events, and an event for another file in the
+    // directory does not count.
+    alignas(inotify_event) char buffer[4096];
+    ssize_t n;
+    while ((n = read(fd, buffer, sizeof(buffer))) > 0) {
+      for (char* p = buffer; p < buffer + n;) {
+        const inotify_event* event = reinterpret_cast<const inotify_event*>(p);
+        if (event->len > 0 && name == event->name) {
+          result = true;
+        }
+        p += sizeof(inotify_event) + event->len;
+      }
+    }
+#endif
+    return result;
+  }
+
+  /// @brief Sleep until something happens in the file's directory or the
+  /// timeout passes.  A change to another file in the directory also ends
+  /// the wait.
+  void wait(std::chrono::microseconds timeout) {
+#ifdef __linux__
+    if (isOpen()) {
+      pollfd p;
+      p.fd = fd;
+      p.events = POLLIN;
+      p.revents = 0;
+      int ms = static_cast<int>((timeout.count() + 999) / 1000);
+      poll(&p, 1, ms);
+      return;
+    }
+#endif
+    std::this_thread::sleep_for(timeout);
+  }
+
+private:
+  MapFileWatch(const MapFileWatch&) = delete;
+  MapFileWatch& operator=(const MapFileWatch&) = delete;
+
+  bool pending = true;  ///< Report a change before any event is seen
+#ifdef __linux__
+  int fd = -1;
+  std::string name;  ///< File name within the watched directory
+#endif
+};
+
+/// @brief Decides whether a frame needs to be drawn on a display that only
+/// has to change when what it shows does.
+///
+///   A frame is drawn when the head pose, the inputs or the viewpoint that
+/// the user has flown to have moved by more than a tolerance since the last
+/// frame drawn, when the map has changed, or when minRedrawHz says it is
+/// time to refresh anyway.  Movements are measured from the last frame
+/// drawn, so slow drift still redraws once it adds up.  Not for head-mounted
+/// displays, which need every frame to track the head with low latency.
+class RedrawPolicy {
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  double minRedrawHz = 1;          ///< Redraw at least this often
+  double inputPollHz = 100;        ///< How often inputs are read while idle
+  double positionTolerance = 1e-4; ///< Meters
+  double rotationTolerance = 1e-3; ///< Radians
+  double analogTolerance = 1e-3;   ///< Of the -1 to 1 analog range
+
+  /// @brief Whether this frame needs to be drawn.
+  /// @param [in] input The inputs read for this frame.
+  /// @param [in] position, rotation Where the viewer has flown to in the
+  ///             world, with rotation as w, x, y, z.
+  /// @param [in] mapChanged Whether the map differs from the last frame's.
+  bool needsRedraw(const InputSample& input, const double position[3],
+                   const double rotation[4], bool mapChanged,
+                   Clock::time_point now) const {
+    if (!drawnOnce || mapChanged ||
+        now - lastDraw >= std::chrono::duration<double>(1.0 / minRedrawHz)) {
+      return true;
+    }
+    if (input.headValid != lastInput.headValid ||
+        std::abs(input.trigger - lastInput.trigger) > analogTolerance ||
+        std::abs(input.leftStickX - lastInput.leftStickX) > analogTolerance ||
+        std::abs(input.leftStickY - lastInput.leftStickY) > analogTolerance ||
+        std::abs(input.rightStickX - lastInput.rightStickX) > analogTolerance) {
+      return true;
+    }
+    return moved(input.headPosition, input.headRotation,
+                 lastInput.headPosition, lastInput.headRotation) ||
+           moved(position, rotation, lastPosition, lastRotation);
+  }
+
+  /// @brief Record that a frame has been drawn with this state.
+  void drawn(const InputSample& input, const double position[3],
+             const double rotation[4], Clock::time_point now) {
+    drawnOnce = true;
+    lastDraw = now;
+    lastInput = input;
+    std::copy(position, position + 3, lastPosition);
+    std::copy(rotation, rotation + 4, lastRotation);
+  }
+
+  /// @brief How long to wait before reading the inputs again while idle.
+  std::chrono::microseconds pollInterval() const {
+    return std::chrono::microseconds(static_cast<long long>(1e6 / inputPollHz));
+  }
+
+private:
+  bool drawnOnce = false;
+  Clock::time_point lastDraw;
+  InputSample lastInput;
+  double lastPosition[3] = { 0, 0, 0 };
+  double lastRotation[4] = { 1, 0, 0, 0 };
+
+  /// @brief Whether two poses differ by more than the tolerances.
+  bool moved(const double p0[3], const double q0[4], const double p1[3],
+             const double q1[4]) const {
+    double dx = p0[0] - p1[0];
+    double dy = p0[1] - p1[1];
+    double dz = p0[2] - p1[2];
+    if (dx * dx + dy * dy + dz * dz > positionTolerance * positionTolerance) {
+      return true;
+    }
+    // q and -q are the same rotation.
+    double dot = std::abs(q0[0] * q1[0] + q0[1] * q1[1] + q0[2] * q1[2] +
+                          q0[3] * q1[3]);
+    return 2 * std::acos(std::min(1.0, dot)) > rotationTolerance;
+  }
+};
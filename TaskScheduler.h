@@ -0,0 +1,432 @@
+/** @file
+    @brief Small work-stealing task scheduler used to spread CPU work such
+           as chunk meshing and glyph rasterization across cores.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "LatencyHistogram.h"
+
+// Standard includes
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <initializer_list>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// @brief Pool of worker threads that run tasks from per-thread deques.
+///
+///   Every worker has its own deque.  A thread pushes the tasks it spawns
+/// onto the back of its own deque and pops from the back, so it works on
+/// the most recently spawned (cache-warm) task first.  A thread whose deque
+/// is empty steals from the front of another thread's deque.  The thread
+/// that created the scheduler has a deque of its own and helps run tasks
+/// while it waits for a group to finish rather than blocking.
+///
+///   The deques are each guarded by their own mutex, which is only held for
+/// the push or pop itself, so workers do not contend unless they are
+/// stealing from the same victim.
+class TaskScheduler {
+public:
+  typedef std::function<void()> Task;
+
+  /// @brief Called on each worker thread as it starts, with its index.
+  typedef std::function<void(unsigned)> ThreadInit;
+
+  /// @brief Tracks a set of spawned tasks so that they can be waited on.
+  class TaskGroup {
+  public:
+    TaskGroup() : pending(0) {}
+
+  private:
+    friend class TaskScheduler;
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+    std::atomic<int> pending;
+  };
+
+  /// @brief Start the worker threads.
+  /// @param [in] numThreads Total number of threads that run tasks,
+  ///             including the one calling wait().  Zero means one per core.
+  /// @param [in] threadInit If set, run first on each worker thread, for
+  ///             example to pin it to a core.
+  explicit TaskScheduler(unsigned numThreads = 0,
+                         ThreadInit threadInit = ThreadInit())
+    : done(false), queued(0), init(std::move(threadInit)) {
+    if (numThreads == 0) {
+      numThreads = std::thread::hardware_concurrency();
+    }
+    if (numThreads == 0) {
+      numThreads = 1;
+    }
+    for (unsigned i = 0; i < numThreads; i++) {
+      deques.emplace_back(new WorkDeque);
+    }
+    // Deque 0 belongs to the thread that owns the scheduler.
+    for (unsigned i = 1; i < numThreads; i++) {
+      threads.emplace_back(&TaskScheduler::workerLoop, this, i);
+    }
+  }
+
+  ~TaskScheduler() {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      done = true;
+    }
+    wake.notify_all();
+    for (auto& t : threads) {
+      t.join();
+    }
+  }
+
+  /// @brief Number of threads, including the owning thread, that run tasks.
+  unsigned threadCount() const {
+    return static_cast<unsigned>(deques.size());
+  }
+
+  /// @brief Add a task to the calling thread's deque.
+  void spawn(TaskGroup& group, Task task) {
+    group.pending++;
+    WorkDeque& d = *deques[currentIndex()];
+    {
+      std::lock_guard<std::mutex> lock(d.mutex);
+      d.tasks.push_back(Item{ std::move(task), &group });
+    }
+    queued++;
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wake.notify_one();
+  }
+
+  /// @brief Run tasks until every task in the group has finished.
+  ///
+  /// The calling thread runs tasks itself, from any group, while it waits.
+  /// When there are none it yields for a while and then sleeps briefly
+  /// between checks, since yielding never lets a lower-priority real-time
+  /// thread run, and the tasks being waited for may be on one.
+  void wait(TaskGroup& group) {
+    unsigned self = currentIndex();
+    unsigned idle = 0;
+    while (group.pending > 0) {
+      if (runOne(self)) {
+        idle = 0;
+      } else if (++idle < 64) {
+        std::this_thread::yield();
+      } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+      }
+    }
+  }
+
+  /// @brief Run one queued task on the calling thread, if there is one.
+  /// @return True if a task was run.
+  bool runPending() {
+    return runOne(currentIndex());
+  }
+
+  /// @brief Run body(i) for every i in [begin, end), in chunks of grain,
+  /// and wait for all of them.
+  template <typename Body>
+  void parallelFor(size_t begin, size_t end, size_t grain, Body body) {
+    if (grain == 0) {
+      grain = 1;
+    }
+    TaskGroup group;
+    for (size_t first = begin; first < end; first += grain) {
+      size_t last = std::min(first + grain, end);
+      spawn(group, [first, last, &body]() {
+        for (size_t i = first; i < last; i++) {
+          body(i);
+        }
+      });
+    }
+    wait(group);
+  }
+
+private:
+  TaskScheduler(const TaskScheduler&) = delete;
+  TaskScheduler& operator=(const TaskScheduler&) = delete;
+
+  struct Item {
+    Task task;
+    TaskGroup* group;
+  };
+
+  struct WorkDeque {
+    std::mutex mutex;
+    std::deque<Item> tasks;
+  };
+
+  std::vector<std::unique_ptr<WorkDeque>> deques;
+  std::vector<std::thread> threads;
+  bool done;                  ///< Guarded by sleepMutex
+  std::atomic<int> queued;    ///< Tasks sitting in any deque
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  ThreadInit init;
+
+  /// @brief Which deque belongs to the calling thread.  Threads that are
+  /// not workers share deque 0 with the owning thread.
+  static unsigned& threadIndex() {
+    static thread_local unsigned index = 0;
+    return index;
+  }
+
+  unsigned currentIndex() const {
+    unsigned i = threadIndex();
+    return i < deques.size() ? i : 0;
+  }
+
+  /// @brief Pop from our own deque, or steal from another, and run it.
+  /// @return True if a task was run.
+  bool runOne(unsigned self) {
+    Item item;
+    bool found = false;
+    {
+      WorkDeque& d = *deques[self];
+      std::lock_guard<std::mutex> lock(d.mutex);
+      if (!d.tasks.empty()) {
+        item = std::move(d.tasks.back());
+        d.tasks.pop_back();
+        found = true;
+      }
+    }
+    for (size_t n = 1; !found && n < deques.size(); n++) {
+      WorkDeque& d = *deques[(self + n) % deques.size()];
+      std::lock_guard<std::mutex> lock(d.mutex);
+      if (!d.tasks.empty()) {
+        item = std::move(d.tasks.front());
+        d.tasks.pop_front();
+        found = true;
+      }
+    }
+    if (!found) {
+      return false;
+    }
+    queued--;
+    item.task();
+    item.group->pending--;
+    return true;
+  }
+
+  void workerLoop(unsigned index) {
+    threadIndex() = index;
+    if (init) {
+      init(index);
+    }
+    while (true) {
+      if (runOne(index)) {
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      wake.wait(lock, [this]() { return done || queued > 0; });
+      if (done) {
+        return;
+      }
+    }
+  }
+};
+
+/// @brief A fixed set of tasks with dependencies between them, run as a
+/// whole once per frame.
+///
+///   A task starts as soon as every task it depends on has finished, so
+/// independent work proceeds in parallel.  Tasks that must run on the
+/// thread that calls run(), such as ones that use the OpenGL context, are
+/// marked as such and are run there; the rest run on the scheduler.  When
+/// the scheduler has worker threads the calling thread only runs its own
+/// tasks, so that they are never stuck behind a long worker task.
+///
+///   How long each task waits between being ready and starting can be
+/// recorded, which shows how promptly the threads are being scheduled.
+class TaskGraph {
+public:
+  typedef size_t Node;
+
+  enum Affinity {
+    ANY_THREAD,     ///< Run on whichever scheduler thread is free
+    CALLING_THREAD  ///< Run on the thread that called run()
+  };
+
+  TaskGraph() {}
+
+  /// @brief Record the wait from ready to started of every task, into one
+  /// histogram for the calling thread's tasks and one for the rest.
+  /// Either may be null.
+  void recordLatency(LatencyHistogram* callingThread, LatencyHistogram* anyThread) {
+    callingThreadLatency = callingThread;
+    anyThreadLatency = anyThread;
+  }
+
+  /// @brief Keep when each task last started and finished, for startTime()
+  /// and finishTime() to report once run() has returned.
+  void recordTimes(bool record) { recordingTimes = record; }
+
+  size_t size() const { return nodes.size(); }
+
+  /// @brief Name a task, for reports.  The name must outlive the graph.
+  void setName(Node n, const char* name) { nodes[n].name = name; }
+  const char* name(Node n) const { return nodes[n].name; }
+
+  Affinity affinity(Node n) const { return nodes[n].affinity; }
+
+  std::chrono::steady_clock::time_point startTime(Node n) const {
+    return nodes[n].started;
+  }
+  std::chrono::steady_clock::time_point finishTime(Node n) const {
+    return nodes[n].finished;
+  }
+
+  /// @brief Add a task that runs after all of the tasks in dependsOn.
+  /// @return Handle to use when other tasks depend on this one.
+  Node add(TaskScheduler::Task task, std::initializer_list<Node> dependsOn = {},
+           Affinity affinity = ANY_THREAD) {
+    Node node = nodes.size();
+    nodes.push_back(NodeInfo());
+    nodes.back().task = std::move(task);
+    nodes.back().affinity = affinity;
+    nodes.back().dependencies = static_cast<int>(dependsOn.size());
+    for (Node d : dependsOn) {
+      nodes[d].successors.push_back(node);
+    }
+    return node;
+  }
+
+  /// @brief Run every task once and return when all have finished.
+  void run(TaskScheduler& scheduler) {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      finished = 0;
+      for (NodeInfo& n : nodes) {
+        n.remaining = n.dependencies;
+      }
+    }
+    TaskScheduler::TaskGroup group;
+    for (Node n = 0; n < nodes.size(); n++) {
+      if (nodes[n].dependencies == 0) {
+        release(scheduler, group, n);
+      }
+    }
+
+    bool helping = (scheduler.threadCount() == 1);
+    std::unique_lock<std::mutex> lock(mutex);
+    while (finished < nodes.size()) {
+      if (!callingThreadReady.empty()) {
+        Node n = callingThreadReady.front();
+        callingThreadReady.pop_front();
+        lock.unlock();
+        runNode(scheduler, group, n);
+        lock.lock();
+      } else if (helping) {
+        lock.unlock();
+        if (!scheduler.runPending()) {
+          std::this_thread::yield();
+        }
+        lock.lock();
+      } else {
+        wake.wait(lock);
+      }
+    }
+    lock.unlock();
+    // The last tasks may still be returning from runNode().
+    scheduler.wait(group);
+  }
+
+private:
+  TaskGraph(const TaskGraph&) = delete;
+  TaskGraph& operator=(const TaskGraph&) = delete;
+
+  struct NodeInfo {
+    TaskScheduler::Task task;
+    Affinity affinity = ANY_THREAD;
+    int dependencies = 0;          ///< Number of tasks this one waits for
+    int remaining = 0;             ///< Of those, how many have not finished
+    std::vector<Node> successors;  ///< Tasks that wait for this one
+    std::chrono::steady_clock::time_point released;  ///< When it became ready
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point finished;
+    const char* name = "task";
+  };
+
+  std::vector<NodeInfo> nodes;
+  std::mutex mutex;              ///< Guards the fields below and remaining
+  std::condition_variable wake;  ///< Signalled when the calling thread has work
+  size_t finished = 0;
+  std::deque<Node> callingThreadReady;
+  LatencyHistogram* callingThreadLatency = nullptr;
+  LatencyHistogram* anyThreadLatency = nullptr;
+  bool recordingTimes = false;
+
+  void release(TaskScheduler& scheduler, TaskScheduler::TaskGroup& group,
+               Node n) {
+    if (callingThreadLatency || anyThreadLatency) {
+      nodes[n].released = std::chrono::steady_clock::now();
+    }
+    if (nodes[n].affinity == CALLING_THREAD) {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        callingThreadReady.push_back(n);
+      }
+      wake.notify_one();
+    } else {
+      scheduler.spawn(group, [this, &scheduler, &group, n]() {
+        runNode(scheduler, group, n);
+      });
+    }
+  }
+
+  void runNode(TaskScheduler& scheduler, TaskScheduler::TaskGroup& group,
+               Node n) {
+    LatencyHistogram* latency = (nodes[n].affinity == CALLING_THREAD)
+                                    ? callingThreadLatency
+                                    : anyThreadLatency;
+    if (latency || recordingTimes) {
+      nodes[n].started = std::chrono::steady_clock::now();
+    }
+    if (latency) {
+      latency->add(nodes[n].started - nodes[n].released);
+    }
+    nodes[n].task();
+    if (recordingTimes) {
+      nodes[n].finished = std::chrono::steady_clock::now();
+    }
+    std::vector<Node> ready;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (Node s : nodes[n].successors) {
+        if (--nodes[s].remaining == 0) {
+          ready.push_back(s);
+        }
+      }
+    }
+    for (Node s : ready) {
+      release(scheduler, group, s);
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      finished++;
+    }
+    wake.notify_one();
+  }
+};
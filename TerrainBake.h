@@ -0,0 +1,251 @@
+/** @file
+    @brief Bakes diffuse lighting and ambient occlusion for static map
+           terrain into per-vertex colors, so it can be drawn unlit.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Internal Includes
+#include "MapGrid.h"
+
+// Standard includes
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/// @brief Terrain triangles with their lighting baked into the colors.
+struct BakedTerrain {
+  std::vector<float> positions;  ///< x, y, z per vertex
+  std::vector<uint8_t> colors;   ///< r, g, b per vertex
+  std::vector<char> cells;       ///< Terrain cells this was baked from
+
+  size_t vertexCount() const { return positions.size() / 3; }
+};
+
+/// @brief Where the terrain sits and how it is lit.
+///
+///   The defaults match mapDraw, which places cell (row, col) centered on
+/// (spacing * row, 0, -spacing * col) as a cube of half-size halfSize.
+struct TerrainBakeParams {
+  float spacing = 10.0f;
+  float halfSize = 5.0f;
+  float light[3] = { 0.3f, 0.8f, 0.5f };  ///< Toward the light; normalized
+  float ambient = 0.45f;   ///< Light reaching faces turned away from it
+  float diffuse = 0.55f;   ///< Extra light on a face turned toward it
+  float occlusion = 0.18f; ///< Darkening for each blocking wall at a corner
+};
+
+/// @brief Which of the eight cells around a cell are walls.
+///
+/// Bit i is set when the neighbor at wallNeighborOffsets[i] is a wall.
+/// The bits run around the cell, so bits i and i + 2 (mod 8) are the two
+/// sides of the diagonal at bit i + 1 for every even i.
+static const int wallNeighborOffsets[8][2] = {
+  { 1, 0 }, { 1, -1 }, { 0, -1 }, { -1, -1 },
+  { -1, 0 }, { -1, 1 }, { 0, 1 }, { 1, 1 }
+};
+
+/// @brief Bitset of the wall neighbors of a cell; see wallNeighborOffsets.
+inline unsigned wallNeighborBits(const MapGrid& map, int row, int col)
+{
+  unsigned bits = 0;
+  for (int i = 0; i < 8; i++) {
+    if (tileKindFor(map.at(row + wallNeighborOffsets[i][0],
+                           col + wallNeighborOffsets[i][1])) == TILE_WALL) {
+      bits |= 1u << i;
+    }
+  }
+  return bits;
+}
+
+/// @brief Number of walls, from 0 to 3, that shade one corner of a cell.
+///
+///   The corner is between the side neighbors at bits side and side + 2
+/// and the diagonal at bit side + 1.  Two side walls close off the corner
+/// whatever the diagonal holds, so that counts as fully shaded.
+/// @param [in] side An even bit index, 0, 2, 4 or 6.
+inline int cornerOcclusion(unsigned bits, int side)
+{
+  int a = (bits >> side) & 1;
+  int b = (bits >> ((side + 2) & 7)) & 1;
+  int d = (bits >> (side + 1)) & 1;
+  return (a && b) ? 3 : a + b + d;
+}
+
+namespace detail {
+
+/// @brief Appends lit quads to a BakedTerrain.
+class TerrainBakeWriter {
+public:
+  TerrainBakeWriter(const TerrainBakeParams& params, BakedTerrain& out)
+    : m_params(params), m_out(out)
+  {
+    const float* l = params.light;
+    float length = std::sqrt(l[0] * l[0] + l[1] * l[1] + l[2] * l[2]);
+    for (int i = 0; i < 3; i++) {
+      m_light[i] = length > 0 ? l[i] / length : 0;
+    }
+  }
+
+  /// @brief Add a quad as two triangles.
+  ///
+  ///   Corners are in winding order, each with its occlusion count.  The
+  /// quad is split along the diagonal whose ends are less different, so an
+  /// occluded corner shades a smooth gradient rather than a crease.
+  void quad(const float corners[4][3], const float normal[3],
+            const float color[3], const int occlusion[4])
+  {
+    float lambert = std::max(0.0f, normal[0] * m_light[0] +
+                                       normal[1] * m_light[1] +
+                                       normal[2] * m_light[2]);
+    float lit = m_params.ambient + m_params.diffuse * lambert;
+    uint8_t rgb[4][3];
+    for (int v = 0; v < 4; v++) {
+      float shade = lit * std::max(0.0f, 1.0f - m_params.occlusion * occlusion[v]);
+      for (int i = 0; i < 3; i++) {
+        float value = std::min(1.0f, color[i] * shade);
+        rgb[v][i] = static_cast<uint8_t>(value * 255.0f + 0.5f);
+      }
+    }
+
+    static const int split02[6] = { 0, 1, 2, 0, 2, 3 };
+    static const int split13[6] = { 0, 1, 3, 1, 2, 3 };
+    const int* order = (occlusion[0] + occlusion[2] > occlusion[1] + occlusion[3])
+                           ? split13 : split02;
+    for (int i = 0; i < 6; i++) {
+      int v = order[i];
+      m_out.positions.insert(m_out.positions.end(), corners[v], corners[v] + 3);
+      m_out.colors.insert(m_out.colors.end(), rgb[v], rgb[v] + 3);
+    }
+  }
+
+private:
+  const TerrainBakeParams& m_params;
+  BakedTerrain& m_out;
+  float m_light[3];
+};
+
+} // namespace detail
+
+/// @brief Build the lit triangles for a terrain grid.
+///
+///   Walls ('#') get their uncovered side faces and their top, shaded
+/// along the floor and in concave corners.  Floors ('.', '>' and the shop
+/// numbers) get one face each, shaded at the corners by the walls around
+/// them.  Touches no GL state, so it may run on any thread.
+inline void bakeTerrain(const MapGrid& terrain, const TerrainBakeParams& params,
+                        BakedTerrain& out)
+{
+  static const float grey[3] = { 0.8f, 0.8f, 0.8f };
+  static const float darkGrey[3] = { 0.52f, 0.52f, 0.51f };
+  static const float black[3] = { 0.0f, 0.0f, 0.0f };
+  static const float yellow[3] = { 1.0f, 1.0f, 0.0f };
+
+  out.positions.clear();
+  out.colors.clear();
+  out.cells = terrain.cells;
+  detail::TerrainBakeWriter writer(params, out);
+
+  const float h = params.halfSize;
+  for (int r = 0; r < terrain.height; r++) {
+    for (int c = 0; c < terrain.width; c++) {
+      char cell = terrain.cells[r * terrain.width + c];
+      const float x = params.spacing * r;
+      const float z = -params.spacing * c;
+      unsigned bits = wallNeighborBits(terrain, r, c);
+
+      if (cell == '#') {
+        // Side faces, as in MapGrid::wallFaceShown: +X, -X, +Z, -Z.  Each
+        // lists its corners bottom-left, bottom-right, top-right, top-left
+        // seen from outside, and the neighbor bits either side of the
+        // face's outward neighbor, which meet it in a concave corner.
+        static const float sides[4][4][3] = {
+          { { 1, -1, 1 }, { 1, -1, -1 }, { 1, 1, -1 }, { 1, 1, 1 } },
+          { { -1, -1, -1 }, { -1, -1, 1 }, { -1, 1, 1 }, { -1, 1, -1 } },
+          { { -1, -1, 1 }, { 1, -1, 1 }, { 1, 1, 1 }, { -1, 1, 1 } },
+          { { 1, -1, -1 }, { -1, -1, -1 }, { -1, 1, -1 }, { 1, 1, -1 } }
+        };
+        static const float normals[4][3] = {
+          { 1, 0, 0 }, { -1, 0, 0 }, { 0, 0, 1 }, { 0, 0, -1 }
+        };
+        static const int outward[4] = { 0, 4, 2, 6 };
+        for (int face = 0; face < 4; face++) {
+          if (!terrain.wallFaceShown(r, c, face)) {
+            continue;
+          }
+          // The diagonal neighbors next to the outward one are walls that
+          // stick out beside this face, at its first and second corners.
+          int o = outward[face];
+          int first = (bits >> ((o + 1) & 7)) & 1;
+          int second = (bits >> ((o + 7) & 7)) & 1;
+          float corners[4][3];
+          for (int v = 0; v < 4; v++) {
+            corners[v][0] = x + h * sides[face][v][0];
+            corners[v][1] = h * sides[face][v][1];
+            corners[v][2] = z + h * sides[face][v][2];
+          }
+          // The floor meets the bottom edge, and a wall beside the face
+          // closes the corner along the whole vertical edge.
+          int occlusion[4] = { 1 + first, 1 + second, second, first };
+          writer.quad(corners, normals[face], grey, occlusion);
+        }
+
+        static const float up[3] = { 0, 1, 0 };
+        static const int none[4] = { 0, 0, 0, 0 };
+        float top[4][3] = { { x + h, h, z + h }, { x + h, h, z - h },
+                            { x - h, h, z - h }, { x - h, h, z + h } };
+        writer.quad(top, up, grey, none);
+        continue;
+      }
+
+      const float* color = nullptr;
+      switch (cell) {
+      case '.':
+        color = darkGrey;
+        break;
+      case '>':
+        color = black;
+        break;
+      case '1':
+      case '2':
+      case '3':
+      case '4':
+      case '5':
+      case '6':
+      case '7':
+        color = yellow;
+        break;
+      default:
+        break;
+      }
+      if (!color) {
+        continue;
+      }
+
+      // Corners of the floor at +X+Z, +X-Z, -X-Z and -X+Z, which lie
+      // between neighbor bits 0/2, 6/0, 4/6 and 2/4.
+      static const float up[3] = { 0, 1, 0 };
+      float corners[4][3] = { { x + h, -h, z + h }, { x + h, -h, z - h },
+                              { x - h, -h, z - h }, { x - h, -h, z + h } };
+      int occlusion[4] = { cornerOcclusion(bits, 0), cornerOcclusion(bits, 6),
+                           cornerOcclusion(bits, 4), cornerOcclusion(bits, 2) };
+      writer.quad(corners, up, color, occlusion);
+    }
+  }
+}
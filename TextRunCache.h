@@ -0,0 +1,187 @@
+/** @file
+    @brief Layout of strings into glyph quads, and a cache of the laid-out
+           meshes of strings that have been drawn.  Kept free of OpenGL so
+           that the CPU side of drawing text can be benchmarked.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "FontQuads.h"
+
+// Standard includes
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// @brief Lay out a string at the origin, as the text renderers draw it.
+///
+///   The atlas gives FIRST_GLYPH, NUM_GLYPHS, glyphMetrics() (left, top,
+/// width and rows of each glyph, in pixels), glyphAdvances() and
+/// glyphTexCoords(index, st).  Characters that are not in the atlas are
+/// skipped.
+/// @param [out] vertices Six vertices for each glyph placed.
+template <typename Atlas>
+inline void layoutText(const Atlas& atlas, const char* text, float sx,
+                       float sy, int plane, std::vector<FontVertex>& vertices)
+{
+  vertices.resize(6 * std::strlen(text));
+  FontVertex* out = vertices.data();
+  float x = 0;
+  for (const char* p = text; *p; p++) {
+    int index = *p - Atlas::FIRST_GLYPH;
+    if (index < 0 || index >= Atlas::NUM_GLYPHS) {
+      continue;
+    }
+    const float* m = atlas.glyphMetrics() + 4 * index;
+    float st[4];
+    atlas.glyphTexCoords(index, st);
+    float left = m[0] * sx;
+    float top = m[1] * sy;
+    float w = m[2] * sx;
+    float h = m[3] * sy;
+
+    // Blend in the text, fully opaque (inverse alpha) and fully white.
+    switch (plane) {
+    case XY:
+      out = emitFontQuad<XY>(out, x + left, x + left + w, top - h, top,
+                             0, st[0], st[1], st[2], st[3], 1, 1, 1, 0);
+      break;
+    case XZ:
+      out = emitFontQuad<XZ>(out, x + left, x + left + w, top, top - h,
+                             0, st[0], st[1], st[2], st[3], 1, 1, 1, 0);
+      break;
+    case YZ:
+      out = emitFontQuad<YZ>(out, left + w, left, top - h, top,
+                             x, st[0], st[1], st[2], st[3], 1, 1, 1, 0);
+      break;
+    }
+
+    x += atlas.glyphAdvances()[index] * sx;
+  }
+  vertices.resize(out - vertices.data());
+}
+
+/// @brief Retained meshes of the strings that have been drawn, so that
+/// drawing one again costs a lookup rather than a layout and an upload.
+///
+///   Each run is laid out at the origin, to be moved into place when it is
+/// drawn.  Runs are keyed by their text, spacing and plane; there is only
+/// the one font.  Once the meshes pass the budget, the least recently drawn
+/// runs are dropped.  Storage says where the meshes are kept:
+///
+///     struct Storage {
+///       struct Run { ... };
+///       static void store(Run& run, const std::vector<FontVertex>& mesh);
+///       static void release(Run& run);
+///     };
+template <typename Atlas, typename Storage>
+class TextRunCache {
+public:
+  typedef typename Storage::Run Run;
+
+  size_t budget = 1 << 20;  ///< Bytes of meshes to keep
+
+  explicit TextRunCache(const Atlas& atlas) : atlas(atlas) {}
+
+  ~TextRunCache() { clear(); }
+
+  /// @brief The mesh of a string, laid out and stored if it is not cached.
+  /// Stays valid until the next call.
+  const Run& get(const char* text, float sx, float sy, int plane) {
+    key.assign(text);
+    key.append(reinterpret_cast<const char*>(&sx), sizeof(sx));
+    key.append(reinterpret_cast<const char*>(&sy), sizeof(sy));
+    key.append(reinterpret_cast<const char*>(&plane), sizeof(plane));
+    auto found = index.find(key);
+    if (found != index.end()) {
+      runs.splice(runs.begin(), runs, found->second);
+      hits++;
+      return found->second->run;
+    }
+    misses++;
+
+    layoutText(atlas, text, sx, sy, plane, vertices);
+    runs.push_front(Entry());
+    Entry& entry = runs.front();
+    entry.key = key;
+    entry.bytes = sizeof(FontVertex) * vertices.size();
+    Storage::store(entry.run, vertices);
+    index[key] = runs.begin();
+    bytes += entry.bytes;
+
+    // Drop the least recently drawn runs until the rest fit, keeping the
+    // one just made even if it is over the budget by itself.
+    while (bytes > budget && runs.size() > 1) {
+      drop(std::prev(runs.end()));
+      evictions++;
+    }
+    return runs.front().run;
+  }
+
+  /// @brief Drop every run.
+  void clear() {
+    while (!runs.empty()) {
+      drop(runs.begin());
+    }
+  }
+
+  size_t hitCount() const { return hits; }
+  size_t missCount() const { return misses; }
+
+  void printStats() const {
+    size_t lookups = hits + misses;
+    if (lookups == 0) {
+      return;
+    }
+    std::cerr << "Text runs: " << hits << " of " << lookups
+              << " strings found (" << 100.0 * hits / lookups
+              << "% hit rate), " << runs.size() << " kept in " << bytes
+              << " bytes, " << evictions << " dropped for space" << std::endl;
+  }
+
+private:
+  TextRunCache(const TextRunCache&) = delete;
+  TextRunCache& operator=(const TextRunCache&) = delete;
+
+  struct Entry {
+    std::string key;
+    Run run;
+    size_t bytes = 0;
+  };
+  typedef typename std::list<Entry>::iterator EntryIterator;
+
+  const Atlas& atlas;
+  std::list<Entry> runs;  ///< Most recently drawn first
+  std::unordered_map<std::string, EntryIterator> index;
+  std::string key;                  ///< Reused so lookups do not allocate
+  std::vector<FontVertex> vertices; ///< Reused for layout
+  size_t bytes = 0;                 ///< Size of the meshes of all runs
+  size_t hits = 0;
+  size_t misses = 0;
+  size_t evictions = 0;
+
+  void drop(EntryIterator entry) {
+    Storage::release(entry->run);
+    bytes -= entry->bytes;
+    index.erase(entry->key);
+    runs.erase(entry);
+  }
+};
@@ -0,0 +1,143 @@
+/** @file
+    @brief CPU encoder for RGTC1 (BC4) compressed single-channel textures,
+           used to store the baked glyph atlas at half the size of R8.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Standard includes
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+/// @brief Bytes taken by an RGTC1 image: eight per 4x4 block.
+inline size_t rgtc1Size(int width, int height)
+{
+  return static_cast<size_t>((width + 3) / 4) * ((height + 3) / 4) * 8;
+}
+
+/// @brief Encode a block against one pair of endpoints.
+///
+///   An RGTC1 block is two endpoint bytes and sixteen 3-bit indices into a
+/// palette made from them.  With red0 > red1 the palette is the endpoints
+/// and six steps between them; otherwise it is the endpoints, four steps
+/// between them, 0 and 255.  Each texel gets the nearest palette entry.
+/// @return The summed squared error of the block.
+inline uint32_t encodeRgtc1Endpoints(const uint8_t texels[16], int red0,
+                                     int red1, uint8_t out[8])
+{
+  int palette[8];
+  palette[0] = red0;
+  palette[1] = red1;
+  if (red0 > red1) {
+    for (int i = 1; i < 7; i++) {
+      palette[i + 1] = ((7 - i) * red0 + i * red1 + 3) / 7;
+    }
+  } else {
+    for (int i = 1; i < 5; i++) {
+      palette[i + 1] = ((5 - i) * red0 + i * red1 + 2) / 5;
+    }
+    palette[6] = 0;
+    palette[7] = 255;
+  }
+
+  uint64_t bits = 0;
+  uint32_t error = 0;
+  for (int t = 0; t < 16; t++) {
+    int best = 0;
+    int bestError = 256 * 256;
+    for (int i = 0; i < 8; i++) {
+      int d = texels[t] - palette[i];
+      if (d * d < bestError) {
+        bestError = d * d;
+        best = i;
+      }
+    }
+    bits |= static_cast<uint64_t>(best) << (3 * t);
+    error += bestError;
+  }
+  out[0] = static_cast<uint8_t>(red0);
+  out[1] = static_cast<uint8_t>(red1);
+  for (int i = 0; i < 6; i++) {
+    out[2 + i] = static_cast<uint8_t>(bits >> (8 * i));
+  }
+  return error;
+}
+
+/// @brief Encode one 4x4 block of texels, row-major.
+///
+///   Tries the eight-value palette spanning the whole block, and, when the
+/// block holds pure black or white, the six-value one spanning only the
+/// texels in between, since it gets 0 and 255 for free.  Antialiased glyph
+/// edges are mostly one or the other with a few greys.
+inline void encodeRgtc1Block(const uint8_t texels[16], uint8_t out[8])
+{
+  int lo = 255;
+  int hi = 0;
+  int innerLo = 255;
+  int innerHi = 0;
+  for (int t = 0; t < 16; t++) {
+    lo = std::min<int>(lo, texels[t]);
+    hi = std::max<int>(hi, texels[t]);
+    if (texels[t] != 0 && texels[t] != 255) {
+      innerLo = std::min<int>(innerLo, texels[t]);
+      innerHi = std::max<int>(innerHi, texels[t]);
+    }
+  }
+  if (lo == hi) {
+    encodeRgtc1Endpoints(texels, hi, lo, out);
+    return;
+  }
+  uint32_t error = encodeRgtc1Endpoints(texels, hi, lo, out);
+  if (error == 0 || (lo != 0 && hi != 255)) {
+    return;
+  }
+  if (innerLo > innerHi) {
+    // Only black and white.
+    innerLo = innerHi = 0;
+  }
+  uint8_t six[8];
+  if (encodeRgtc1Endpoints(texels, innerLo, innerHi, six) < error) {
+    std::copy(six, six + 8, out);
+  }
+}
+
+/// @brief Encode some rows of blocks of an 8-bit single-channel image.
+///
+/// Blocks that hang off the right or bottom edge repeat the last column or
+/// row.  Rows of blocks are independent, so they may be encoded by
+/// different threads.
+/// @param [out] blocks The whole image's blocks, rgtc1Size() bytes, of which
+///              rows [blockRowBegin, blockRowEnd) are written.
+inline void encodeRgtc1Rows(const uint8_t* pixels, int width, int height,
+                            int blockRowBegin, int blockRowEnd, uint8_t* blocks)
+{
+  int blocksWide = (width + 3) / 4;
+  uint8_t texels[16];
+  for (int by = blockRowBegin; by < blockRowEnd; by++) {
+    for (int bx = 0; bx < blocksWide; bx++) {
+      for (int r = 0; r < 4; r++) {
+        int y = std::min(4 * by + r, height - 1);
+        for (int c = 0; c < 4; c++) {
+          int x = std::min(4 * bx + c, width - 1);
+          texels[4 * r + c] = pixels[y * width + x];
+        }
+      }
+      encodeRgtc1Block(texels, blocks + 8 * (by * blocksWide + bx));
+    }
+  }
+}
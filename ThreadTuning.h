@@ -0,0 +1,228 @@
+/** @file
+    @brief Pinning threads to cores, real-time scheduling and locking memory,
+           for running the render loop on a box shared with busy processes.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+// Standard includes
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#endif
+
+/// @brief How threads should be placed and scheduled.  The defaults leave
+/// everything to the operating system.
+struct ThreadTuning {
+  enum Policy {
+    NORMAL,  ///< The default time-sharing scheduler
+    FIFO,    ///< SCHED_FIFO: run until blocked or preempted by higher priority
+    RR       ///< SCHED_RR: as FIFO, but round-robin among equal priorities
+  };
+
+  std::vector<int> renderCores;  ///< Cores for the render thread; empty for any
+  std::vector<int> workerCores;  ///< Cores for the other threads; empty for any
+  Policy policy = NORMAL;
+  int priority = 10;      ///< Of the render thread; workers get one less
+  bool lockMemory = false;
+
+  /// @brief Parse a list of cores such as "2,3,6-7".
+  /// @return False if the list is not well formed.
+  static bool parseCores(const char* text, std::vector<int>& cores) {
+    cores.clear();
+    const char* p = text;
+    while (*p) {
+      char* end;
+      long first = std::strtol(p, &end, 10);
+      if (end == p || first < 0) {
+        return false;
+      }
+      long last = first;
+      p = end;
+      if (*p == '-') {
+        last = std::strtol(p + 1, &end, 10);
+        if (end == p + 1 || last < first) {
+          return false;
+        }
+        p = end;
+      }
+      for (long c = first; c <= last; c++) {
+        cores.push_back(static_cast<int>(c));
+      }
+      if (*p == ',') {
+        p++;
+      } else if (*p) {
+        return false;
+      }
+    }
+    return !cores.empty();
+  }
+
+  /// @brief Parse "fifo" or "rr".
+  static bool parsePolicy(const char* text, Policy& policy) {
+    if (std::string("fifo") == text) {
+      policy = FIFO;
+    } else if (std::string("rr") == text) {
+      policy = RR;
+    } else {
+      return false;
+    }
+    return true;
+  }
+};
+
+/// @brief Write a message in one piece, since several threads may report
+/// at once.
+inline void reportThreadTuning(const std::string& message)
+{
+  std::cerr << message + "\n" << std::flush;
+}
+
+/// @brief Restrict the calling thread to a set of cores.
+/// @param [in] name Names the thread in any error message.
+/// @return True on success or if cores is empty, false with a message if
+///         the thread could not be pinned.
+inline bool pinThisThread(const std::vector<int>& cores, const char* name)
+{
+  if (cores.empty()) {
+    return true;
+  }
+#if defined(_WIN32)
+  DWORD_PTR mask = 0;
+  for (int c : cores) {
+    if (c < static_cast<int>(8 * sizeof(mask))) {
+      mask |= DWORD_PTR(1) << c;
+    }
+  }
+  if (mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0) {
+    return true;
+  }
+  std::ostringstream s;
+  s << "Could not pin the " << name << " thread: error " << GetLastError();
+  reportThreadTuning(s.str());
+  return false;
+#elif defined(__linux__)
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int c : cores) {
+    if (c < CPU_SETSIZE) {
+      CPU_SET(c, &set);
+    }
+  }
+  int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+  if (err == 0) {
+    return true;
+  }
+  reportThreadTuning(std::string("Could not pin the ") + name + " thread: " +
+                     std::strerror(err));
+  return false;
+#else
+  reportThreadTuning(std::string("Could not pin the ") + name +
+                     " thread: not supported here");
+  return false;
+#endif
+}
+
+/// @brief Move the calling thread to a real-time scheduling class.
+///
+///   Needs CAP_SYS_NICE, root or an RLIMIT_RTPRIO on Linux.  When that is
+/// not permitted the thread stays with the normal scheduler, which is the
+/// fallback: the caller carries on, just without the guarantee.
+/// @param [in] name Names the thread in any message.
+/// @return True on success or for NORMAL, false with a message otherwise.
+inline bool makeThisThreadRealtime(ThreadTuning::Policy policy, int priority,
+                                   const char* name)
+{
+  if (policy == ThreadTuning::NORMAL) {
+    return true;
+  }
+#ifdef _WIN32
+  // Windows has no per-thread FIFO or round-robin class; the highest
+  // priority in the process's class is the nearest thing.
+  (void)priority;
+  if (SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL)) {
+    return true;
+  }
+  std::ostringstream s;
+  s << "Could not raise the priority of the " << name << " thread: error "
+    << GetLastError();
+  reportThreadTuning(s.str());
+  return false;
+#else
+  int which = (policy == ThreadTuning::FIFO) ? SCHED_FIFO : SCHED_RR;
+  sched_param param;
+  std::memset(&param, 0, sizeof(param));
+  param.sched_priority = std::max(sched_get_priority_min(which),
+                                  std::min(priority, sched_get_priority_max(which)));
+  int err = pthread_setschedparam(pthread_self(), which, &param);
+  if (err == 0) {
+    return true;
+  }
+  std::ostringstream s;
+  s << "Could not give the " << name << " thread "
+    << (which == SCHED_FIFO ? "SCHED_FIFO" : "SCHED_RR") << " priority "
+    << param.sched_priority << " (" << std::strerror(err)
+    << "), leaving it on the normal scheduler";
+  reportThreadTuning(s.str());
+  return false;
+#endif
+}
+
+/// @brief Place and schedule the calling thread as a worker, that is, as
+/// any thread other than the render thread.
+inline void tuneWorkerThread(const ThreadTuning& tuning, const char* name)
+{
+  pinThisThread(tuning.workerCores, name);
+  makeThisThreadRealtime(tuning.policy, tuning.priority - 1, name);
+}
+
+/// @brief Lock every page the process has mapped into memory, so that the
+/// frame loop never waits for one to be paged back in.
+///
+///   Only the pages mapped so far are locked, so call this once everything
+/// the frame loop touches has been allocated.  Later mappings are left
+/// unlocked rather than risk allocations failing against RLIMIT_MEMLOCK.
+/// @return True on success, false with a message otherwise.
+inline bool lockProcessMemory()
+{
+#ifdef _WIN32
+  std::cerr << "Could not lock memory: not supported here" << std::endl;
+  return false;
+#else
+  if (mlockall(MCL_CURRENT) == 0) {
+    return true;
+  }
+  std::cerr << "Could not lock memory (" << std::strerror(errno)
+            << "), it may be paged out" << std::endl;
+  return false;
+#endif
+}
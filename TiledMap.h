@@ -0,0 +1,685 @@
+/** @file
+    @brief Tiled binary map format for worlds too large to read whole, and a
+           pager that keeps only the chunks around the viewer in memory.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#pragma once
+
+#include "MapGrid.h"
+#include "MapRecording.h"  // For the varints
+
+// Standard includes
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <string>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+/// @brief Shared file layout for TiledMapWriter and TiledMapFile.
+///
+///   An eight-byte magic number starts a 32-byte header holding the map
+/// size, the chunk size and the player cell.  An index follows with one
+/// 16-byte entry per chunk, row-major: the offset and size of the chunk's
+/// data and how it is encoded.  Each chunk is a square of chunkSize cells on
+/// a side, padded with blanks past the edge of the map, and is compressed
+/// on its own so that it can be read without touching any other: as
+/// (varint run length, cell) pairs, or as the raw cells when that would be
+/// smaller.  A chunk with no data is all blank, so sparse worlds cost
+/// nothing for their empty space.  Numbers are little-endian.
+class TiledMapFormat {
+public:
+  static const char* magic() { return "UMTILE1\n"; }
+  enum { HEADER_SIZE = 32, ENTRY_SIZE = 16 };
+  enum Encoding { RAW = 0, RUN_LENGTH = 1 };
+
+  struct Header {
+    int width = 0;
+    int height = 0;
+    int chunkSize = 0;
+    int playerRow = 0;
+    int playerCol = 0;
+  };
+
+  struct Entry {
+    uint64_t offset = 0;  ///< From the start of the file
+    uint32_t size = 0;    ///< Zero for a chunk that is all blank
+    uint32_t encoding = RAW;
+  };
+
+  static void put32(char* p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+      p[i] = static_cast<char>(v >> (8 * i));
+    }
+  }
+
+  static uint32_t get32(const char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; i++) {
+      v |= static_cast<uint32_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+    }
+    return v;
+  }
+
+  static void put64(char* p, uint64_t v) {
+    put32(p, static_cast<uint32_t>(v));
+    put32(p + 4, static_cast<uint32_t>(v >> 32));
+  }
+
+  static uint64_t get64(const char* p) {
+    return get32(p) | (static_cast<uint64_t>(get32(p + 4)) << 32);
+  }
+
+  /// @brief Compress one chunk's cells.
+  /// @return The encoding that was used.
+  static Encoding encodeChunk(const char* cells, size_t count, std::string& out) {
+    out.clear();
+    for (size_t i = 0; i < count;) {
+      size_t run = i + 1;
+      while (run < count && cells[run] == cells[i]) {
+        run++;
+      }
+      MapRecordingFormat::putVarint(out, run - i);
+      out.push_back(cells[i]);
+      if (out.size() >= count) {
+        out.assign(cells, count);
+        return RAW;
+      }
+      i = run;
+    }
+    return RUN_LENGTH;
+  }
+
+  /// @brief Expand one chunk's data into count cells.
+  /// @return True on success, false if the data is corrupt.
+  static bool decodeChunk(const char* p, size_t size, uint32_t encoding,
+                          char* cells, size_t count) {
+    const char* end = p + size;
+    if (size == 0) {
+      std::memset(cells, ' ', count);
+      return true;
+    }
+    if (encoding == RAW) {
+      if (size != count) {
+        return false;
+      }
+      std::memcpy(cells, p, count);
+      return true;
+    }
+    if (encoding != RUN_LENGTH) {
+      return false;
+    }
+    size_t i = 0;
+    while (i < count) {
+      uint64_t run;
+      if (!MapRecordingFormat::getVarint(p, end, run) || p >= end ||
+          run == 0 || run > count - i) {
+        return false;
+      }
+      std::memset(cells + i, *p++, static_cast<size_t>(run));
+      i += static_cast<size_t>(run);
+    }
+    return p == end;
+  }
+};
+
+/// @brief Writes a tiled map one chunk at a time, so that a world need not
+/// fit in memory to be written.
+///
+///   The header and index are written by close(), once the chunks are.
+class TiledMapWriter {
+public:
+  TiledMapWriter() {}
+  ~TiledMapWriter() { close(); }
+
+  /// @brief Start a map.  Chunks that are never written are left blank.
+  /// @return True on success, false if the file could not be created.
+  bool open(const std::string& fileName, int width, int height,
+            int chunkSize, int playerRow, int playerCol) {
+    close();
+    if (width <= 0 || height <= 0 || chunkSize <= 0) {
+      return false;
+    }
+    header.width = width;
+    header.height = height;
+    header.chunkSize = chunkSize;
+    header.playerRow = playerRow;
+    header.playerCol = playerCol;
+    chunkCols = (width + chunkSize - 1) / chunkSize;
+    chunkRows = (height + chunkSize - 1) / chunkSize;
+    entries.assign(static_cast<size_t>(chunkCols) * chunkRows,
+                   TiledMapFormat::Entry());
+    out.open(fileName.c_str(), std::ofstream::out | std::ofstream::binary |
+                                   std::ofstream::trunc);
+    if (!out.is_open()) {
+      return false;
+    }
+    // Room for the header and index, filled in by close().
+    std::string blank(TiledMapFormat::HEADER_SIZE +
+                          TiledMapFormat::ENTRY_SIZE * entries.size(), '\0');
+    out.write(blank.data(), blank.size());
+    nextOffset = blank.size();
+    return static_cast<bool>(out);
+  }
+
+  int rows() const { return chunkRows; }
+  int cols() const { return chunkCols; }
+
+  /// @brief Write one chunk, in any order.
+  /// @param [in] cells chunkSize * chunkSize cells, row-major.
+  bool writeChunk(int chunkRow, int chunkCol, const char* cells) {
+    if (!out.is_open() || chunkRow < 0 || chunkRow >= chunkRows ||
+        chunkCol < 0 || chunkCol >= chunkCols) {
+      return false;
+    }
+    size_t count = static_cast<size_t>(header.chunkSize) * header.chunkSize;
+    TiledMapFormat::Entry& entry = entries[chunkRow * chunkCols + chunkCol];
+    if (std::count(cells, cells + count, ' ') ==
+        static_cast<std::ptrdiff_t>(count)) {
+      entry = TiledMapFormat::Entry();
+      return true;
+    }
+    entry.encoding = TiledMapFormat::encodeChunk(cells, count, encoded);
+    entry.offset = nextOffset;
+    entry.size = static_cast<uint32_t>(encoded.size());
+    out.write(encoded.data(), encoded.size());
+    nextOffset += encoded.size();
+    return static_cast<bool>(out);
+  }
+
+  /// @brief Write the header and index and close the file.
+  /// @return True if everything was written.
+  bool close() {
+    if (!out.is_open()) {
+      return false;
+    }
+    std::string head(TiledMapFormat::HEADER_SIZE +
+                         TiledMapFormat::ENTRY_SIZE * entries.size(), '\0');
+    char* p = &head[0];
+    std::memcpy(p, TiledMapFormat::magic(), 8);
+    TiledMapFormat::put32(p + 8, header.width);
+    TiledMapFormat::put32(p + 12, header.height);
+    TiledMapFormat::put32(p + 16, header.chunkSize);
+    TiledMapFormat::put32(p + 20, header.playerRow);
+    TiledMapFormat::put32(p + 24, header.playerCol);
+    p += TiledMapFormat::HEADER_SIZE;
+    for (const TiledMapFormat::Entry& entry : entries) {
+      TiledMapFormat::put64(p, entry.offset);
+      TiledMapFormat::put32(p + 8, entry.size);
+      TiledMapFormat::put32(p + 12, entry.encoding);
+      p += TiledMapFormat::ENTRY_SIZE;
+    }
+    out.seekp(0);
+    out.write(head.data(), head.size());
+    bool ok = static_cast<bool>(out);
+    out.close();
+    return ok;
+  }
+
+  /// @brief Write a whole map that is already in memory.
+  static bool write(const std::string& fileName, const MapGrid& map,
+                    int chunkSize = 64) {
+    TiledMapWriter writer;
+    if (!writer.open(fileName, map.width, map.height, chunkSize,
+                     map.playerRow, map.playerCol)) {
+      return false;
+    }
+    std::vector<char> cells(static_cast<size_t>(chunkSize) * chunkSize);
+    for (int cr = 0; cr < writer.rows(); cr++) {
+      for (int cc = 0; cc < writer.cols(); cc++) {
+        for (int r = 0; r < chunkSize; r++) {
+          for (int c = 0; c < chunkSize; c++) {
+            char ch = map.at(cr * chunkSize + r, cc * chunkSize + c);
+            cells[r * chunkSize + c] = ch ? ch : ' ';
+          }
+        }
+        if (!writer.writeChunk(cr, cc, cells.data())) {
+          return false;
+        }
+      }
+    }
+    return writer.close();
+  }
+
+private:
+  TiledMapWriter(const TiledMapWriter&) = delete;
+  TiledMapWriter& operator=(const TiledMapWriter&) = delete;
+
+  std::ofstream out;
+  TiledMapFormat::Header header;
+  int chunkCols = 0;
+  int chunkRows = 0;
+  std::vector<TiledMapFormat::Entry> entries;
+  uint64_t nextOffset = 0;
+  std::string encoded;  ///< Reused by writeChunk()
+};
+
+/// @brief A tiled map opened for reading.
+///
+///   The file is memory-mapped rather than read, so only the pages of the
+/// chunks that are actually decoded are ever brought in.  Reading chunks
+/// does not change the object, so any number of threads may do it at once.
+class TiledMapFile {
+public:
+  TiledMapFile() {}
+  ~TiledMapFile() { close(); }
+
+  /// @brief Map a file and check its header and index.
+  /// @return True on success, false if it cannot be read or is not a
+  ///         tiled map.
+  bool open(const std::string& fileName) {
+    close();
+    if (!mapFile(fileName)) {
+      std::cerr << "TiledMapFile::open(): Could not map " << fileName
+                << std::endl;
+      return false;
+    }
+    if (size < TiledMapFormat::HEADER_SIZE ||
+        std::memcmp(data, TiledMapFormat::magic(), 8) != 0) {
+      std::cerr << "TiledMapFile::open(): " << fileName
+                << " is not a tiled map" << std::endl;
+      close();
+      return false;
+    }
+    header.width = static_cast<int>(TiledMapFormat::get32(data + 8));
+    header.height = static_cast<int>(TiledMapFormat::get32(data + 12));
+    header.chunkSize = static_cast<int>(TiledMapFormat::get32(data + 16));
+    header.playerRow = static_cast<int>(TiledMapFormat::get32(data + 20));
+    header.playerCol = static_cast<int>(TiledMapFormat::get32(data + 24));
+    if (header.width <= 0 || header.height <= 0 || header.chunkSize <= 0) {
+      std::cerr << "TiledMapFile::open(): Bad header in " << fileName
+                << std::endl;
+      close();
+      return false;
+    }
+    chunkCols = (header.width + header.chunkSize - 1) / header.chunkSize;
+    chunkRows = (header.height + header.chunkSize - 1) / header.chunkSize;
+    size_t chunks = static_cast<size_t>(chunkCols) * chunkRows;
+    if (size < TiledMapFormat::HEADER_SIZE + TiledMapFormat::ENTRY_SIZE * chunks) {
+      std::cerr << "TiledMapFile::open(): Truncated index in " << fileName
+                << std::endl;
+      close();
+      return false;
+    }
+    index.resize(chunks);
+    const char* p = data + TiledMapFormat::HEADER_SIZE;
+    for (TiledMapFormat::Entry& entry : index) {
+      entry.offset = TiledMapFormat::get64(p);
+      entry.size = TiledMapFormat::get32(p + 8);
+      entry.encoding = TiledMapFormat::get32(p + 12);
+      p += TiledMapFormat::ENTRY_SIZE;
+      if (entry.offset > size || entry.size > size - entry.offset) {
+        std::cerr << "TiledMapFile::open(): Chunk past the end of "
+                  << fileName << std::endl;
+        close();
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void close() {
+    unmapFile();
+    index.clear();
+    header = TiledMapFormat::Header();
+    chunkCols = chunkRows = 0;
+  }
+
+  bool isOpen() const { return data != nullptr; }
+  const TiledMapFormat::Header& info() const { return header; }
+  int rows() const { return chunkRows; }
+  int cols() const { return chunkCols; }
+
+  /// @brief Cells in one decoded chunk.
+  size_t chunkCells() const {
+    return static_cast<size_t>(header.chunkSize) * header.chunkSize;
+  }
+
+  /// @brief Decode one chunk.
+  /// @param [out] cells chunkCells() cells, row-major.
+  /// @return True on success, false if the chunk is out of range or corrupt.
+  bool readChunk(int chunkRow, int chunkCol, char* cells) const {
+    if (!isOpen() || chunkRow < 0 || chunkRow >= chunkRows || chunkCol < 0 ||
+        chunkCol >= chunkCols) {
+      return false;
+    }
+    const TiledMapFormat::Entry& entry = index[chunkRow * chunkCols + chunkCol];
+    return TiledMapFormat::decodeChunk(data + entry.offset, entry.size,
+                                       entry.encoding, cells, chunkCells());
+  }
+
+  /// @brief Tell the system that a chunk will be read soon, so that its
+  /// pages can be read in ahead of time.  Does nothing where that is not
+  /// supported.
+  void willNeed(int chunkRow, int chunkCol) const {
+#ifndef _WIN32
+    if (!isOpen() || chunkRow < 0 || chunkRow >= chunkRows || chunkCol < 0 ||
+        chunkCol >= chunkCols) {
+      return;
+    }
+    const TiledMapFormat::Entry& entry = index[chunkRow * chunkCols + chunkCol];
+    if (entry.size == 0) {
+      return;
+    }
+    // The range has to start on a page boundary.
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t start = static_cast<size_t>(entry.offset) / page * page;
+    posix_madvise(const_cast<char*>(data) + start,
+                  static_cast<size_t>(entry.offset) + entry.size - start,
+                  POSIX_MADV_WILLNEED);
+#else
+    (void)chunkRow;
+    (void)chunkCol;
+#endif
+  }
+
+private:
+  TiledMapFile(const TiledMapFile&) = delete;
+  TiledMapFile& operator=(const TiledMapFile&) = delete;
+
+  const char* data = nullptr;
+  size_t size = 0;
+  TiledMapFormat::Header header;
+  int chunkCols = 0;
+  int chunkRows = 0;
+  std::vector<TiledMapFormat::Entry> index;
+#ifdef _WIN32
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+#endif
+
+  bool mapFile(const std::string& fileName) {
+#ifdef _WIN32
+    file = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    LARGE_INTEGER fileSize;
+    if (file == INVALID_HANDLE_VALUE || !GetFileSizeEx(file, &fileSize) ||
+        fileSize.QuadPart == 0) {
+      unmapFile();
+      return false;
+    }
+    size = static_cast<size_t>(fileSize.QuadPart);
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping) {
+      data = static_cast<const char*>(
+          MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    }
+#else
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if (fd < 0) {
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0 && st.st_size > 0) {
+      size = static_cast<size_t>(st.st_size);
+      void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (p != MAP_FAILED) {
+        data = static_cast<const char*>(p);
+      }
+    }
+    // The mapping keeps the file open.
+    ::close(fd);
+#endif
+    if (!data) {
+      unmapFile();
+      return false;
+    }
+    return true;
+  }
+
+  void unmapFile() {
+#ifdef _WIN32
+    if (data) {
+      UnmapViewOfFile(data);
+    }
+    if (mapping) {
+      CloseHandle(mapping);
+      mapping = nullptr;
+    }
+    if (file != INVALID_HANDLE_VALUE) {
+      CloseHandle(file);
+      file = INVALID_HANDLE_VALUE;
+    }
+#else
+    if (data) {
+      munmap(const_cast<char*>(data), size);
+    }
+#endif
+    data = nullptr;
+    size = 0;
+  }
+};
+
+/// @brief Keeps the chunks of a TiledMapFile around a moving viewer decoded
+/// in memory, and builds the part of the map the renderers see from them.
+///
+///   Each update() wants the square of chunks within radius of the viewer's
+/// chunk, nearest first, and then the same square around where the viewer
+/// will be after lookAhead seconds at its current speed.  Chunks that are
+/// wanted and not resident are decoded, at most maxLoads per call so that a
+/// fast flight cannot stall a frame; prefetch chunks past that limit are
+/// only hinted to the system.  Once the decoded chunks pass the budget the
+/// least recently wanted are dropped.
+class MapPager {
+public:
+  size_t budget = 64 << 20;  ///< Bytes of decoded chunks to keep
+  int radius = 1;            ///< Chunks shown on each side of the viewer's
+  double lookAhead = 1.0;    ///< Seconds of travel to prefetch ahead
+  size_t maxLoads = 8;       ///< Chunks decoded per update() at most
+
+  MapPager() {}
+
+  /// @brief Page from a file, dropping any chunks of an earlier one.  The
+  /// file must stay open while the pager uses it.
+  void setFile(const TiledMapFile* tiledFile) {
+    file = tiledFile;
+    resident.clear();
+    residentBytes = 0;
+    haveViewer = false;
+  }
+
+  /// @brief Bring in the chunks around the viewer and ahead of it.
+  /// @param [in] row, col Viewer position in cells.  May be fractional or
+  ///             off the map.
+  /// @param [in] dt Seconds since the last call, used to find the speed.
+  void update(double row, double col, double dt) {
+    if (!file || !file->isOpen()) {
+      return;
+    }
+    if (haveViewer && dt > 0) {
+      // Smooth the speed so one jerky frame does not throw the prefetch
+      // to the wrong side.
+      double blend = std::min(1.0, dt * 4);
+      rowSpeed += blend * ((row - viewerRow) / dt - rowSpeed);
+      colSpeed += blend * ((col - viewerCol) / dt - colSpeed);
+    }
+    viewerRow = row;
+    viewerCol = col;
+    haveViewer = true;
+    tick++;
+
+    int size = file->info().chunkSize;
+    centerRow = static_cast<int>(std::floor(row / size));
+    centerCol = static_cast<int>(std::floor(col / size));
+    int aheadRow = static_cast<int>(std::floor((row + rowSpeed * lookAhead) / size));
+    int aheadCol = static_cast<int>(std::floor((col + colSpeed * lookAhead) / size));
+
+    size_t loads = 0;
+    wantSquare(centerRow, centerCol, false, loads);
+    if (aheadRow != centerRow || aheadCol != centerCol) {
+      wantSquare(aheadRow, aheadCol, true, loads);
+    }
+  }
+
+  /// @brief Fill a map with the square of chunks around the viewer, as of
+  /// the last update().  Only resident chunks are read; the rest are left
+  /// blank until they are paged in.  The window moves a whole chunk at a
+  /// time and is always the same size, so the renderers see a map that
+  /// changes only when the viewer crosses into another chunk.
+  void fillWindow(MapGrid& out) {
+    out.width = out.height = 0;
+    out.cells.clear();
+    if (!file || !file->isOpen()) {
+      return;
+    }
+    int size = file->info().chunkSize;
+    int span = 2 * radius + 1;
+    int row0 = (centerRow - radius) * size;
+    int col0 = (centerCol - radius) * size;
+    out.width = out.height = span * size;
+    out.cells.assign(static_cast<size_t>(out.width) * out.height, ' ');
+    // Keep the map where it is in the world as the window moves over it.
+    out.playerRow = file->info().playerRow - row0;
+    out.playerCol = file->info().playerCol - col0;
+
+    for (int cr = 0; cr < span; cr++) {
+      for (int cc = 0; cc < span; cc++) {
+        int chunkRow = centerRow - radius + cr;
+        int chunkCol = centerCol - radius + cc;
+        if (!onMap(chunkRow, chunkCol)) {
+          continue;
+        }
+        auto it = resident.find(chunkIndex(chunkRow, chunkCol));
+        if (it == resident.end()) {
+          missing++;
+          continue;
+        }
+        const char* src = it->second.cells.data();
+        for (int r = 0; r < size; r++) {
+          std::memcpy(&out.cells[(cr * size + r) * out.width + cc * size],
+                      src + r * size, size);
+        }
+      }
+    }
+  }
+
+  /// @brief Report how the paging went.
+  void printStats() const {
+    std::cerr << "Map pager: " << loads << " chunks loaded (" << prefetches
+              << " ahead of the viewer), " << evictions << " dropped, "
+              << resident.size() << " resident in " << residentBytes
+              << " bytes, " << missing << " shown before they were loaded"
+              << std::endl;
+  }
+
+private:
+  MapPager(const MapPager&) = delete;
+  MapPager& operator=(const MapPager&) = delete;
+
+  struct Chunk {
+    std::vector<char> cells;
+    uint64_t lastWanted = 0;
+  };
+
+  const TiledMapFile* file = nullptr;
+  std::map<size_t, Chunk> resident;
+  size_t residentBytes = 0;
+  uint64_t tick = 0;  ///< Counts update() calls
+  bool haveViewer = false;
+  double viewerRow = 0;
+  double viewerCol = 0;
+  double rowSpeed = 0;  ///< Cells per second
+  double colSpeed = 0;
+  int centerRow = 0;    ///< Chunk holding the viewer
+  int centerCol = 0;
+  size_t loads = 0;
+  size_t prefetches = 0;
+  size_t evictions = 0;
+  size_t missing = 0;
+
+  bool onMap(int chunkRow, int chunkCol) const {
+    return chunkRow >= 0 && chunkRow < file->rows() && chunkCol >= 0 &&
+           chunkCol < file->cols();
+  }
+
+  size_t chunkIndex(int chunkRow, int chunkCol) const {
+    return static_cast<size_t>(chunkRow) * file->cols() + chunkCol;
+  }
+
+  /// @brief Want the square of chunks around one, nearest first.
+  void wantSquare(int row, int col, bool ahead, size_t& loadsThisUpdate) {
+    for (int ring = 0; ring <= radius; ring++) {
+      for (int r = row - ring; r <= row + ring; r++) {
+        for (int c = col - ring; c <= col + ring; c++) {
+          if (std::max(std::abs(r - row), std::abs(c - col)) != ring ||
+              !onMap(r, c)) {
+            continue;
+          }
+          auto it = resident.find(chunkIndex(r, c));
+          if (it != resident.end()) {
+            it->second.lastWanted = tick;
+          } else if (loadsThisUpdate < maxLoads && load(r, c)) {
+            loadsThisUpdate++;
+            prefetches += ahead ? 1 : 0;
+          } else if (ahead) {
+            file->willNeed(r, c);
+          }
+        }
+      }
+    }
+  }
+
+  /// @brief Decode a chunk, making room for it first.
+  /// @return True if it was loaded.
+  bool load(int chunkRow, int chunkCol) {
+    size_t bytes = file->chunkCells();
+    while (residentBytes + bytes > budget) {
+      // Drop the least recently wanted chunk, but never one wanted now.
+      auto oldest = resident.end();
+      for (auto it = resident.begin(); it != resident.end(); ++it) {
+        if (it->second.lastWanted < tick &&
+            (oldest == resident.end() ||
+             it->second.lastWanted < oldest->second.lastWanted)) {
+          oldest = it;
+        }
+      }
+      if (oldest == resident.end()) {
+        return false;
+      }
+      residentBytes -= oldest->second.cells.size();
+      resident.erase(oldest);
+      evictions++;
+    }
+    Chunk& chunk = resident[chunkIndex(chunkRow, chunkCol)];
+    chunk.cells.resize(bytes);
+    if (!file->readChunk(chunkRow, chunkCol, chunk.cells.data())) {
+      std::cerr << "MapPager: Could not read chunk " << chunkRow << ", "
+                << chunkCol << std::endl;
+      std::fill(chunk.cells.begin(), chunk.cells.end(), ' ');
+    }
+    chunk.lastWanted = tick;
+    residentBytes += bytes;
+    loads++;
+    return true;
+  }
+};
@@ -0,0 +1,173 @@
+/** @file
+    @brief Command-line tool that writes synthetic umoria-style maps, and
+           optionally keeps changing them, to stress the map renderers.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "DungeonGenerator.h"
+#include "TiledMap.h"
+
+// Standard includes
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h> // For exit()
+#include <string>
+#include <thread>
+
+void Usage(std::string name)
+{
+    std::cerr << "Usage: " << name << " [-size W H] [-rooms N] [-walls D]"
+              << " [-actors N] [-mutation R] [-seed S] [-turns N]"
+              << " [-interval MS] [-numbered] [-tiled N] OUTPUT" << std::endl;
+    std::cerr << "  -size: Map width and height in cells (default 256 256)"
+              << std::endl;
+    std::cerr << "  -rooms: Rooms to place (default 32)" << std::endl;
+    std::cerr << "  -walls: Fraction of the floor turned into pillars (default 0.05)"
+              << std::endl;
+    std::cerr << "  -actors: Monsters on the map (default 64)" << std::endl;
+    std::cerr << "  -mutation: Fraction of cells changed per turn (default 0.001)"
+              << std::endl;
+    std::cerr << "  -seed: Random seed (default 1)" << std::endl;
+    std::cerr << "  -turns: Turns to play after writing the first map (default 0)"
+              << std::endl;
+    std::cerr << "  -interval: Rewrite OUTPUT every MS milliseconds, one turn each"
+              << std::endl;
+    std::cerr << "  -numbered: Write turn N to OUTPUT.N instead of rewriting OUTPUT"
+              << std::endl;
+    std::cerr << "  -tiled: Write tiled maps with N by N cell chunks, not text"
+              << std::endl;
+    exit(-1);
+}
+
+/// @brief Write a map so that a reader never sees half of it.
+///
+/// The map goes to a temporary file that is then renamed over the output,
+/// since the fly example re-reads its map file every frame.
+/// @param [in] tiledChunk Chunk size to write a tiled map with, or zero to
+///             write text.
+static bool writeMap(const std::string& fileName, const DungeonGenerator& dungeon,
+                     int tiledChunk)
+{
+    std::string temp = fileName + ".tmp";
+    if (tiledChunk > 0) {
+        if (!TiledMapWriter::write(temp, dungeon.map(), tiledChunk)) {
+            return false;
+        }
+    } else {
+        std::ofstream out(temp.c_str(), std::ofstream::out | std::ofstream::binary);
+        if (!out.is_open()) {
+            return false;
+        }
+        out << dungeon.text();
+        if (!out) {
+            return false;
+        }
+    }
+#ifdef _WIN32
+    // rename() will not replace an existing file on Windows.
+    std::remove(fileName.c_str());
+#endif
+    return std::rename(temp.c_str(), fileName.c_str()) == 0;
+}
+
+int main(int argc, char* argv[])
+{
+    DungeonParams params;
+    int turns = 0;
+    int intervalMs = 0;
+    bool numbered = false;
+    int tiledChunk = 0;
+    std::string output;
+
+    // Parse the command line
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-size" && i + 2 < argc) {
+            params.width = atoi(argv[++i]);
+            params.height = atoi(argv[++i]);
+        } else if (arg == "-rooms" && i + 1 < argc) {
+            params.rooms = atoi(argv[++i]);
+        } else if (arg == "-walls" && i + 1 < argc) {
+            params.wallDensity = static_cast<float>(atof(argv[++i]));
+        } else if (arg == "-actors" && i + 1 < argc) {
+            params.actors = atoi(argv[++i]);
+        } else if (arg == "-mutation" && i + 1 < argc) {
+            params.mutationRate = static_cast<float>(atof(argv[++i]));
+        } else if (arg == "-seed" && i + 1 < argc) {
+            params.seed = static_cast<unsigned>(strtoul(argv[++i], nullptr, 10));
+        } else if (arg == "-turns" && i + 1 < argc) {
+            turns = atoi(argv[++i]);
+        } else if (arg == "-interval" && i + 1 < argc) {
+            intervalMs = atoi(argv[++i]);
+        } else if (arg == "-numbered") {
+            numbered = true;
+        } else if (arg == "-tiled" && i + 1 < argc) {
+            tiledChunk = atoi(argv[++i]);
+            if (tiledChunk <= 0) {
+                Usage(argv[0]);
+            }
+        } else if (arg[0] != '-' && output.empty()) {
+            output = arg;
+        } else {
+            Usage(argv[0]);
+        }
+    }
+    if (output.empty() || params.width <= 0 || params.height <= 0 ||
+        turns < 0 || intervalMs < 0) {
+        Usage(argv[0]);
+    }
+
+    DungeonGenerator dungeon(params);
+    if (!writeMap(output, dungeon, tiledChunk)) {
+        perror(output.c_str());
+        return 1;
+    }
+
+    // Play the turns, keeping to the interval from the start so that time
+    // spent writing does not make the sequence drift.
+    size_t changed = 0;
+    auto next = std::chrono::steady_clock::now();
+    for (int turn = 1; turn <= turns; turn++) {
+        changed += dungeon.step();
+        std::string fileName = output;
+        if (numbered) {
+            std::ostringstream name;
+            name << output << "." << turn;
+            fileName = name.str();
+        }
+        if (intervalMs > 0) {
+            next += std::chrono::milliseconds(intervalMs);
+            std::this_thread::sleep_until(next);
+        }
+        if (!writeMap(fileName, dungeon, tiledChunk)) {
+            perror(fileName.c_str());
+            return 1;
+        }
+    }
+
+    std::cerr << "Wrote " << dungeon.map().width << "x" << dungeon.map().height
+              << " map to " << output;
+    if (turns > 0) {
+        std::cerr << " and played " << turns << " turns, "
+                  << static_cast<double>(changed) / turns
+                  << " cells changed per turn";
+    }
+    std::cerr << std::endl;
+    return 0;
+}
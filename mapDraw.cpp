@@ -24,6 +24,9 @@
 // limitations under the License.
 
 // Internal Includes
+#include "FlightRecorder.h"
+#include "MapGrid.h"
+#include "TerrainBake.h"
 #include <osvr/ClientKit/Context.h>
 #include <osvr/ClientKit/Interface.h>
 #include <osvr/RenderKit/RenderManager.h>
@@ -41,21 +44,23 @@
 #endif
 
 // Standard includes
+#include <atomic>
 #include <iostream>
 #include <string>
+#include <thread>
 #include <stdlib.h> // For exit()
 
-#include <fstream>  //for parsing text file
-
 // This must come after we include <GL/gl.h> so its pointer types are defined.
 #include <osvr/RenderKit/GraphicsLibraryOpenGL.h>
 
 // Forward declarations of rendering functions defined below.
 void draw_cube(double radius, float color[]);
 // void draw_room(double radius);
-void draw_floor(double radius, float color[]);
 void draw_hallway(double radius);
-void draw_pound(double radius);
+void compileBakedTerrain(const BakedTerrain& baked);
+void buildActorCubes(const MapActors& actors);
+void drawActorCubes();
+void compileTerrain();
 
 // Set to true when it is time for the application to quit.
 // Handlers below that set it to true when the user causes
@@ -63,6 +68,38 @@ void draw_pound(double radius);
 // cleanly.  This only works on Windows, but so does D3D...
 static bool quit = false;
 
+// The map is split into static terrain, which is compiled into a display
+// list that is only rebuilt when the terrain changes, and the actors on
+// it, whose cubes are rebuilt into one vertex array when they move and
+// drawn with a single call each frame.
+static MapGrid g_map;
+static MapGrid g_terrain;
+static MapActors g_actors;
+static std::vector<char> g_listedTerrain;  ///< Terrain in g_terrainList
+static GLuint g_terrainList = 0;
+static MapActors g_cubedActors;            ///< Actors in the arrays below
+static std::vector<GLfloat> g_actorPositions;  ///< x, y, z per vertex
+static std::vector<GLfloat> g_actorNormals;    ///< x, y, z per vertex
+static std::vector<uint32_t> g_actorColors;    ///< Packed RGBA per vertex
+
+// The terrain's lighting and ambient occlusion are baked into its vertex
+// colors on a worker thread whenever it changes, and it is drawn unlit.
+// The old display list is kept until the new bake is ready.
+static MapGrid g_bakeInput;          ///< Terrain the worker is baking
+static BakedTerrain g_baked;         ///< Written by the worker only
+static std::thread g_bakeThread;
+static std::atomic<bool> g_bakeDone(false);
+static FlightRecorder::Clock::time_point g_bakeStart;  ///< Set by the worker
+static FlightRecorder::Clock::time_point g_bakeEnd;    ///< Set by the worker
+
+// Always on: keeps the timings and events of the last few thousand frames,
+// and writes the seconds before a frame-time spike to a trace file.
+static FlightRecorder g_flightRecorder;
+
+// Count every allocation, for the flight recorder.
+void* operator new(std::size_t size) { return countedAllocate(size); }
+void operator delete(void* p) noexcept { std::free(p); }
+
 #ifdef _WIN32
 // Note: On Windows, this runs in a different thread from
 // the main application.
@@ -222,167 +259,47 @@ void DrawWorld(
     // change view to middle of room
     glTranslated(-10, 0, 10);
 
-
-    //colors
-    static float black_col[] = {0.0, 0.0, 0.0};
-    static float red_col[] = {1.0, 0.0, 0.0};
-    static float grn_col[] = {0.0, 1.0, 0.0};
-    static float blu_col[] = {0.0, 0.0, 1.0};
-    static float yel_col[] = {1.0, 1.0, 0.0};
-    static float lightblu_col[] = {0.0, 1.0, 1.0};
-    static float pur_col[] = {1.0, 0.0, 1.0};
-    static float grey[] = {0.8, 0.8, 0.8};
-    static float darkGrey[] = {0.52, 0.52, 0.51};
-
-
-    //open text file and parse one char at a time, 
-    //carriage return at every newline
-    std::ifstream ifs;
-    // std::cerr << "attempting to open text file\n";
-    ifs.open ("test.txt", std::ifstream::in);
-    if (ifs.is_open()) {
-        // std::cerr << "opened file\n";
-    } else {
+    // Read the map and split off the actors.
+    FlightRecorder::Clock::time_point loadStart = FlightRecorder::Clock::now();
+    if (!g_map.load("test.txt")) {
         std::cerr << "could not open file\n";
-        perror("file.txt ");  
+        perror("test.txt ");
         exit(1);
     }
-
-    char c;
-    // int playerX = 0;
-    // int playerZ = 0;
-    // while (ifs.get(c)) {  //get coords for @
-    //     char curr = c;
-    //     if (curr == '@') {
-    //         break;
-    //     } 
-    //     else if (curr == '\n') {
-    //         playerX += 1;
-    //         playerZ = 0;
-    //     } else {
-    //         playerZ += 1;
-    //     }
-    // }
-    // playerX = 0 - playerX;
-    // //translate around @
-    // std::cerr << "translating X:";
-    // std::cerr << playerX;
-    // std::cerr << "\n";
-    // std::cerr << "translating Z:";
-    // std::cerr << playerZ;
-    // std::cerr << "\n";
-    // glTranslated((playerX*5), 0, (playerZ*10));
-
-    int i = 0;
-    while (ifs.get(c)) {         // loop rendering characters
-        // std::cerr << c;
-        char curr = c;
-        switch(curr) {
-            case '#':
-                // std::cerr << "rendering wall";
-                draw_pound(5.0);
-                break;
-            case '.':
-                // std::cerr << "rendering floor";
-                draw_floor(5.0, darkGrey);
-                break;
-            case 'c':
-                // std::cerr << "rendering monster";
-                draw_floor(5.0, darkGrey);
-                glTranslated(0, -4, 0);
-                draw_cube(1.0, pur_col);
-                glTranslated(0, 4, 0);
-                break;
-            case 'p':
-                // std::cerr << "rendering monster";
-                draw_floor(5.0, darkGrey);
-                glTranslated(0, -4, 0);
-                draw_cube(1.0, red_col);
-                glTranslated(0, 4, 0);
-                break;
-            case 'r':
-                // std::cerr << "rendering monster";
-                draw_floor(5.0, darkGrey);
-                glTranslated(0, -4, 0);
-                draw_cube(1.0, blu_col);
-                glTranslated(0, 4, 0);
-                break;
-            case '>':
-                draw_floor(5.0, black_col);
-                break;
-            case '@':
-                draw_floor(5.0, grn_col);
-                break;
-            case '1':
-                draw_floor(5.0, yel_col);
-                break;
-            case '2':
-                draw_floor(5.0, yel_col);
-                break;
-            case '3':
-                draw_floor(5.0, yel_col);
-                break;
-            case '4':
-                draw_floor(5.0, yel_col);
-                break;
-            case '5':
-                draw_floor(5.0, yel_col);
-                break;
-            case '6':
-                draw_floor(5.0, yel_col);
-                break;
-            case '7':
-                draw_floor(5.0, yel_col);
-                break;
-
-        }
-        if (c =='\n') {
-            glTranslated(10, 0, (i*10));
-            i = 0;
-        } else {
-            glTranslated(0, 0, -10);
-            i += 1;
+    splitMapLayers(g_map, g_terrain, g_actors);
+    g_flightRecorder.phase("load map", loadStart, FlightRecorder::Clock::now());
+
+    // Rebuild the terrain display list only when the terrain itself has
+    // changed, which actors moving around on it never do.  The baking is
+    // done off this thread; only the very first frame waits for it.
+    if (g_bakeThread.joinable() && (g_bakeDone || !g_terrainList)) {
+        g_bakeThread.join();
+        compileTerrain();
+    }
+    if (!g_bakeThread.joinable() && g_terrain.cells != g_listedTerrain) {
+        g_flightRecorder.mark("terrain changed");
+        g_bakeInput = g_terrain;
+        g_bakeDone = false;
+        g_bakeThread = std::thread([] {
+            g_bakeStart = FlightRecorder::Clock::now();
+            bakeTerrain(g_bakeInput, TerrainBakeParams(), g_baked);
+            g_bakeEnd = FlightRecorder::Clock::now();
+            g_bakeDone = true;
+        });
+        if (!g_terrainList) {
+            g_bakeThread.join();
+            compileTerrain();
         }
-        
     }
-    ifs.close();                // close file
-    
-    
-    // //map array
-    // int map[4][4] = {{'#', '#', '#', '#'},
-    //                  {'#', '.', '.', '#'},
-    //                  {'#', '.', 'c', '#'},
-    //                  {'#', '#', '#', '#'}};
+    glCallList(g_terrainList);
 
+    // Each actor is a small cube in its own color, floating over the floor.
+    if (g_actors != g_cubedActors) {
+        buildActorCubes(g_actors);
+    }
+    drawActorCubes();
     
-
-    // //draw map
-    // for (int i=0; i<4; i++) {
-    //     for (int j=0; j<4; j++) {
-    //         switch(map[i][j]) {
-    //             case '#':
-    //                 draw_pound(5.0);
-    //                 break;
-    //             case '.':
-    //                 draw_floor(5.0);
-    //                 break;
-    //             case 'c':
-    //                 draw_floor(5.0);
-    //                 draw_cube(1.0);
-    //                 break;
-    //             default:
-    //                 break;
-    //         }
-    //         if (j == 3) {
-    //             glTranslated(10, 0, 30);
-    //         } else {
-    //             glTranslated(0, 0, -10);
-    //         }
-    //     }
-    // }
     
-   
-
     //draw hallway
     // draw_hallway(5.0);
     // glTranslated(0, 0, -10);
@@ -402,9 +319,6 @@ void DrawWorld(
     /// Draw a cube with a 5-meter radius as the room we are floating in.
     // draw_cube(5.0);
 
-    //draw floor
-    // draw_floor(5.0);
-
     // Draw another cube 1 meter along the -Z axis
     // glTranslated(0, 0, -1);
     // draw_cube(0.1);
@@ -541,7 +455,12 @@ void DrawRightHand(
 }
 
 void Usage(std::string name) {
-    std::cerr << "Usage: " << name << " [-IPD value_in_meters]" << std::endl;
+    std::cerr << "Usage: " << name << " [-IPD value_in_meters]"
+              << " [-flightSpike X] [-flightTrace PREFIX]" << std::endl;
+    std::cerr << "  -flightSpike: Write a trace when a frame takes this many times"
+              << " the median (default 3)" << std::endl;
+    std::cerr << "  -flightTrace: Write traces to PREFIX-N.json (default flight)"
+              << std::endl;
     exit(-1);
 }
 
@@ -556,6 +475,16 @@ int main(int argc, char* argv[]) {
                 Usage(argv[0]);
             }
             IPDMeters = atof(argv[i]);
+        } else if (std::string("-flightSpike") == argv[i]) {
+            if (++i >= argc || atof(argv[i]) <= 1) {
+                Usage(argv[0]);
+            }
+            g_flightRecorder.spikeFactor = atof(argv[i]);
+        } else if (std::string("-flightTrace") == argv[i]) {
+            if (++i >= argc) {
+                Usage(argv[0]);
+            }
+            g_flightRecorder.prefix = argv[i];
         } else if (argv[i][0] == '-') {
             Usage(argv[0]);
         } else
@@ -633,9 +562,16 @@ int main(int argc, char* argv[]) {
 
     // Continue rendering until it is time to quit.
     while (!quit) {
+        FlightRecorder::Clock::time_point frameStart =
+            FlightRecorder::Clock::now();
+        uint64_t allocations = allocationCount().load(std::memory_order_relaxed);
+
         // Update the context so we get our callbacks called and
         // update tracker state.
         context.update();
+        FlightRecorder::Clock::time_point renderStart =
+            FlightRecorder::Clock::now();
+        g_flightRecorder.phase("update", frameStart, renderStart);
 
         osvr::renderkit::RenderManager::RenderParams params;
         params.IPDMeters = IPDMeters;
@@ -645,44 +581,123 @@ int main(int argc, char* argv[]) {
                 << std::endl;
             quit = true;
         }
+
+        // Leave evidence of every stall in the flight recorder.
+        FlightRecorder::Clock::time_point frameEnd = FlightRecorder::Clock::now();
+        g_flightRecorder.phase("render", renderStart, frameEnd);
+        g_flightRecorder.counter("allocations",
+            allocationCount().load(std::memory_order_relaxed) - allocations,
+            frameEnd);
+        g_flightRecorder.frame(frameStart, frameEnd);
     }
+    g_flightRecorder.stop();
+    g_flightRecorder.printStats(std::cerr);
 
     // Close the Renderer interface cleanly.
+    if (g_bakeThread.joinable()) {
+        g_bakeThread.join();
+    }
     delete render;
 
     return 0;
 }
 
+// Compile the terrain the worker has baked, and record how long the bake
+// and the compile took.
+void compileTerrain() {
+    g_flightRecorder.phase("bake terrain", g_bakeStart, g_bakeEnd, 1);
+    FlightRecorder::Clock::time_point compileStart = FlightRecorder::Clock::now();
+    compileBakedTerrain(g_baked);
+    g_listedTerrain = g_baked.cells;
+    g_flightRecorder.phase("compile terrain", compileStart,
+                           FlightRecorder::Clock::now());
+}
+
+// Compile baked terrain into g_terrainList.  The lighting is already in
+// the vertex colors, so it is drawn with lighting off.
+void compileBakedTerrain(const BakedTerrain& baked) {
+    if (!g_terrainList) {
+        g_terrainList = glGenLists(1);
+    }
+    glNewList(g_terrainList, GL_COMPILE);
+    glPushAttrib(GL_LIGHTING_BIT);
+    glDisable(GL_LIGHTING);
+    if (baked.vertexCount() > 0) {
+        glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+        glEnableClientState(GL_VERTEX_ARRAY);
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, &baked.positions[0]);
+        glColorPointer(3, GL_UNSIGNED_BYTE, 0, &baked.colors[0]);
+        glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(baked.vertexCount()));
+        glPopClientAttrib();
+    }
+    glPopAttrib();
+    glEndList();
+}
+
 static GLfloat matspec[4] = {0.5, 0.5, 0.5, 0.0};
-static float black_col[] = {0.0, 0.0, 0.0};
-static float red_col[] = {1.0, 0.0, 0.0};
-static float grn_col[] = {0.0, 1.0, 0.0};
-static float blu_col[] = {0.0, 0.0, 1.0};
-static float yel_col[] = {1.0, 1.0, 0.0};
-static float lightblu_col[] = {0.0, 1.0, 1.0};
-static float pur_col[] = {1.0, 0.0, 1.0};
-static float grey[] = {0.8, 0.8, 0.8};
-static float darkGrey[] = {0.52, 0.52, 0.51};
 
-void draw_floor(double radius, float color[]) {
-    glPushMatrix();
-    glScaled(radius, radius, radius);
+// Build the cubes of all of the actors into the actor vertex arrays.  Each
+// is a cube of radius 1 over the actor's cell, with the faces of draw_cube().
+void buildActorCubes(const MapActors& actors) {
+    // For each face, its normal and its four corners in draw_cube() order.
+    static const GLfloat faces[6][5][3] = {
+        { {0, 0, -1}, {1, 1, -1}, {1, -1, -1}, {-1, -1, -1}, {-1, 1, -1} },
+        { {0, 0, 1}, {-1, 1, 1}, {-1, -1, 1}, {1, -1, 1}, {1, 1, 1} },
+        { {0, -1, 0}, {1, -1, 1}, {-1, -1, 1}, {-1, -1, -1}, {1, -1, -1} },
+        { {0, 1, 0}, {1, 1, 1}, {1, 1, -1}, {-1, 1, -1}, {-1, 1, 1} },
+        { {-1, 0, 0}, {-1, 1, 1}, {-1, 1, -1}, {-1, -1, -1}, {-1, -1, 1} },
+        { {1, 0, 0}, {1, -1, 1}, {1, -1, -1}, {1, 1, -1}, {1, 1, 1} } };
+    // Each face is split into two triangles.
+    static const int corners[6] = { 1, 2, 3, 1, 3, 4 };
+
+    size_t vertices = 36 * actors.size();
+    g_actorPositions.resize(3 * vertices);
+    g_actorNormals.resize(3 * vertices);
+    g_actorColors.resize(vertices);
+    GLfloat* position = g_actorPositions.data();
+    GLfloat* normal = g_actorNormals.data();
+    uint32_t* color = g_actorColors.data();
+    for (size_t i = 0; i < actors.size(); i++) {
+        GLfloat center[3] = { 10 * actors.x[i], -4, -10 * actors.z[i] };
+        for (int f = 0; f < 6; f++) {
+            for (int v = 0; v < 6; v++) {
+                for (int k = 0; k < 3; k++) {
+                    *position++ = center[k] + faces[f][corners[v]][k];
+                    *normal++ = faces[f][0][k];
+                }
+                *color++ = actors.color[i];
+            }
+        }
+    }
+    g_cubedActors = actors;
+}
+
+// Draw the cubes built by buildActorCubes() with one call.  Their colors
+// are packed 0xAABBGGRR, so in memory they are the bytes of an RGBA array.
+void drawActorCubes() {
+    if (g_actorColors.empty()) {
+        return;
+    }
+    glPushAttrib(GL_LIGHTING_BIT | GL_ENABLE_BIT);
+    glEnable(GL_COLOR_MATERIAL);
+    glColorMaterial(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE);
     glMaterialfv(GL_FRONT, GL_SPECULAR, matspec);
     glMaterialf(GL_FRONT, GL_SHININESS, 64.0);
-
-    glBegin(GL_POLYGON);
-    glColor3fv(color);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, color);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, color);
-    glNormal3f(0.0, -1.0, 0.0);
-    glVertex3f(1.0, -1.0, 1.0);
-    glVertex3f(-1.0, -1.0, 1.0);
-    glVertex3f(-1.0, -1.0, -1.0);
-    glVertex3f(1.0, -1.0, -1.0);
-    glEnd();
-
-    glPopMatrix();
+    glPushClientAttrib(GL_CLIENT_VERTEX_ARRAY_BIT);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_NORMAL_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, g_actorPositions.data());
+    glNormalPointer(GL_FLOAT, 0, g_actorNormals.data());
+    glColorPointer(4, GL_UNSIGNED_BYTE, 0, g_actorColors.data());
+    glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(g_actorColors.size()));
+    glPopClientAttrib();
+    glPopAttrib();
 }
+static float blu_col[] = {0.0, 0.0, 1.0};
+static float grey[] = {0.8, 0.8, 0.8};
+
 void draw_hallway(double radius) {
     glPushMatrix();
     glScaled(radius, radius, radius);
@@ -796,70 +811,3 @@ void draw_cube(double radius, float color[]) {
     glPopMatrix();
 }
 
-void draw_pound(double radius) {
-    glPushMatrix();
-    glScaled(radius, radius, radius);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, matspec);
-    glMaterialf(GL_FRONT, GL_SHININESS, 64.0);
-    glBegin(GL_POLYGON);
-    glColor3fv(grey);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, grey);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, grey);
-    glNormal3f(0.0, 0.0, -1.0);
-    glVertex3f(1.0, 1.0, -1.0);
-    glVertex3f(1.0, -1.0, -1.0);
-    glVertex3f(-1.0, -1.0, -1.0);
-    glVertex3f(-1.0, 1.0, -1.0);
-    glEnd();
-    glBegin(GL_POLYGON);
-    glColor3fv(grey);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, grey);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, grey);
-    glNormal3f(0.0, 0.0, 1.0);
-    glVertex3f(-1.0, 1.0, 1.0);
-    glVertex3f(-1.0, -1.0, 1.0);
-    glVertex3f(1.0, -1.0, 1.0);
-    glVertex3f(1.0, 1.0, 1.0);
-    glEnd();
-    glBegin(GL_POLYGON);
-    glColor3fv(grey);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, grey);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, grey);
-    glNormal3f(0.0, -1.0, 0.0);
-    glVertex3f(1.0, -1.0, 1.0);
-    glVertex3f(-1.0, -1.0, 1.0);
-    glVertex3f(-1.0, -1.0, -1.0);
-    glVertex3f(1.0, -1.0, -1.0);
-    glEnd();
-    glBegin(GL_POLYGON);
-    glColor3fv(grey);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, grey);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, grey);
-    glNormal3f(0.0, 1.0, 0.0);
-    glVertex3f(1.0, 1.0, 1.0);
-    glVertex3f(1.0, 1.0, -1.0);
-    glVertex3f(-1.0, 1.0, -1.0);
-    glVertex3f(-1.0, 1.0, 1.0);
-    glEnd();
-    glBegin(GL_POLYGON);
-    glColor3fv(grey);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, grey);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, grey);
-    glNormal3f(-1.0, 0.0, 0.0);
-    glVertex3f(-1.0, 1.0, 1.0);
-    glVertex3f(-1.0, 1.0, -1.0);
-    glVertex3f(-1.0, -1.0, -1.0);
-    glVertex3f(-1.0, -1.0, 1.0);
-    glEnd();
-    glBegin(GL_POLYGON);
-    glColor3fv(grey);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT, grey);
-    glMaterialfv(GL_FRONT_AND_BACK, GL_DIFFUSE, grey);
-    glNormal3f(1.0, 0.0, 0.0);
-    glVertex3f(1.0, -1.0, 1.0);
-    glVertex3f(1.0, -1.0, -1.0);
-    glVertex3f(1.0, 1.0, -1.0);
-    glVertex3f(1.0, 1.0, 1.0);
-    glEnd();
-    glPopMatrix();
-}
@@ -0,0 +1,967 @@
+/** @file
+    @brief Micro-benchmarks for the CPU-side hot paths of the map renderers:
+           map parsing, player search, quad emission, text layout, wall
+           face culling and pose math.  Results can be saved as JSON and
+           compared against a saved baseline.
+
+    @date 2026
+*/
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+// Internal Includes
+#include "AtlasMips.h"
+#include "DungeonGenerator.h"
+#include "FontQuads.h"
+#include "FrameScheduler.h"
+#include "MapGrid.h"
+#include "TextRunCache.h"
+#include "TextureCompression.h"
+#include <quat.h>
+
+// Library/third-party includes
+#include <freetype2/ft2build.h>
+#include FT_FREETYPE_H
+
+// Standard includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdlib.h> // For exit()
+#include <string>
+#include <vector>
+
+void Usage(std::string name)
+{
+    std::cerr << "Usage: " << name << " [-map FILE] [-font FILE] [-filter TEXT]"
+              << " [-minTime MS] [-json FILE] [-baseline FILE] [-threshold PCT]"
+              << std::endl;
+    std::cerr << "  -map: Map to parse and mesh (default: a generated 256x256 map)"
+              << std::endl;
+    std::cerr << "  -font: Font for the glyph benchmarks (default ./COURIER.TTF)"
+              << std::endl;
+    std::cerr << "  -filter: Only run benchmarks whose name contains TEXT"
+              << std::endl;
+    std::cerr << "  -minTime: Time each measurement for at least MS milliseconds"
+              << " (default 200)" << std::endl;
+    std::cerr << "  -json: Save the results to FILE" << std::endl;
+    std::cerr << "  -baseline: Compare against results saved earlier with -json"
+              << std::endl;
+    std::cerr << "  -threshold: Percent slower than the baseline that counts as"
+              << " a regression (default 10)" << std::endl;
+    exit(-1);
+}
+
+/// @brief What one benchmark measured.
+struct BenchResult {
+    std::string name;
+    double nsPerOp = 0;     ///< Best of the repetitions
+    double bytesPerOp = 0;  ///< Bytes read or written by one operation
+    size_t ops = 0;         ///< Operations in the best repetition
+};
+
+/// @brief Results are folded into this so that the compiler cannot throw
+/// away the work being timed.
+static volatile size_t g_sink = 0;
+
+/// @brief Times a body that performs a given number of operations.
+///
+///   The operation count is doubled until one run takes at least the
+/// minimum time, then the run is repeated and the fastest is kept, since
+/// the fastest run is the one least disturbed by the rest of the system.
+class BenchRunner {
+public:
+    typedef std::function<size_t(size_t ops)> Body;
+
+    BenchRunner(double minTimeMs, const std::string& filter)
+        : minTimeMs(minTimeMs), filter(filter) {}
+
+    void run(const std::string& name, double bytesPerOp, Body body) {
+        if (!filter.empty() && name.find(filter) == std::string::npos) {
+            return;
+        }
+        size_t ops = 1;
+        double seconds = time(body, ops);
+        while (seconds * 1000 < minTimeMs && ops < (size_t(1) << 40)) {
+            // Aim a little past the minimum so we usually only grow once more.
+            double scale = seconds > 0 ? 1.2 * minTimeMs / (seconds * 1000) : 10;
+            ops = static_cast<size_t>(ops * std::min(std::max(scale, 2.0), 100.0));
+            seconds = time(body, ops);
+        }
+        for (int rep = 1; rep < REPETITIONS; rep++) {
+            seconds = std::min(seconds, time(body, ops));
+        }
+
+        BenchResult r;
+        r.name = name;
+        r.nsPerOp = seconds * 1e9 / ops;
+        r.bytesPerOp = bytesPerOp;
+        r.ops = ops;
+        results.push_back(r);
+        std::cout << std::left << std::setw(28) << name << std::right
+                  << std::setw(14) << std::fixed << std::setprecision(2)
+                  << r.nsPerOp << " ns/op" << std::setw(12)
+                  << std::setprecision(0) << r.bytesPerOp << " B/op";
+        if (r.bytesPerOp > 0) {
+            std::cout << std::setw(10) << std::setprecision(2)
+                      << r.bytesPerOp / r.nsPerOp << " GB/s";
+        }
+        std::cout << std::endl;
+    }
+
+    const std::vector<BenchResult>& all() const { return results; }
+
+private:
+    enum { REPETITIONS = 5 };
+
+    double minTimeMs;
+    std::string filter;
+    std::vector<BenchResult> results;
+
+    static double time(Body& body, size_t ops) {
+        auto start = std::chrono::steady_clock::now();
+        g_sink += body(ops);
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() -
+                                             start).count();
+    }
+};
+
+//==========================================================================
+// JSON results.  One benchmark per line, so that the baseline reader below
+// does not need a general JSON parser.
+
+static bool writeJson(const std::string& fileName,
+                      const std::vector<BenchResult>& results)
+{
+    std::ofstream out(fileName.c_str());
+    if (!out.is_open()) {
+        return false;
+    }
+    out << "{\n  \"benchmarks\": [\n";
+    out << std::setprecision(6);
+    for (size_t i = 0; i < results.size(); i++) {
+        const BenchResult& r = results[i];
+        out << "    { \"name\": \"" << r.name << "\", \"ns_per_op\": "
+            << r.nsPerOp << ", \"bytes_per_op\": " << r.bytesPerOp
+            << ", \"ops\": " << r.ops << " }"
+            << (i + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+    return static_cast<bool>(out);
+}
+
+/// @brief Find a numeric field in a line written by writeJson().
+static bool jsonNumber(const std::string& line, const char* key, double& value)
+{
+    std::string pattern = std::string("\"") + key + "\":";
+    size_t at = line.find(pattern);
+    if (at == std::string::npos) {
+        return false;
+    }
+    value = strtod(line.c_str() + at + pattern.size(), nullptr);
+    return true;
+}
+
+/// @brief Read the ns/op of each benchmark from a file written by writeJson().
+static bool readBaseline(const std::string& fileName,
+                         std::map<std::string, double>& nsPerOp)
+{
+    std::ifstream in(fileName.c_str());
+    if (!in.is_open()) {
+        return false;
+    }
+    std::string line;
+    while (std::getline(in, line)) {
+        size_t at = line.find("\"name\": \"");
+        if (at == std::string::npos) {
+            continue;
+        }
+        at += strlen("\"name\": \"");
+        size_t end = line.find('"', at);
+        double ns;
+        if (end != std::string::npos && jsonNumber(line, "ns_per_op", ns)) {
+            nsPerOp[line.substr(at, end - at)] = ns;
+        }
+    }
+    return true;
+}
+
+/// @brief Print how each result compares with the baseline.
+/// @return The number of benchmarks slower than the threshold allows.
+static int compareBaseline(const std::vector<BenchResult>& results,
+                           const std::map<std::string, double>& baseline,
+                           double thresholdPercent)
+{
+    int regressions = 0;
+    std::cout << std::endl << "Against baseline (threshold " << thresholdPercent
+              << "%):" << std::endl;
+    for (const BenchResult& r : results) {
+        auto base = baseline.find(r.name);
+        if (base == baseline.end() || base->second <= 0) {
+            std::cout << std::left << std::setw(28) << r.name << "   (new)"
+                      << std::endl;
+            continue;
+        }
+        double change = 100 * (r.nsPerOp / base->second - 1);
+        bool regressed = change > thresholdPercent;
+        regressions += regressed ? 1 : 0;
+        std::cout << std::left << std::setw(28) << r.name << std::right
+                  << std::setw(14) << std::fixed << std::setprecision(2)
+                  << base->second << " -> " << std::setw(10) << r.nsPerOp
+                  << " ns/op " << std::showpos << std::setw(8)
+                  << std::setprecision(1) << change << "%" << std::noshowpos
+                  << (regressed ? "  REGRESSION" : "") << std::endl;
+    }
+    return regressions;
+}
+
+//==========================================================================
+// Map parsing and player search.
+
+/// @brief Read a map the way the examples originally did, one character at
+/// a time with ifstream::get(), filling a grid and noting the player.
+static size_t parseWithGet(const char* fileName, MapGrid& map)
+{
+    std::ifstream ifs(fileName, std::ifstream::in);
+    std::vector<std::string> lines(1);
+    char c;
+    while (ifs.get(c)) {
+        if (c == '\n') {
+            lines.emplace_back();
+        } else {
+            lines.back().push_back(c);
+        }
+    }
+    if (lines.back().empty()) {
+        lines.pop_back();
+    }
+    map.width = 0;
+    for (const std::string& l : lines) {
+        map.width = std::max(map.width, static_cast<int>(l.size()));
+    }
+    map.height = static_cast<int>(lines.size());
+    map.cells.assign(static_cast<size_t>(map.width) * map.height, ' ');
+    for (int r = 0; r < map.height; r++) {
+        std::copy(lines[r].begin(), lines[r].end(), &map.cells[r * map.width]);
+    }
+    return map.cells.size();
+}
+
+/// @brief Find the player with the first pass the examples used, reading
+/// the file with ifstream::get() and counting rows and columns.
+static size_t findPlayerWithGet(const char* fileName)
+{
+    std::ifstream ifs(fileName, std::ifstream::in);
+    size_t row = 0;
+    size_t col = 0;
+    char c;
+    while (ifs.get(c)) {
+        if (c == '@') {
+            return row * 65536 + col;
+        }
+        if (c == '\n') {
+            row++;
+            col = 0;
+        } else {
+            col++;
+        }
+    }
+    return 0;
+}
+
+/// @brief Find the player in text already in memory.
+static size_t findPlayerInText(const std::string& text)
+{
+    size_t at = text.find('@');
+    if (at == std::string::npos) {
+        return 0;
+    }
+    size_t lineStart = text.rfind('\n', at);
+    size_t col = (lineStart == std::string::npos) ? at : at - lineStart - 1;
+    size_t row = std::count(text.begin(), text.begin() + at, '\n');
+    return row * 65536 + col;
+}
+
+//==========================================================================
+// Atlas sampling: a software model of reading floor glyphs at a grazing
+// angle, where each pixel steps several texels down the glyph.
+
+/// @brief One bilinear sample of an 8-bit image, at texel coordinates.
+static int sampleBilinear(const uint8_t* image, int width, int height,
+                          float x, float y)
+{
+    x -= 0.5f;
+    y -= 0.5f;
+    int x0 = std::max(0, std::min(static_cast<int>(std::floor(x)), width - 1));
+    int y0 = std::max(0, std::min(static_cast<int>(std::floor(y)), height - 1));
+    int x1 = std::min(x0 + 1, width - 1);
+    int y1 = std::min(y0 + 1, height - 1);
+    float fx = x - std::floor(x);
+    float fy = y - std::floor(y);
+    float top = image[y0 * width + x0] * (1 - fx) + image[y0 * width + x1] * fx;
+    float bottom = image[y1 * width + x0] * (1 - fx) + image[y1 * width + x1] * fx;
+    return static_cast<int>(top * (1 - fy) + bottom * fy);
+}
+
+/// @brief Where sample i of the grazing floor walk lands, in level 0
+/// texels: down one column of each glyph in turn, step texels at a time.
+static void grazingSample(size_t i, int cell, int glyphs, int step,
+                          float& x, float& y)
+{
+    size_t perGlyph = cell / step;
+    x = static_cast<float>((i / perGlyph) % glyphs * cell + cell / 3) + 0.5f;
+    y = static_cast<float>((i % perGlyph) * step) + 0.5f;
+}
+
+/// @brief The average number of 4x4 texel tiles, of the kind GPUs store
+/// textures in, that a sample reads and the sample before it did not.
+static double newTilesPerSample(int width, int cell, int glyphs, int step,
+                                int level)
+{
+    const size_t SAMPLES = 4096;
+    std::vector<int> previous;
+    size_t fresh = 0;
+    int levelWidth = width >> level;
+    for (size_t i = 0; i < SAMPLES; i++) {
+        float x, y;
+        grazingSample(i, cell, glyphs, step, x, y);
+        x = x / (1 << level) - 0.5f;
+        y = y / (1 << level) - 0.5f;
+        std::vector<int> tiles;
+        for (int dy = 0; dy < 2; dy++) {
+            for (int dx = 0; dx < 2; dx++) {
+                int tx = std::max(0, static_cast<int>(std::floor(x)) + dx) / 4;
+                int ty = std::max(0, static_cast<int>(std::floor(y)) + dy) / 4;
+                int tile = ty * (levelWidth / 4 + 1) + tx;
+                if (std::find(tiles.begin(), tiles.end(), tile) == tiles.end()) {
+                    tiles.push_back(tile);
+                }
+            }
+        }
+        for (int tile : tiles) {
+            if (std::find(previous.begin(), previous.end(), tile) == previous.end()) {
+                fresh++;
+            }
+        }
+        previous.swap(tiles);
+    }
+    return static_cast<double>(fresh) / SAMPLES;
+}
+
+//==========================================================================
+// Pose math: the per-frame flying update, once with quatlib and once with
+// an inline scalar single-precision version of the same steps.  Neither is
+// vectorized; the float version shows what dropping quatlib's doubles and
+// matrix-based transforms is worth.
+
+/// @brief Rotate the forward and right vectors into world space and move
+/// the room, as the fly loop does each frame, using quatlib.
+static void flyStepQuatlib(q_xyz_quat_type& roomPose, const q_type head,
+                           double spin, double forward, double right)
+{
+    q_type rot;
+    q_from_axis_angle(rot, 0, 1, 0, spin);
+    q_mult(roomPose.quat, rot, roomPose.quat);
+
+    q_vec_type negZ = { 0, 0, -1 };
+    q_vec_type forwardDir;
+    q_xform(forwardDir, head, negZ);
+    q_xform(forwardDir, roomPose.quat, forwardDir);
+    q_vec_scale(forwardDir, forward, forwardDir);
+
+    q_vec_type X = { 1, 0, 0 };
+    q_vec_type rightDir;
+    q_xform(rightDir, head, X);
+    q_xform(rightDir, roomPose.quat, rightDir);
+    q_vec_scale(rightDir, right, rightDir);
+
+    for (int i = 0; i < 3; i++) {
+        roomPose.xyz[i] += forwardDir[i] + rightDir[i];
+    }
+}
+
+/// @brief Single-precision quaternion, stored x, y, z, w like quatlib.
+struct QuatF {
+    float v[4];
+};
+
+inline QuatF quatMult(const QuatF& a, const QuatF& b)
+{
+    QuatF r;
+    r.v[3] = a.v[3] * b.v[3] - a.v[0] * b.v[0] - a.v[1] * b.v[1] - a.v[2] * b.v[2];
+    r.v[0] = a.v[3] * b.v[0] + a.v[0] * b.v[3] + a.v[1] * b.v[2] - a.v[2] * b.v[1];
+    r.v[1] = a.v[3] * b.v[1] + a.v[1] * b.v[3] + a.v[2] * b.v[0] - a.v[0] * b.v[2];
+    r.v[2] = a.v[3] * b.v[2] + a.v[2] * b.v[3] + a.v[0] * b.v[1] - a.v[1] * b.v[0];
+    return r;
+}
+
+/// @brief Rotate a vector by a unit quaternion, using
+/// v' = v + 2w(q x v) + 2q x (q x v), which avoids building a matrix.
+inline void quatXform(float out[3], const QuatF& q, const float in[3])
+{
+    float t[3] = { 2 * (q.v[1] * in[2] - q.v[2] * in[1]),
+                   2 * (q.v[2] * in[0] - q.v[0] * in[2]),
+                   2 * (q.v[0] * in[1] - q.v[1] * in[0]) };
+    float x = in[0] + q.v[3] * t[0] + (q.v[1] * t[2] - q.v[2] * t[1]);
+    float y = in[1] + q.v[3] * t[1] + (q.v[2] * t[0] - q.v[0] * t[2]);
+    float z = in[2] + q.v[3] * t[2] + (q.v[0] * t[1] - q.v[1] * t[0]);
+    out[0] = x;
+    out[1] = y;
+    out[2] = z;
+}
+
+static void flyStepFloat(QuatF& roomRot, float roomPos[3], const QuatF& head,
+                         float spin, float forward, float right)
+{
+    QuatF rot = { { 0, std::sin(spin / 2), 0, std::cos(spin / 2) } };
+    roomRot = quatMult(rot, roomRot);
+
+    static const float negZ[3] = { 0, 0, -1 };
+    static const float X[3] = { 1, 0, 0 };
+    float forwardDir[3];
+    float rightDir[3];
+    quatXform(forwardDir, head, negZ);
+    quatXform(forwardDir, roomRot, forwardDir);
+    quatXform(rightDir, head, X);
+    quatXform(rightDir, roomRot, rightDir);
+    for (int i = 0; i < 3; i++) {
+        roomPos[i] += forwardDir[i] * forward + rightDir[i] * right;
+    }
+}
+
+//==========================================================================
+// Text: the layout and run cache that render_text() goes through, with
+// the glyph metrics read straight from FreeType and the runs kept in memory
+// rather than uploaded.
+
+/// @brief The metrics the fly example's glyph atlas holds, without the
+/// texture.
+struct BenchGlyphAtlas {
+    static const int FIRST_GLYPH = 32;
+    static const int NUM_GLYPHS = 95;
+    static const int COLUMNS = 16;
+
+    explicit BenchGlyphAtlas(FT_Face face) {
+        int cell = 1;
+        for (int i = 0; i < NUM_GLYPHS; i++) {
+            float* m = metrics + 4 * i;
+            m[0] = m[1] = m[2] = m[3] = advances[i] = 0;
+            if (FT_Load_Char(face, FIRST_GLYPH + i, FT_LOAD_RENDER)) {
+                continue;
+            }
+            FT_GlyphSlot g = face->glyph;
+            m[0] = static_cast<float>(g->bitmap_left);
+            m[1] = static_cast<float>(g->bitmap_top);
+            m[2] = static_cast<float>(g->bitmap.width);
+            m[3] = static_cast<float>(g->bitmap.rows);
+            advances[i] = static_cast<float>(g->advance.x / 64);
+            cell = std::max(cell, static_cast<int>(
+                std::max(g->bitmap.width, g->bitmap.rows)) + 2);
+        }
+        int rows = (NUM_GLYPHS + COLUMNS - 1) / COLUMNS;
+        texelU = 1.0f / (COLUMNS * cell);
+        texelV = 1.0f / (rows * cell);
+        cellU = cell * texelU;
+        cellV = cell * texelV;
+    }
+
+    const float* glyphMetrics() const { return metrics; }
+    const float* glyphAdvances() const { return advances; }
+    void glyphTexCoords(int index, float st[4]) const {
+        st[0] = (index % COLUMNS) * cellU;
+        st[1] = (index / COLUMNS) * cellV;
+        st[2] = st[0] + metrics[4 * index + 2] * texelU;
+        st[3] = st[1] + metrics[4 * index + 3] * texelV;
+    }
+
+    float metrics[4 * NUM_GLYPHS];
+    float advances[NUM_GLYPHS];
+    float cellU = 0;
+    float cellV = 0;
+    float texelU = 0;
+    float texelV = 0;
+};
+
+/// @brief Keeps each run's mesh in memory, where the fly example uploads
+/// it to a vertex buffer.
+struct MemoryTextRuns {
+    struct Run {
+        std::vector<FontVertex> vertices;
+    };
+    static void store(Run& run, const std::vector<FontVertex>& vertices) {
+        run.vertices = vertices;
+    }
+    static void release(Run& run) { run.vertices.clear(); }
+};
+
+//==========================================================================
+
+/// @brief Check that FrameScheduler finds the refresh period from presents
+/// that stall at startup, before any -jitStart frame depends on it.
+/// @param [in] stalls How many of the first intervals span three syncs.
+/// @return The error in the period it found, in seconds.
+static double frameSchedulerPeriodError(int stalls)
+{
+    const double period = 1.0 / 90;
+    FrameScheduler scheduler;
+    FrameScheduler::Clock::time_point shown;
+    for (int i = 0; i < 40; i++) {
+        int syncs = (i > 0 && i <= stalls) ? 3 : 1;
+        shown += std::chrono::duration_cast<FrameScheduler::Clock::duration>(
+            std::chrono::duration<double>(syncs * period));
+        scheduler.presented(shown, shown);
+    }
+    return std::abs(scheduler.refreshPeriod() - period);
+}
+
+int main(int argc, char* argv[])
+{
+    std::string mapFile;
+    std::string fontFile = "./COURIER.TTF";
+    std::string filter;
+    std::string jsonFile;
+    std::string baselineFile;
+    double minTimeMs = 200;
+    double thresholdPercent = 10;
+
+    // Parse the command line
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "-map" && i + 1 < argc) {
+            mapFile = argv[++i];
+        } else if (arg == "-font" && i + 1 < argc) {
+            fontFile = argv[++i];
+        } else if (arg == "-filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "-minTime" && i + 1 < argc) {
+            minTimeMs = atof(argv[++i]);
+        } else if (arg == "-json" && i + 1 < argc) {
+            jsonFile = argv[++i];
+        } else if (arg == "-baseline" && i + 1 < argc) {
+            baselineFile = argv[++i];
+        } else if (arg == "-threshold" && i + 1 < argc) {
+            thresholdPercent = atof(argv[++i]);
+        } else {
+            Usage(argv[0]);
+        }
+    }
+
+    // The benchmarks time code that must work, so check what is cheap to
+    // check before any of them run.
+    for (int stalls = 1; stalls <= 6; stalls++) {
+        double error = frameSchedulerPeriodError(stalls);
+        if (error > 1e-5) {
+            std::cerr << "FrameScheduler did not recover from " << stalls
+                      << " stalled presents (period off by " << error << " s)"
+                      << std::endl;
+            return 1;
+        }
+    }
+
+    // The parsers that read from disk need a file, so a generated map is
+    // written next to us for the length of the run.
+    std::string text;
+    bool removeMapFile = false;
+    if (mapFile.empty()) {
+        DungeonGenerator dungeon{ DungeonParams() };
+        text = dungeon.text();
+        mapFile = "microBenchmarks.map.tmp";
+        std::ofstream out(mapFile.c_str(), std::ofstream::binary);
+        out << text;
+        if (!out) {
+            std::cerr << "Could not write " << mapFile << std::endl;
+            return 1;
+        }
+        removeMapFile = true;
+    } else {
+        std::ifstream in(mapFile.c_str(), std::ifstream::binary);
+        if (!in.is_open()) {
+            std::cerr << "Could not open " << mapFile << std::endl;
+            return 1;
+        }
+        text.assign(std::istreambuf_iterator<char>(in),
+                    std::istreambuf_iterator<char>());
+    }
+    const char* mapName = mapFile.c_str();
+    MapGrid map;
+    map.parse(text);
+    std::cout << "Map: " << map.width << "x" << map.height << ", "
+              << text.size() << " bytes" << std::endl;
+
+    BenchRunner bench(minTimeMs, filter);
+    double mapBytes = static_cast<double>(text.size());
+
+    // Parsing, one whole map per operation.
+    bench.run("parse/ifstreamGet", mapBytes, [&](size_t ops) {
+        size_t sum = 0;
+        MapGrid m;
+        for (size_t i = 0; i < ops; i++) {
+            sum += parseWithGet(mapName, m);
+        }
+        return sum;
+    });
+    bench.run("parse/mapGridLoad", mapBytes, [&](size_t ops) {
+        size_t sum = 0;
+        MapGrid m;
+        for (size_t i = 0; i < ops; i++) {
+            m.load(mapName);
+            sum += m.cells.size();
+        }
+        return sum;
+    });
+    bench.run("parse/mapGridParse", mapBytes, [&](size_t ops) {
+        size_t sum = 0;
+        MapGrid m;
+        for (size_t i = 0; i < ops; i++) {
+            m.parse(text);
+            sum += m.cells.size();
+        }
+        return sum;
+    });
+
+    // Player search.  The bytes are those before the '@'.
+    double playerBytes = static_cast<double>(
+        std::min(text.find('@'), text.size()));
+    bench.run("findPlayer/ifstreamGet", playerBytes, [&](size_t ops) {
+        size_t sum = 0;
+        for (size_t i = 0; i < ops; i++) {
+            sum += findPlayerWithGet(mapName);
+        }
+        return sum;
+    });
+    bench.run("findPlayer/inMemory", playerBytes, [&](size_t ops) {
+        size_t sum = 0;
+        for (size_t i = 0; i < ops; i++) {
+            sum += findPlayerInText(text);
+        }
+        return sum;
+    });
+
+    // Quad emission, one quad per operation into a buffer that is reused
+    // the way render_text reuses its vertex vector.
+    const double quadBytes = 6 * sizeof(FontVertex);
+    enum { QUADS_PER_BATCH = 1024 };
+    std::vector<FontVertex> vertices;
+    vertices.reserve(6 * QUADS_PER_BATCH);
+    bench.run("quads/addFontQuad", quadBytes, [&](size_t ops) {
+        size_t sum = 0;
+        for (size_t i = 0; i < ops; i++) {
+            if (vertices.size() == 6 * QUADS_PER_BATCH) {
+                sum += vertices.size();
+                vertices.clear();
+            }
+            float x = static_cast<float>(i & 127);
+            addFontQuad(vertices, x, x + 1, 1, 0, -2, 1, 1, 1, 0);
+        }
+        vertices.clear();
+        return sum;
+    });
+    bench.run("quads/addFontQuadXZ", quadBytes, [&](size_t ops) {
+        size_t sum = 0;
+        for (size_t i = 0; i < ops; i++) {
+            if (vertices.size() == 6 * QUADS_PER_BATCH) {
+                sum += vertices.size();
+                vertices.clear();
+            }
+            float x = static_cast<float>(i & 127);
+            addFontQuadXZ(vertices, x, x + 1, 0, 1, 0, 1, 1, 1, 0);
+        }
+        vertices.clear();
+        return sum;
+    });
+    bench.run("quads/addFontQuadYZ", quadBytes, [&](size_t ops) {
+        size_t sum = 0;
+        for (size_t i = 0; i < ops; i++) {
+            if (vertices.size() == 6 * QUADS_PER_BATCH) {
+                sum += vertices.size();
+                vertices.clear();
+            }
+            float z = static_cast<float>(i & 127);
+            addFontQuadYZ(vertices, 0, 1, 0, z, z + 1, 1, 1, 1, 0);
+        }
+        vertices.clear();
+        return sum;
+    });
+
+    // The plane-specialized kernel writing runs of quads into a buffer that
+    // is already the right size, as the map meshers do.
+    vertices.resize(6 * QUADS_PER_BATCH);
+    bench.run("quads/emitFontQuadXY", quadBytes, [&](size_t ops) {
+        FontVertex* out = vertices.data();
+        for (size_t i = 0; i < ops; i++) {
+            if (i % QUADS_PER_BATCH == 0) {
+                out = vertices.data();
+            }
+            float x = static_cast<float>(i & 127);
+            out = emitFontQuad<XY>(out, x, x + 1, 0, 1, -2, 0, 0, 1, 1, 1, 1, 1, 0);
+        }
+        return static_cast<size_t>(out - vertices.data());
+    });
+    bench.run("quads/emitFontQuadXZ", quadBytes, [&](size_t ops) {
+        FontVertex* out = vertices.data();
+        for (size_t i = 0; i < ops; i++) {
+            if (i % QUADS_PER_BATCH == 0) {
+                out = vertices.data();
+            }
+            float x = static_cast<float>(i & 127);
+            out = emitFontQuad<XZ>(out, x, x + 1, 0, 1, 0, 0, 0, 1, 1, 1, 1, 1, 0);
+        }
+        return static_cast<size_t>(out - vertices.data());
+    });
+    bench.run("quads/emitFontQuadYZ", quadBytes, [&](size_t ops) {
+        FontVertex* out = vertices.data();
+        for (size_t i = 0; i < ops; i++) {
+            if (i % QUADS_PER_BATCH == 0) {
+                out = vertices.data();
+            }
+            float z = static_cast<float>(i & 127);
+            out = emitFontQuad<YZ>(out, z, z + 1, 0, 1, 0, 0, 0, 1, 1, 1, 1, 1, 0);
+        }
+        return static_cast<size_t>(out - vertices.data());
+    });
+    vertices.clear();
+
+    // The CPU side of render_text, one string per operation: finding a
+    // string's run in the cache, and laying out and storing one that is
+    // not there.  The bytes are the key that is hashed for a hit and the
+    // mesh that is built for a miss.
+    FT_Library ft = nullptr;
+    FT_Face face = nullptr;
+    if (FT_Init_FreeType(&ft) == 0 &&
+        FT_New_Face(ft, fontFile.c_str(), 0, &face) == 0) {
+        FT_Set_Pixel_Sizes(face, 0, 48);
+        static const char sample[] = "You feel the walls close in. #.@<>";
+        static const char* const strings[] = { sample, "HP 12(20)",
+                                               "You hit the kobold." };
+        const size_t STRINGS = sizeof(strings) / sizeof(strings[0]);
+        const float sx = 0.01f;
+        const float sy = 0.01f;
+        BenchGlyphAtlas atlas(face);
+        double keyBytes = 0;
+        double meshBytes = 0;
+        for (size_t s = 0; s < STRINGS; s++) {
+            keyBytes += std::strlen(strings[s]) + 2 * sizeof(float) + sizeof(int);
+            layoutText(atlas, strings[s], sx, sy, XY, vertices);
+            meshBytes += sizeof(FontVertex) * vertices.size();
+        }
+        keyBytes /= STRINGS;
+        meshBytes /= STRINGS;
+        vertices.clear();
+        {
+            TextRunCache<BenchGlyphAtlas, MemoryTextRuns> runs(atlas);
+            bench.run("text/renderTextHit", keyBytes, [&](size_t ops) {
+                size_t sum = 0;
+                for (size_t i = 0; i < ops; i++) {
+                    sum += runs.get(strings[i % STRINGS], sx, sy, XY)
+                               .vertices.size();
+                }
+                return sum;
+            });
+        }
+        {
+            // With no budget each string drops the one before, so every
+            // lookup misses, as when the strings drawn keep changing.
+            TextRunCache<BenchGlyphAtlas, MemoryTextRuns> runs(atlas);
+            runs.budget = 0;
+            bench.run("text/renderTextMiss", meshBytes, [&](size_t ops) {
+                size_t sum = 0;
+                for (size_t i = 0; i < ops; i++) {
+                    sum += runs.get(strings[i % STRINGS], sx, sy, XY)
+                               .vertices.size();
+                }
+                return sum;
+            });
+        }
+
+        // Baking the glyph atlas as RGTC1, one 4x4 block per operation,
+        // over the sample's glyphs packed side by side.
+        const int CELL = 64;
+        int stripWidth = CELL * static_cast<int>(sizeof(sample) - 1);
+        std::vector<uint8_t> strip(stripWidth * CELL, 0);
+        for (size_t i = 0; i + 1 < sizeof(sample); i++) {
+            if (FT_Load_Char(face, sample[i], FT_LOAD_RENDER)) {
+                continue;
+            }
+            const FT_Bitmap& bitmap = face->glyph->bitmap;
+            for (int r = 0; r < std::min<int>(bitmap.rows, CELL); r++) {
+                for (int c = 0; c < std::min<int>(bitmap.width, CELL); c++) {
+                    strip[r * stripWidth + CELL * i + c] =
+                        bitmap.buffer[r * bitmap.pitch + c];
+                }
+            }
+        }
+        std::vector<uint8_t> blocks(rgtc1Size(stripWidth, CELL));
+        size_t stripBlocks = blocks.size() / 8;
+        bench.run("atlas/encodeRgtc1", 16, [&](size_t ops) {
+            size_t sum = 0;
+            uint8_t texels[16];
+            for (size_t i = 0; i < ops; i++) {
+                size_t b = i % stripBlocks;
+                int bx = static_cast<int>(b % (stripWidth / 4));
+                int by = static_cast<int>(b / (stripWidth / 4));
+                for (int r = 0; r < 4; r++) {
+                    std::memcpy(texels + 4 * r,
+                                &strip[(4 * by + r) * stripWidth + 4 * bx], 4);
+                }
+                encodeRgtc1Block(texels, &blocks[8 * b]);
+                sum += blocks[8 * b];
+            }
+            return sum;
+        });
+
+        // Floor glyphs at a grazing angle, eight texels per pixel, sampled
+        // from the full-size strip as without mipmaps, and from the level
+        // that matches the step as trilinear filtering would.  One sample
+        // per operation; the bytes are the new 4x4 tiles each sample reads,
+        // which is what the texture cache has to fetch.
+        const int GRAZING_STEP = 8;
+        const int GRAZING_LEVEL = 3;
+        int glyphCount = static_cast<int>(sizeof(sample) - 1);
+        std::vector<std::vector<uint8_t> > chain(1, strip);
+        buildMipChain(chain, stripWidth, CELL, GRAZING_LEVEL);
+        for (int level = 0; level <= GRAZING_LEVEL; level += GRAZING_LEVEL) {
+            const std::vector<uint8_t>& image = chain[level];
+            int w = stripWidth >> level;
+            int h = CELL >> level;
+            double tileBytes = 16 * newTilesPerSample(stripWidth, CELL, glyphCount,
+                                                      GRAZING_STEP, level);
+            bench.run(level == 0 ? "atlas/grazingFloorLevel0"
+                                 : "atlas/grazingFloorMipmapped",
+                      tileBytes, [&](size_t ops) {
+                size_t sum = 0;
+                float scale = 1.0f / (1 << level);
+                for (size_t i = 0; i < ops; i++) {
+                    float x, y;
+                    grazingSample(i, CELL, glyphCount, GRAZING_STEP, x, y);
+                    sum += sampleBilinear(image.data(), w, h, x * scale,
+                                          y * scale);
+                }
+                return sum;
+            });
+        }
+        FT_Done_Face(face);
+    } else {
+        std::cerr << "Could not load font " << fontFile
+                  << ", skipping text benchmarks" << std::endl;
+    }
+    if (ft) {
+        FT_Done_FreeType(ft);
+    }
+
+    // Wall face culling over the whole map, one cell per operation.
+    size_t cellCount = map.cells.size();
+    bench.run("mesh/wallFaceCulling", 1, [&](size_t ops) {
+        size_t shown = 0;
+        size_t cell = 0;
+        for (size_t i = 0; i < ops; i++) {
+            int row = static_cast<int>(cell / map.width);
+            int col = static_cast<int>(cell % map.width);
+            if (tileKindFor(map.cells[cell]) == TILE_WALL) {
+                for (int f = 0; f < 4; f++) {
+                    shown += map.wallFaceShown(row, col, f) ? 1 : 0;
+                }
+            }
+            if (++cell == cellCount) {
+                cell = 0;
+            }
+        }
+        return shown;
+    });
+
+    // Pose math, one flying update per operation.
+    q_type head;
+    q_from_axis_angle(head, 0.3, 1, 0.1, 0.7);
+    q_normalize(head, head);
+    bench.run("pose/quatlib", sizeof(q_xyz_quat_type) + sizeof(q_type),
+              [&](size_t ops) {
+        q_xyz_quat_type room = { { 0, 0, 0 }, { 0, 0, 0, 1 } };
+        for (size_t i = 0; i < ops; i++) {
+            flyStepQuatlib(room, head, 0.001, 0.01, 0.02);
+        }
+        return static_cast<size_t>(room.xyz[0] + room.xyz[2]);
+    });
+    QuatF headF = { { static_cast<float>(head[Q_X]), static_cast<float>(head[Q_Y]),
+                      static_cast<float>(head[Q_Z]), static_cast<float>(head[Q_W]) } };
+    {
+        // The two must fly the same way for their times to be comparable.
+        // The room starts tilted so that the spins do not commute with it.
+        q_xyz_quat_type room = { { 0, 0, 0 }, { 0, 0, 0, 1 } };
+        q_from_axis_angle(room.quat, 1, 0, 0.3, 0.4);
+        QuatF roomF = { { static_cast<float>(room.quat[Q_X]),
+                          static_cast<float>(room.quat[Q_Y]),
+                          static_cast<float>(room.quat[Q_Z]),
+                          static_cast<float>(room.quat[Q_W]) } };
+        float pos[3] = { 0, 0, 0 };
+        for (int i = 0; i < 100; i++) {
+            flyStepQuatlib(room, head, 0.01, 0.01, 0.02);
+            flyStepFloat(roomF, pos, headF, 0.01f, 0.01f, 0.02f);
+        }
+        double error = 0;
+        for (int i = 0; i < 3; i++) {
+            error = std::max(error, std::abs(room.xyz[i] - pos[i]));
+        }
+        for (int i = 0; i < 4; i++) {
+            error = std::max(error, std::abs(room.quat[i] - roomF.v[i]));
+        }
+        if (error > 1e-4) {
+            std::cerr << "pose/scalarFloat does not match pose/quatlib (off by "
+                      << error << ")" << std::endl;
+            if (removeMapFile) {
+                std::remove(mapName);
+            }
+            return 1;
+        }
+    }
+    bench.run("pose/scalarFloat", sizeof(QuatF) * 2 + 3 * sizeof(float),
+              [&](size_t ops) {
+        QuatF room = { { 0, 0, 0, 1 } };
+        float pos[3] = { 0, 0, 0 };
+        for (size_t i = 0; i < ops; i++) {
+            flyStepFloat(room, pos, headF, 0.001f, 0.01f, 0.02f);
+        }
+        return static_cast<size_t>(pos[0] + pos[2]);
+    });
+
+    if (removeMapFile) {
+        std::remove(mapName);
+    }
+
+    if (!jsonFile.empty()) {
+        if (!writeJson(jsonFile, bench.all())) {
+            std::cerr << "Could not write " << jsonFile << std::endl;
+            return 1;
+        }
+        std::cout << "Wrote " << jsonFile << std::endl;
+    }
+    if (!baselineFile.empty()) {
+        std::map<std::string, double> baseline;
+        if (!readBaseline(baselineFile, baseline)) {
+            std::cerr << "Could not read baseline " << baselineFile << std::endl;
+            return 1;
+        }
+        int regressions = compareBaseline(bench.all(), baseline, thresholdPercent);
+        if (regressions > 0) {
+            std::cout << regressions << " benchmark(s) regressed" << std::endl;
+            return 2;
+        }
+    }
+    return 0;
+}